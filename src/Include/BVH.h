@@ -0,0 +1,100 @@
+#pragma once
+
+#include "pch.h"
+
+#include "Box.h"
+#include "Utils.h"
+
+namespace gm
+{
+    /*!
+    \brief Bounding volume hierarchy over a set of boxes, answering nearest first queries.
+
+    Items are the indices of the boxes given to BVH::build.
+    */
+    class BVH
+    {
+    public:
+        BVH() = default;
+
+        void build(const std::vector<Box> &boxes, const std::vector<int> &items);
+
+        bool empty() const;
+        Box box() const;
+
+        template <typename Distance, typename Visit>
+        void traverse(const Distance &distance, const Visit &visit, const float &threshold) const;
+
+    private:
+        int build(int first, int last);
+
+    private:
+        //! Leaves reference count items from first, inner cells have their left child stored next to them.
+        struct Cell
+        {
+            Box box;
+            int first{0}, count{0};
+            int right{0};
+        };
+
+        static const int s_leaf_size; //!< Maximum number of items in a leaf.
+        static const int s_stack;     //!< Traversal stack size.
+
+        std::vector<Cell> m_cells; //!< Root first.
+        std::vector<int> m_items;  //!< Items in leaf order.
+        std::vector<Box> m_boxes;  //!< Boxes of the items, in leaf order.
+    };
+
+    /*!
+    \brief Visit the items nearest first.
+
+    Cells and items at a distance greater than or equal to the threshold are skipped, unless they overlap the query.
+    \param distance Lower bound of the distance to a box, distance(const Box &) -> float.
+    \param visit Called with every visited item, may lower the threshold.
+    \param threshold Culling distance, read again after every visit.
+    */
+    template <typename Distance, typename Visit>
+    void BVH::traverse(const Distance &distance, const Visit &visit, const float &threshold) const
+    {
+        if (m_cells.empty())
+            return;
+
+        int stack[s_stack];
+        float distances[s_stack];
+        int sp = 0;
+        stack[sp] = 0;
+        distances[sp++] = distance(m_cells[0].box);
+
+        while (sp > 0)
+        {
+            sp--;
+            if (distances[sp] > 0.f && distances[sp] >= threshold)
+                continue;
+
+            const Cell &cell = m_cells[stack[sp]];
+            if (cell.count > 0)
+            {
+                for (int i = cell.first; i < cell.first + cell.count; i++)
+                {
+                    const float d = distance(m_boxes[i]);
+                    if (d <= 0.f || d < threshold)
+                        visit(m_items[i]);
+                }
+                continue;
+            }
+
+            // Push the farthest child first, so that the nearest one is visited next
+            int a = stack[sp] + 1, b = cell.right;
+            float da = distance(m_cells[a].box), db = distance(m_cells[b].box);
+            if (db < da)
+            {
+                std::swap(a, b);
+                std::swap(da, db);
+            }
+            stack[sp] = b;
+            distances[sp++] = db;
+            stack[sp] = a;
+            distances[sp++] = da;
+        }
+    }
+} // namespace gm
@@ -47,6 +47,11 @@ namespace gm
         bool inside(const Box &) const;
         bool inside(const Vector &) const;
 
+        float distance(const Vector &) const;
+        float distance(const Box &) const;
+
+        bool intersect(const Vector &, const Vector &, float &, float &) const;
+
         float volume() const;
         float area() const;
 
@@ -185,6 +190,58 @@ namespace gm
         return ((m_a < p) && (m_b > p));
     }
 
+    /*!
+    \brief Compute the distance between m_a point and the box, 0 inside.
+    \param p Point.
+    */
+    inline float Box::distance(const Vector &p) const
+    {
+        Vector d(0.0);
+        for (int i = 0; i < 3; i++)
+            d(i) = std::max(std::max(m_a(i) - p(i), p(i) - m_b(i)), 0.0f);
+        return length(d);
+    }
+
+    /*!
+    \brief Compute the distance between two boxes, 0 if they overlap.
+    \param box The box.
+    */
+    inline float Box::distance(const Box &box) const
+    {
+        Vector d(0.0);
+        for (int i = 0; i < 3; i++)
+            d(i) = std::max(std::max(m_a(i) - box.m_b(i), box.m_a(i) - m_b(i)), 0.0f);
+        return length(d);
+    }
+
+    /*!
+    \brief Compute the interval of a ray inside the box.
+    \param o, d Origin and direction of the ray.
+    \param t_in, t_out Returned entry and exit distances along the ray, in units of the direction.
+    \return False if the line misses the box.
+    */
+    inline bool Box::intersect(const Vector &o, const Vector &d, float &t_in, float &t_out) const
+    {
+        t_in = -FLT_MAX;
+        t_out = FLT_MAX;
+        for (int i = 0; i < 3; i++)
+        {
+            if (d(i) == 0.0f)
+            {
+                if (o(i) < m_a(i) || o(i) > m_b(i))
+                    return false;
+                continue;
+            }
+            float t0 = (m_a(i) - o(i)) / d(i);
+            float t1 = (m_b(i) - o(i)) / d(i);
+            if (t0 > t1)
+                std::swap(t0, t1);
+            t_in = std::max(t_in, t0);
+            t_out = std::min(t_out, t1);
+        }
+        return t_in <= t_out;
+    }
+
     /*!
     \brief Check if two boxes are (strictly) equal.
     \param m_a, m_b Boxes.
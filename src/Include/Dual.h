@@ -0,0 +1,58 @@
+#pragma once
+
+#include "pch.h"
+
+#include "Simd.h"
+
+namespace gm
+{
+    /*!
+    \brief Value and gradient of a scalar function of a point, for forward mode automatic differentiation.
+
+    The SDF kernels instantiated on Dual propagate the gradient with respect to the evaluated point
+    alongside the value, see SDFNode::value_dual.
+    */
+    struct Dual
+    {
+        Dual() = default;
+        Dual(float x) : v(x) {}
+        Dual(float x, const Vector &g) : v(x), d(g) {}
+
+        //! Coordinate i of a point, as a variable of the differentiation.
+        static Dual variable(float x, int i)
+        {
+            Vector g(0, 0, 0);
+            g(i) = 1.f;
+            return Dual(x, g);
+        }
+
+        float v{0.f};
+        Vector d{0, 0, 0}; //!< Gradient.
+    };
+
+    inline Dual operator+(const Dual &a, const Dual &b) { return Dual(a.v + b.v, a.d + b.d); }
+    inline Dual operator-(const Dual &a, const Dual &b) { return Dual(a.v - b.v, a.d - b.d); }
+    inline Dual operator-(const Dual &a) { return Dual(-a.v, -a.d); }
+    inline Dual operator*(const Dual &a, const Dual &b) { return Dual(a.v * b.v, b.v * a.d + a.v * b.d); }
+    inline Dual operator/(const Dual &a, const Dual &b) { return Dual(a.v / b.v, (b.v * a.d - a.v * b.d) / (b.v * b.v)); }
+
+    //! Value part of either number type.
+    inline float primal(float a) { return a; }
+    inline float primal(const Dual &a) { return a.v; }
+} // namespace gm
+
+//! Dual overloads of the functions used by the SDF kernels.
+namespace simd
+{
+    inline gm::Dual min(const gm::Dual &a, const gm::Dual &b) { return b.v < a.v ? b : a; }
+    inline gm::Dual max(const gm::Dual &a, const gm::Dual &b) { return a.v < b.v ? b : a; }
+    inline gm::Dual abs(const gm::Dual &a) { return a.v < 0.f ? -a : a; }
+    inline gm::Dual floor(const gm::Dual &a) { return gm::Dual(std::floor(a.v)); }
+    inline gm::Dual round(const gm::Dual &a) { return gm::Dual(std::round(a.v)); }
+
+    inline gm::Dual sqrt(const gm::Dual &a)
+    {
+        const float s = std::sqrt(a.v);
+        return gm::Dual(s, s > 0.f ? a.d * (0.5f / s) : Vector(0, 0, 0));
+    }
+} // namespace simd
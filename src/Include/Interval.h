@@ -0,0 +1,71 @@
+#pragma once
+
+#include "pch.h"
+
+#include "Box.h"
+#include "Simd.h"
+
+namespace gm
+{
+    /*!
+    \brief Range [lo, hi] of a real quantity.
+
+    Arithmetic follows the natural interval extension, so that the SDF kernels instantiated on
+    Interval return a conservative range of the field over a box. Bounds are not rounded outward.
+    */
+    struct Interval
+    {
+        Interval() = default;
+        Interval(float x) : lo(x), hi(x) {}
+        Interval(float l, float h) : lo(l), hi(h) {}
+
+        //! Range of the i-th coordinate of a box.
+        static Interval axis(const Box &box, int i) { return Interval(box[0](i), box[1](i)); }
+
+        bool contains(float x) const { return lo <= x && x <= hi; }
+
+        float lo{0.f}, hi{0.f};
+    };
+
+    inline Interval operator+(Interval a, Interval b) { return Interval(a.lo + b.lo, a.hi + b.hi); }
+    inline Interval operator-(Interval a, Interval b) { return Interval(a.lo - b.hi, a.hi - b.lo); }
+    inline Interval operator-(Interval a) { return Interval(-a.hi, -a.lo); }
+
+    inline Interval operator*(Interval a, Interval b)
+    {
+        float p[] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+        return Interval(std::min({p[0], p[1], p[2], p[3]}), std::max({p[0], p[1], p[2], p[3]}));
+    }
+
+    inline Interval operator/(Interval a, Interval b)
+    {
+        if (b.contains(0.f))
+            return Interval(-FLT_MAX, FLT_MAX);
+        return a * Interval(1.f / b.hi, 1.f / b.lo);
+    }
+} // namespace gm
+
+//! Interval overloads of the functions used by the SDF kernels.
+namespace simd
+{
+    inline gm::Interval min(gm::Interval a, gm::Interval b) { return gm::Interval(std::min(a.lo, b.lo), std::min(a.hi, b.hi)); }
+    inline gm::Interval max(gm::Interval a, gm::Interval b) { return gm::Interval(std::max(a.lo, b.lo), std::max(a.hi, b.hi)); }
+    inline gm::Interval sqrt(gm::Interval a) { return gm::Interval(std::sqrt(std::max(a.lo, 0.f)), std::sqrt(std::max(a.hi, 0.f))); }
+    inline gm::Interval floor(gm::Interval a) { return gm::Interval(std::floor(a.lo), std::floor(a.hi)); }
+    inline gm::Interval round(gm::Interval a) { return gm::Interval(std::round(a.lo), std::round(a.hi)); }
+
+    inline gm::Interval abs(gm::Interval a)
+    {
+        if (a.lo >= 0.f)
+            return a;
+        if (a.hi <= 0.f)
+            return -a;
+        return gm::Interval(0.f, std::max(-a.lo, a.hi));
+    }
+
+    inline gm::Interval square(gm::Interval a)
+    {
+        a = abs(a);
+        return gm::Interval(a.lo * a.lo, a.hi * a.hi);
+    }
+} // namespace simd
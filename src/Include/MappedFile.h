@@ -0,0 +1,36 @@
+#pragma once
+
+#include "pch.h"
+
+#include "Utils.h"
+
+/*!
+\brief Read only memory mapping of a file.
+
+Mapping is immediate whatever the size of the file, its pages are read lazily by the system
+on first access and shared between the processes mapping the same file.
+*/
+class MappedFile
+{
+public:
+    explicit MappedFile(const char *filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    static Ref<MappedFile> create(const char *filename);
+
+    bool valid() const;
+    const unsigned char *data() const;
+    size_t size() const;
+
+private:
+    const unsigned char *m_data{nullptr};
+    size_t m_size{0};
+
+#ifdef _WIN32
+    void *m_file{nullptr};    //!< File handle.
+    void *m_mapping{nullptr}; //!< File mapping handle.
+#endif
+};
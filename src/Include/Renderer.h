@@ -0,0 +1,69 @@
+#pragma once
+
+#include "pch.h"
+
+#include "SDF.h"
+#include "ThreadPool.h"
+
+#include "image.h"
+#include "orbiter.h"
+
+namespace gm
+{
+    enum class RenderOutput
+    {
+        SHADED = 0, //!< Diffuse shading, lit from the camera.
+        DEPTH,      //!< Distance to the camera, from white for the nearest hit to black for the farthest one.
+        NORMAL,     //!< Normals mapped to colors.
+        STEPS,      //!< Heatmap of the number of steps of each ray, from blue to red.
+        NB_ELT
+    };
+
+    /*!
+    \brief Headless sphere tracing renderer of SDF trees, a preview that does not need a polygonization nor a GPU.
+
+    The image is split into square tiles handed out dynamically to a thread pool. A cone pre-pass finds
+    how far each block of pixels of a tile can skip, then the pixels of a block are traced as a single packet
+    with SDFNode::trace. A render fills every RenderOutput at once.
+    */
+    class Renderer
+    {
+    public:
+        Renderer(int width, int height, int threads = 0);
+
+        static Ref<Renderer> create(int width, int height, int threads = 0);
+
+        int width() const;
+        int height() const;
+
+        RayQuery &query();
+
+        void tile_size(int size);
+        int tile_size() const;
+
+        void cone_size(int size);
+        int cone_size() const;
+
+        void render(const SDFTree &tree, const Orbiter &camera, float fov = 45.f);
+
+        const Image &image(RenderOutput output) const;
+        int write(RenderOutput output, const char *filename) const;
+
+        float average_steps() const;
+
+    private:
+        int render_tile(const SDFTree &tree, int tile, const RayQuery &query, const Point &origin, const Point &plane, const Vector &dx, const Vector &dy);
+
+    private:
+        int m_width, m_height;
+        int m_tile_size{16};
+        int m_cone_size{8};                                //!< Size of the pixel blocks of the cone pre-pass, 0 to disable it.
+        RayQuery m_query;                                  //!< Tracing parameters, the tolerance also grows with the pixel footprint.
+        Ref<ThreadPool> m_pool;
+
+        std::vector<float> m_depth;                        //!< Distance to the camera of the hits, negative for misses.
+        std::vector<int> m_steps;
+        long long m_cone_steps{0};
+        Image m_images[static_cast<int>(RenderOutput::NB_ELT)];
+    };
+} // namespace gm
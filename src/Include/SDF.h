@@ -2,7 +2,12 @@
 
 #include "pch.h"
 
+#include "BVH.h"
 #include "Box.h"
+#include "Interval.h"
+#include "MappedFile.h"
+#include "SDFProgram.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 
 /*
@@ -15,6 +20,8 @@ d= length(P - A - h * ab)
 
 namespace gm
 {
+    class SDFTree;
+
     struct Ray
     {
         Point origin{0, 0, 0};
@@ -23,10 +30,84 @@ namespace gm
         Point point(float t) const;
     };
 
+    enum class RayStatus
+    {
+        HIT = 0,
+        MISS_DISTANCE, //!< Went past the maximum distance.
+        MISS_STEPS,    //!< Ran out of steps before converging, usually along grazing surfaces.
+        NB_ELT
+    };
+
+    //! Parameters of SDFNode::trace.
+    struct RayQuery
+    {
+        float t_min{0.f};          //!< Distance along the ray where marching starts, known to be free of surface.
+        float t_max{100.f};        //!< Maximum distance along the ray.
+        float epsilon{1e-3f};      //!< Field value below which the ray hits the surface.
+        float epsilon_slope{0.f};  //!< Growth of the tolerance with the distance, typically the footprint of a pixel.
+        float relaxation{1.f};     //!< Over-relaxation factor of the steps in [1, 2), 1 for plain sphere tracing.
+        int steps{256};            //!< Maximum number of steps.
+        bool clip{true};           //!< March only between the entry and the exit of the ray in the bounds of the node.
+        bool normal{true};         //!< Compute the normal at the hit point.
+    };
+
+    //! Result of SDFNode::trace.
+    struct RayHit
+    {
+        float t{0.f}; //!< Distance along the ray of the hit point, or of the last step for a miss.
+        Point point{0, 0, 0};
+        Vector normal{0, 0, 0};
+        int steps{0};     //!< Number of field evaluations.
+        int fallbacks{0}; //!< Number of over-relaxed steps taken back.
+        RayStatus status{RayStatus::MISS_STEPS};
+
+        bool hit() const;
+    };
+
     enum class IntersectMethod
     {
         RAY_MARCHING = 0,
         SPHERE_TRACING,
+        ENHANCED_SPHERE_TRACING, //!< Over-relaxed steps, clipped to the bounds, with a tolerance growing with the distance.
+        NB_ELT
+    };
+
+    enum class PolygonizeMethod
+    {
+        UNIFORM = 0,     //!< Marching cubes over every cell of the grid.
+        OCTREE,          //!< Marching cubes over the cells kept by an octree culling empty space.
+        CONTINUATION,    //!< Marching cubes flooding the cells crossed by the surface from seed cells.
+        DUAL_CONTOURING, //!< One vertex per cell crossed by the surface, placed on the sharp features.
+        NB_ELT
+    };
+
+    enum class NormalMethod
+    {
+        GRADIENT = 0, //!< Gradient of the field at every vertex, see SDFTree::normal.
+        LATTICE,      //!< Interpolated from the field samples of the polygonization grid, without extra evaluation.
+        NB_ELT
+    };
+
+    enum class RefineMethod
+    {
+        BISECTION = 0, //!< Halve the segment down to the tolerance, a fixed number of evaluations.
+        LINEAR,        //!< Interpolate the end values linearly, without evaluation.
+        REGULA_FALSI,  //!< Illinois false position, until the field is below the tolerance.
+        NEWTON,        //!< Newton steps along the segment with the gradient, bracketed by bisection.
+        NB_ELT
+    };
+
+    enum class GridInterpolation
+    {
+        TRILINEAR = 0, //!< Eight samples around the point, continuous values.
+        TRICUBIC,      //!< Catmull-Rom splines through 64 samples, continuous gradients.
+        NB_ELT
+    };
+
+    enum class GridStorage
+    {
+        DENSE = 0, //!< One float per sample.
+        SPARSE,    //!< Bricks of half floats in a narrow band around the surface, a single bound elsewhere.
         NB_ELT
     };
 
@@ -43,6 +124,7 @@ namespace gm
         PRIMITIVE_ELLIPSOID,
         PRIMITIVE_OCTAHEDRON,
         PRIMITIVE_PYRAMID,
+        PRIMITIVE_GRID,
         UNARY_OPERATOR_HULL,
         UNARY_OPERATOR_ROUNDING,
         UNARY_OPERATOR_ELONGATION,
@@ -54,30 +136,54 @@ namespace gm
         BINARY_OPERATOR_SMOOTH_INTERSECTION,
         BINARY_OPERATOR_SUBSTRACTION,
         BINARY_OPERATOR_SMOOTH_SUBSTRACTION,
+        NARY_OPERATOR_UNION,
+        NARY_OPERATOR_SMOOTH_UNION,
         TRANSFORM_TRANSLATION,
         TRANSFORM_ROTATION,
         TRANSFORM_ROTATION_X,
         TRANSFORM_ROTATION_Y,
         TRANSFORM_ROTATION_Z,
         TRANSFORM_SCALE,
+        TRANSFORM_AFFINE,
+        TRANSFORM_INSTANCES,
         NB_ELT
     };
 
     /************************** SDF Node ******************************/
 
-    class SDFNode
+    class SDFNode : public std::enable_shared_from_this<SDFNode>
     {
     public:
         SDFNode(float lambda = 1.0, IntersectMethod method = IntersectMethod::RAY_MARCHING);
         virtual ~SDFNode() = default;
 
         virtual float value(const Point &p) const;
+        virtual void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const;
+        virtual Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const;
         virtual bool inside(const Point &p) const;
         virtual Vector gradient(const Point &p) const;
+        Dual value_gradient(const Point &p) const;
         virtual bool intersect(const Ray &ray, float eps) const;
+        RayHit trace(const Ray &ray, const RayQuery &query = {}) const;
+        void trace(std::span<const Ray> rays, std::span<RayHit> hits, const RayQuery &query = {}) const;
+        RayHit cone_march(const Ray &ray, float slope, const RayQuery &query = {}) const;
 
         void intersect_method(IntersectMethod method);
 
+        virtual void compile(SDFProgram &program) const;
+
+        virtual Interval interval(const Box &box) const;
+        virtual Ref<SDFNode> prune(const Box &box, Interval &range);
+
+        virtual Box bounds() const;
+        virtual bool conservative_bounds() const;
+        static bool bounded(const Box &box);
+
+        virtual float lipschitz() const;
+
+        virtual Ref<SDFNode> optimize();
+        virtual uint64_t fingerprint() const;
+
         virtual Ref<SDFNode> left();
         virtual Ref<SDFNode> right();
 
@@ -88,14 +194,23 @@ namespace gm
 
         virtual SDFType type() const = 0;
 
+    protected:
+        uint64_t hash(std::initializer_list<float> params, std::initializer_list<uint64_t> children = {}) const;
+        static void edited();
+
     private:
         bool intersect_ray_marching(const Ray &ray, float eps = 1e-3) const;
         bool intersect_sphere_tracing(const Ray &ray, float t) const;
+        bool intersect_enhanced_sphere_tracing(const Ray &ray, float eps) const;
 
     protected:
         static const float s_epsilon; //!< Epsilon value for partial derivatives
         static const int s_limit;     //!< Epsilon value for intersection limit
-        static int s_value_call_count;
+        static const float s_relaxation;    //!< Over-relaxation factor of IntersectMethod::ENHANCED_SPHERE_TRACING.
+        static const float s_epsilon_slope; //!< Growth of the tolerance with the distance of IntersectMethod::ENHANCED_SPHERE_TRACING.
+        static thread_local int s_value_call_count; //!< Counted per thread, parallel algorithms gather their workers count.
+        static const Box s_unbounded;               //!< Bounds of nodes with an infinite surface.
+        static std::atomic<uint64_t> s_generation;  //!< Number of calls to the parameter accessors, see SDFTree::compile.
 
     protected:
         float m_lambda{1.0};
@@ -116,8 +231,24 @@ namespace gm
         Ref<SDFNode> left() override;
         Ref<SDFNode> right() override;
 
+        bool conservative_bounds() const override;
+        float lipschitz() const override;
+        uint64_t fingerprint() const override;
+
         virtual SDFType type() const = 0;
 
+    protected:
+        //! Copy of the node applied to another operand, or the node itself if the operand is unchanged.
+        template <typename Node>
+        Ref<SDFNode> rebuild(const Ref<SDFNode> &node)
+        {
+            if (node == m_node)
+                return shared_from_this();
+            Ref<Node> copy = create_ref<Node>(static_cast<const Node &>(*this));
+            copy->m_node = node;
+            return copy;
+        }
+
     protected:
         Ref<SDFNode> m_node;
     };
@@ -133,6 +264,14 @@ namespace gm
         static Ref<SDFHull> create(const Ref<SDFNode> &n, float thickness, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const override;
 
@@ -153,11 +292,23 @@ namespace gm
         static Ref<SDFRepetition> create(const Ref<SDFNode> &n, float t, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const override;
 
         float& t();
 
+    private:
+        Box local(const Box &box) const;
+
     private:
         float m_t; 
     };
@@ -175,8 +326,24 @@ namespace gm
         Ref<SDFNode> left() override;
         Ref<SDFNode> right() override;
 
+        float lipschitz() const override;
+        uint64_t fingerprint() const override;
+
         virtual SDFType type() const = 0;
 
+    protected:
+        //! Copy of the node applied to other operands, or the node itself if the operands are unchanged.
+        template <typename Node>
+        Ref<SDFNode> rebuild(const Ref<SDFNode> &left, const Ref<SDFNode> &right)
+        {
+            if (left == m_left && right == m_right)
+                return shared_from_this();
+            Ref<Node> copy = create_ref<Node>(static_cast<const Node &>(*this));
+            copy->m_left = left;
+            copy->m_right = right;
+            return copy;
+        }
+
     protected:
         Ref<SDFNode> m_left, m_right;
     };
@@ -191,6 +358,8 @@ namespace gm
 
         virtual float value(const Point &p) const = 0;
 
+        uint64_t fingerprint() const override;
+
         virtual SDFType type() const = 0;
 
         float &k();
@@ -210,6 +379,14 @@ namespace gm
         static Ref<SDFUnion> create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
 
         SDFType type() const override;
     };
@@ -225,6 +402,13 @@ namespace gm
         static Ref<SDFIntersection> create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
 
         SDFType type() const override;
     };
@@ -240,6 +424,13 @@ namespace gm
         static Ref<SDFSubstraction> create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
 
         SDFType type() const override;
     };
@@ -255,6 +446,13 @@ namespace gm
         static Ref<SDFXOR> create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
 
         SDFType type() const override;
     };
@@ -270,6 +468,13 @@ namespace gm
         static Ref<SDFSmoothUnion> create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
 
         SDFType type() const override;
     };
@@ -285,6 +490,13 @@ namespace gm
         static Ref<SDFSmoothIntersection> create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
 
         SDFType type() const override;
     };
@@ -300,10 +512,98 @@ namespace gm
         static Ref<SDFSmoothSubstraction> create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
 
         SDFType type() const override;
     };
 
+    /************************** SDF Union Set ******************************/
+
+    /*!
+    \brief Union of many operands, stored in a bounding volume hierarchy over their bounds.
+
+    Evaluation visits the operands nearest first and skips those whose bounds are farther than the
+    current value, so that large unions are evaluated in about logarithmic time.
+    The hierarchy is built at construction, and built again before the next evaluation once a node accessor
+    was called, see SDFUnionSet::update.
+    */
+    class SDFUnionSet : public SDFNode
+    {
+    public:
+        SDFUnionSet(const std::vector<Ref<SDFNode>> &nodes, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+        virtual ~SDFUnionSet() = default;
+
+        static Ref<SDFUnionSet> create(const std::vector<Ref<SDFNode>> &nodes, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+
+        float value(const Point &p) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        float lipschitz() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        uint64_t fingerprint() const override;
+
+        SDFType type() const override;
+
+        const std::vector<Ref<SDFNode>> &nodes() const;
+
+    protected:
+        template <typename Node>
+        Ref<SDFNode> prune_set(const Box &box, Interval &range);
+
+    private:
+        template <typename T>
+        T evaluate(const T &x, const T &y, const T &z) const;
+
+        template <typename Visit>
+        void traverse(const Box &box, Visit visit) const;
+
+        void build() const;
+        void update() const;
+
+    protected:
+        std::vector<Ref<SDFNode>> m_nodes;
+        mutable std::vector<int> m_unbounded; //!< Operands evaluated everywhere, unbounded or without SDFNode::conservative_bounds, the other ones are stored in the hierarchy.
+        mutable BVH m_hierarchy;              //!< Hierarchy over the bounds of the operands.
+        mutable Box m_bounds;                 //!< Union of the bounds of all the operands.
+        alignas(std::atomic_ref<uint64_t>::required_alignment) mutable uint64_t m_generation{0}; //!< Value of SDFNode::s_generation when the hierarchy was built.
+        float m_k{0.f};                       //!< Blend radius, 0 for a sharp union.
+    };
+
+    /************************** SDF Smooth Union Set ******************************/
+
+    /*!
+    \brief Smooth union of many operands.
+
+    Blends the operands closer than k to the nearest one, the result equals SDFSmoothUnion for two operands
+    and the field is lowered by at most k / 4.
+    */
+    class SDFSmoothUnionSet final : public SDFUnionSet
+    {
+    public:
+        SDFSmoothUnionSet(const std::vector<Ref<SDFNode>> &nodes, float k, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+        ~SDFSmoothUnionSet() = default;
+
+        static Ref<SDFSmoothUnionSet> create(const std::vector<Ref<SDFNode>> &nodes, float k, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        bool conservative_bounds() const override;
+        float lipschitz() const override;
+
+        SDFType type() const override;
+
+        float k() const;
+    };
+
     /************************** SDF Sphere ******************************/
 
     class SDFSphere final : public SDFNode
@@ -315,6 +615,13 @@ namespace gm
         static Ref<SDFSphere> create(const Point &c, float r, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const override;
 
@@ -337,6 +644,13 @@ namespace gm
         static Ref<SDFBox> create(const Point &a, const Point &b, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const override;
 
@@ -358,6 +672,14 @@ namespace gm
         static Ref<SDFPlane> create(const Vector &normal, float height, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        float lipschitz() const override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const override;
 
@@ -380,6 +702,13 @@ namespace gm
         static Ref<SDFTorus> create(float r1, float r2, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const override;
 
@@ -401,6 +730,13 @@ namespace gm
         static Ref<SDFCapsule> create(float radius, float height, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const override;
 
@@ -422,6 +758,13 @@ namespace gm
         static Ref<SDFCylinder> create(float radius, float height, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const override;
 
@@ -432,6 +775,101 @@ namespace gm
         float m_radius, m_height;
     };
 
+    /************************** SDF Grid ******************************/
+
+    /*!
+    \brief Field of a node baked into a dense grid of samples over a box.
+
+    Evaluations interpolate the samples instead of visiting the nodes of the baked sub-tree,
+    which freezes heavy sub-trees that are not being edited. The box should enclose the surface :
+    outside of it, the field is extended from the samples on its faces.
+
+    Sparse grids split the samples into bricks. Only the bricks of a narrow band around the surface
+    store their samples, the other ones store a lower bound of the distance over the brick,
+    so that high resolutions fit in memory and tracing stays conservative.
+
+    Grids are saved as a header followed by their arrays, so that SDFGrid::load maps the file
+    and uses the samples in place, without parsing nor baking.
+    */
+    class SDFGrid final : public SDFNode
+    {
+    public:
+        SDFGrid(const Ref<SDFNode> &node, const Box &box, int resolution, GridInterpolation interpolation = GridInterpolation::TRILINEAR, GridStorage storage = GridStorage::DENSE, int threads = 0, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+        SDFGrid(const Ref<MappedFile> &file, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+        ~SDFGrid() = default;
+
+        static Ref<SDFGrid> create(const Ref<SDFNode> &node, const Box &box, int resolution, GridInterpolation interpolation = GridInterpolation::TRILINEAR, GridStorage storage = GridStorage::DENSE, int threads = 0, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+        static Ref<SDFGrid> load(const char *filename, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+
+        int save(const char *filename) const;
+
+        float value(const Point &p) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        Vector gradient(const Point &p) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        float lipschitz() const override;
+        uint64_t fingerprint() const override;
+
+        SDFType type() const override;
+
+        void bake(int threads = 0);
+
+        void interpolation(GridInterpolation interpolation);
+        GridInterpolation interpolation() const;
+        GridStorage storage() const;
+
+        const Ref<SDFNode> &node() const;
+        const Box &box() const;
+        int resolution() const;
+        float cell_size() const;
+        size_t memory() const;
+
+    private:
+        //! Brick of a sparse grid, see SDFGrid::at.
+        struct Brick
+        {
+            int offset{-1}; //!< First sample in the half float payload, -1 for a brick reduced to its bound.
+            float bound{0.f};
+        };
+
+        void bake_dense(const SDFTree &tree, ThreadPool &pool);
+        void bake_sparse(const SDFTree &tree, ThreadPool &pool);
+        void measure();
+
+        template <typename T>
+        T evaluate(const T &x, const T &y, const T &z) const;
+
+        template <typename T>
+        T interpolate(const T u[3]) const;
+
+        float at(int i, int j, int k) const;
+        const Brick *brick(int i, int j, int k) const;
+
+    private:
+        static const int s_brick_size; //!< Number of samples along the sides of the bricks of sparse grids.
+        static const float s_band;     //!< Half width, in cells, of the narrow band of sparse grids.
+
+        Ref<SDFNode> m_node;                   //!< Baked sub-tree, kept to bake it again after an edit, null for loaded grids.
+        Box m_box;                             //!< Sampled box, its upper vertex is snapped to the grid.
+        int m_resolution;                      //!< Number of cells along the largest side of the box.
+        int m_size[3];                         //!< Number of samples along each axis.
+        float m_cell;                          //!< Side of the cubic cells.
+        GridInterpolation m_interpolation;
+        GridStorage m_storage;
+        std::vector<float> m_samples;          //!< Dense samples, x varies first, then y, then z.
+        std::vector<Brick> m_bricks;           //!< Sparse bricks, ordered as the samples.
+        std::vector<uint16_t> m_halfs;         //!< Half float samples of the sparse bricks of the band.
+        Ref<MappedFile> m_file;                //!< Mapped file holding the arrays of a loaded grid.
+        std::span<const float> m_sample_data;  //!< Arrays in use, owned or mapped.
+        std::span<const Brick> m_brick_data;
+        std::span<const uint16_t> m_half_data;
+        int m_brick_count[3]{0, 0, 0};
+        float m_slope{1.f};                    //!< Lipschitz constant of the trilinear interpolation, measured when baking.
+        float m_slopes[3]{1.f, 1.f, 1.f};      //!< Largest difference between neighbor samples along each axis, divided by the cell size.
+        uint64_t m_source{0};                  //!< Fingerprint of the node when it was baked.
+    };
+
     /************************** SDF Translation ******************************/
 
     class SDFTranslation final : public SDFUnaryOperator
@@ -443,11 +881,22 @@ namespace gm
         static Ref<SDFTranslation> create(const Ref<SDFNode> &node, const Vector &t, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const;
 
         float &translation();
 
+    private:
+        Box local(const Box &box) const;
+
     private:
         Vector m_translation;
     };
@@ -463,12 +912,23 @@ namespace gm
         static Ref<SDFRotation> create(const Ref<SDFNode> &node, const Vector &axis, float angle, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point& p) const;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const;
 
         float& axis(); 
         float& angle(); 
 
+    protected:
+        Box local(const Box &box) const;
+
     protected: 
         Vector m_axis; 
         float m_angle; 
@@ -485,6 +945,8 @@ namespace gm
         static Ref<SDFRotationX> create(const Ref<SDFNode> &node, float angle, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         SDFType type() const;
+
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
     };
 
     /************************** SDF Rotation Y ******************************/
@@ -498,6 +960,8 @@ namespace gm
         static Ref<SDFRotationY> create(const Ref<SDFNode> &node, float angle, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         SDFType type() const;
+
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
     };
 
     /************************** SDF Rotation Z ******************************/
@@ -511,6 +975,8 @@ namespace gm
         static Ref<SDFRotationZ> create(const Ref<SDFNode> &node, float angle, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         SDFType type() const;
+
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
     };
 
     /************************** SDF Scale ******************************/
@@ -524,15 +990,118 @@ namespace gm
         static Ref<SDFScale> create(const Ref<SDFNode> &node, float s, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        uint64_t fingerprint() const override;
 
         SDFType type() const;
 
         float &scale();
 
+    private:
+        Box local(const Box &box) const;
+
     private:
         float m_scale;
     };
 
+    /************************** SDF Affine ******************************/
+
+    /*!
+    \brief Operand under an affine transform, with its inverse precomputed.
+
+    Produced by SDFNode::optimize from chains of translations, rotations and scales.
+    */
+    class SDFAffine final : public SDFUnaryOperator
+    {
+    public:
+        SDFAffine(const Ref<SDFNode> &node, const Transform &transform, float scale, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+        ~SDFAffine() = default;
+
+        static Ref<SDFAffine> create(const Ref<SDFNode> &node, const Transform &transform, float scale, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+        static Ref<SDFNode> fuse(const Ref<SDFNode> &node, const Transform &transform, float scale, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+
+        float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        float lipschitz() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        uint64_t fingerprint() const override;
+
+        SDFType type() const override;
+
+        const Transform &transform() const;
+        float scale() const;
+
+    private:
+        Box local(const Box &box) const;
+
+    private:
+        Transform m_transform; //!< Operand to world.
+        float m_inverse[12];   //!< World to operand, 3x4 row major.
+        float m_scale;         //!< Distance scale, the transform must be a similarity of this ratio.
+    };
+
+    /************************** SDF Instances ******************************/
+
+    /*!
+    \brief Copies of a single operand under many affine transforms.
+
+    The operand is shared by all the instances and evaluated in the frame of the nearest ones only,
+    found with a hierarchy over the bounds of the instances.
+    Distances are scaled by the smallest stretch of every transform, exact for rigid and uniformly scaled instances.
+    The hierarchy is built again after the operand is edited through a node accessor, see SDFInstances::update.
+    */
+    class SDFInstances final : public SDFUnaryOperator
+    {
+    public:
+        SDFInstances(const Ref<SDFNode> &node, const std::vector<Transform> &transforms, float lambda = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+        ~SDFInstances() = default;
+
+        static Ref<SDFInstances> create(const Ref<SDFNode> &node, const std::vector<Transform> &transforms, float l = 1.0, IntersectMethod im = IntersectMethod::RAY_MARCHING);
+
+        float value(const Point &p) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        uint64_t fingerprint() const override;
+
+        SDFType type() const override;
+
+        const std::vector<Transform> &transforms() const;
+
+    private:
+        template <typename T>
+        T evaluate(const T &x, const T &y, const T &z) const;
+
+        template <typename Visit>
+        void traverse(const Box &box, Visit visit) const;
+
+        void build() const;
+        void update() const;
+        Box local(int i, const Box &box) const;
+
+    private:
+        std::vector<Transform> m_transforms;
+        mutable std::vector<float> m_inverses; //!< World to instance 3x4 row major matrices, 12 values per instance.
+        mutable std::vector<float> m_scales;   //!< Smallest stretch of every transform.
+        mutable BVH m_hierarchy;               //!< Hierarchy over the bounds of the instances, empty when they cannot be culled from their bounds.
+        mutable Box m_bounds;                  //!< Union of the bounds of the instances.
+        alignas(std::atomic_ref<uint64_t>::required_alignment) mutable uint64_t m_generation{0}; //!< Value of SDFNode::s_generation when the hierarchy was built.
+    };
+
     /************************** SDF Tree ******************************/
 
     class SDFTree final : public SDFNode
@@ -543,6 +1112,16 @@ namespace gm
         static Ref<SDFTree> create(const Ref<SDFNode> &root = nullptr, float l = 0.f, IntersectMethod im = IntersectMethod::RAY_MARCHING);
 
         float value(const Point &p) const override;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const override;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const override;
+        void compile(SDFProgram &program) const override;
+        Interval interval(const Box &box) const override;
+        Box bounds() const override;
+        bool conservative_bounds() const override;
+        float lipschitz() const override;
+        Ref<SDFNode> prune(const Box &box, Interval &range) override;
+        Ref<SDFNode> optimize() override;
+        uint64_t fingerprint() const override;
 
         Ref<SDFNode> left() override;
         Ref<SDFNode> right() override;
@@ -550,22 +1129,107 @@ namespace gm
         SDFType type() const override;
         std::vector<SDFType> tree_type() const;
 
+        void compile() const;
+
+        Ref<SDFTree> specialize(const Box &box) const;
+
+        void thread_count(int threads);
+        int thread_count() const;
+
+        void polygonize_method(PolygonizeMethod method);
+        PolygonizeMethod polygonize_method() const;
+
+        void normal_method(NormalMethod method);
+        NormalMethod normal_method() const;
+
+        void seed_resolution(int resolution);
+        int seed_resolution() const;
+
+        void refine_method(RefineMethod method);
+        RefineMethod refine_method() const;
+
+        void refine_tolerance(float tolerance);
+        float refine_tolerance() const;
+
+        int refine_count() const;
+        void reset_refine_count();
+
         Ref<Mesh> polygonize(int resolution, const Box &box) const;
+        Ref<Mesh> polygonize(int resolution, const Box &box, std::span<const Point> seeds) const;
         Vector normal(const Vector &) const;
-        Vector dichotomy(Vector, Vector, float, float, float) const;
+        Vector refine(const Vector &a, const Vector &b, float va, float vb, float length) const;
+        Vector dichotomy(Vector, Vector, float, float, float, float tolerance = s_epsilon) const;
 
         void root(const Ref<SDFNode> &node);
         Ref<SDFNode> &root();
 
     private:
+        struct PolygonizeSlab
+        {
+            std::vector<Vector> vertices;
+            std::vector<Vector> normals;
+            std::vector<int> triangles;
+            int bottom{0};    //!< Number of vertices on the lower plane, stored first.
+            int top_first{0}; //!< First vertex on the upper plane.
+            int top{0};       //!< Number of vertices on the upper plane.
+        };
+
+        //! Segment straddling the surface, see SDFTree::refine_batch.
+        struct RefineEdge
+        {
+            Vector a, b;
+            float va, vb; //!< Field function value at the end vertices.
+            float length;
+        };
+
+        struct OctreeCell
+        {
+            Box box;
+            int i, j, k; //!< Lower grid cell covered by the node.
+            int size;    //!< Number of grid cells covered along each axis.
+        };
+
         std::vector<SDFType> tree_type(const Ref<SDFNode> &node) const;
+        bool compiled() const;
+
+        Ref<Mesh> polygonize_uniform(int resolution, const Box &box) const;
+        void polygonize_slab(int resolution, const Box &box, int k0, int k1, PolygonizeSlab &slab) const;
+        Ref<Mesh> polygonize_octree(int resolution, const Box &box) const;
+        void polygonize_brick(int resolution, const Box &box, const OctreeCell &brick, Mesh &mesh, std::unordered_map<uint64_t, int> &edges) const;
+        Ref<Mesh> polygonize_continuation(int resolution, const Box &box, std::span<const Point> seeds) const;
+        Ref<Mesh> polygonize_dual(int resolution, const Box &box) const;
+        void polygonize_cell(int resolution, const Box &box, int i, int j, int k, const float a[8], Mesh &mesh, std::unordered_map<uint64_t, int> &edges) const;
+        void seed(const Box &box, std::vector<Point> &seeds) const;
+        void refine_batch(std::span<const RefineEdge> edges, std::span<Vector> vertices) const;
 
     private:
-        static int s_triangle_table[256][16]; //!< Two dimensionnal array storing the straddling edges for every marching cubes configuration.
-        static int s_edge_table[256];         //!< Array storing straddling edges for every marching cubes configuration.
+        static const uint8_t s_triangle_table[256][15]; //!< Two dimensionnal array storing the straddling edges of the triangles for every marching cubes configuration.
+        static const uint8_t s_triangle_count[256];     //!< Number of triangles of every marching cubes configuration.
+        static const uint16_t s_edge_table[256];        //!< Array storing straddling edges for every marching cubes configuration.
+        static const int s_cell_edge[12][4];  //!< Axis and lower vertex offset {axis, di, dj, dk} of the edges of a cell.
+        static const int s_brick_size;        //!< Size, in grid cells, of the octree nodes the tree is specialized for.
+        static const float s_qef_threshold;   //!< Eigenvalues of the dual contouring error below this fraction of the largest one are discarded.
+        static const int s_refine_limit;      //!< Maximum number of evaluations of the iterative refinements of an edge.
+        static thread_local int s_refine_count; //!< Evaluations of the edge refinements, counted per thread as SDFNode::value_call_count.
 
     private:
         Ref<SDFNode> m_root;
+
+        mutable SDFProgram m_program;          //!< Bytecode lowering of the optimized tree, evaluated by SDFTree::value.
+        mutable Ref<SDFNode> m_program_root;   //!< Root the program was compiled from.
+        mutable Ref<SDFNode> m_optimized;      //!< Optimized copy of the root, see SDFNode::optimize.
+        mutable uint64_t m_fingerprint{0};     //!< Fingerprint of the root when it was optimized.
+        mutable std::atomic<uint64_t> m_generation{0}; //!< Value of SDFNode::s_generation when the program was last checked.
+        mutable std::mutex m_compile_mutex;
+
+        int m_thread_count{1};                 //!< Threads used by SDFTree::polygonize, 0 for the hardware concurrency.
+        mutable Ref<ThreadPool> m_pool;
+
+        PolygonizeMethod m_polygonize_method{PolygonizeMethod::UNIFORM};
+        NormalMethod m_normal_method{NormalMethod::GRADIENT};
+        RefineMethod m_refine_method{RefineMethod::BISECTION};
+        float m_refine_tolerance{s_epsilon};   //!< Segment length for RefineMethod::BISECTION, field value for the iterative methods.
+        int m_seed_resolution{16};             //!< Cells along each axis of the coarse scan seeding PolygonizeMethod::CONTINUATION, 0 to follow the given seeds only.
     };
 
     const char *type_str(SDFType type);
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "pch.h"
+
+#include "Dual.h"
+#include "Interval.h"
+#include "Simd.h"
+
+//! Distance kernels shared by SDFProgram and the batched SDFNode::value_batch implementations.
+//! Each kernel is instantiated on float for scalar evaluation, on simd::vfloat for batches, on Dual for gradients
+//! and on Interval for range bounds.
+namespace gm::kernel
+{
+    /************************** Primitives ******************************/
+
+    //! k = {cx, cy, cz, radius}
+    struct Sphere
+    {
+        template <typename T>
+        T operator()(T x, T y, T z, const float *k) const
+        {
+            x = x - T(k[0]);
+            y = y - T(k[1]);
+            z = z - T(k[2]);
+            return simd::sqrt(simd::square(x) + simd::square(y) + simd::square(z)) - T(k[3]);
+        }
+    };
+
+    //! k = {half size x, y, z}
+    struct Box
+    {
+        template <typename T>
+        T operator()(T x, T y, T z, const float *k) const
+        {
+            x = simd::abs(x) - T(k[0]);
+            y = simd::abs(y) - T(k[1]);
+            z = simd::abs(z) - T(k[2]);
+            T mx = simd::max(x, T(0.f)), my = simd::max(y, T(0.f)), mz = simd::max(z, T(0.f));
+            return simd::min(simd::max(x, simd::max(y, z)), T(0.f)) + simd::sqrt(simd::square(mx) + simd::square(my) + simd::square(mz));
+        }
+    };
+
+    //! k = {nx, ny, nz, height}
+    struct Plane
+    {
+        template <typename T>
+        T operator()(T x, T y, T z, const float *k) const
+        {
+            return x * T(k[0]) + y * T(k[1]) + z * T(k[2]) + T(k[3]);
+        }
+    };
+
+    //! k = {R, r}
+    struct Torus
+    {
+        template <typename T>
+        T operator()(T x, T y, T z, const float *k) const
+        {
+            T q = simd::sqrt(simd::square(x) + simd::square(z)) - T(k[0]);
+            return simd::sqrt(simd::square(q) + simd::square(y)) - T(k[1]);
+        }
+    };
+
+    //! k = {radius, height}
+    struct Capsule
+    {
+        template <typename T>
+        T operator()(T x, T y, T z, const float *k) const
+        {
+            y = y - simd::min(simd::max(y, T(0.f)), T(k[1]));
+            return simd::sqrt(simd::square(x) + simd::square(y) + simd::square(z)) - T(k[0]);
+        }
+    };
+
+    //! k = {radius, height}
+    struct Cylinder
+    {
+        template <typename T>
+        T operator()(T x, T y, T z, const float *k) const
+        {
+            T dx = simd::sqrt(simd::square(x) + simd::square(z)) - T(k[0]);
+            T dy = simd::abs(y) - T(k[1]);
+            T mx = simd::max(dx, T(0.f)), my = simd::max(dy, T(0.f));
+            return simd::min(simd::max(dx, dy), T(0.f)) + simd::sqrt(simd::square(mx) + simd::square(my));
+        }
+    };
+
+    //! Distance to an axis aligned box, k = {min x, y, z, max x, y, z}
+    struct Outside
+    {
+        template <typename T>
+        T operator()(T x, T y, T z, const float *k) const
+        {
+            T dx = simd::max(simd::max(T(k[0]) - x, x - T(k[3])), T(0.f));
+            T dy = simd::max(simd::max(T(k[1]) - y, y - T(k[4])), T(0.f));
+            T dz = simd::max(simd::max(T(k[2]) - z, z - T(k[5])), T(0.f));
+            return simd::sqrt(simd::square(dx) + simd::square(dy) + simd::square(dz));
+        }
+    };
+
+    /************************** Operators ******************************/
+
+    //! k = {thickness / 2}
+    struct Hull
+    {
+        template <typename T>
+        T operator()(T a, const float *k) const
+        {
+            return simd::abs(a) - T(k[0]);
+        }
+    };
+
+    //! k = {scale}
+    struct Scale
+    {
+        template <typename T>
+        T operator()(T a, const float *k) const
+        {
+            return a * T(k[0]);
+        }
+    };
+
+    struct Union
+    {
+        template <typename T>
+        T operator()(T a, T b, const float *) const
+        {
+            return simd::min(a, b);
+        }
+    };
+
+    struct Intersection
+    {
+        template <typename T>
+        T operator()(T a, T b, const float *) const
+        {
+            return simd::max(a, b);
+        }
+    };
+
+    struct Substraction
+    {
+        template <typename T>
+        T operator()(T a, T b, const float *) const
+        {
+            return simd::max(a, -b);
+        }
+    };
+
+    struct XOR
+    {
+        template <typename T>
+        T operator()(T a, T b, const float *) const
+        {
+            return simd::max(simd::min(a, b), -simd::max(a, b));
+        }
+    };
+
+    //! k = {k}
+    struct SmoothUnion
+    {
+        template <typename T>
+        T operator()(T a, T b, const float *k) const
+        {
+            if (k[0] <= 0.f)
+                return simd::min(a, b);
+            T h = simd::max(T(k[0]) - simd::abs(a - b), T(0.f));
+            return simd::min(a, b) - simd::square(h) * T(0.25f / k[0]);
+        }
+    };
+
+    //! k = {k}
+    struct SmoothIntersection
+    {
+        template <typename T>
+        T operator()(T a, T b, const float *k) const
+        {
+            if (k[0] <= 0.f)
+                return simd::max(a, b);
+            T h = simd::max(T(k[0]) - simd::abs(a - b), T(0.f));
+            return simd::max(a, b) + simd::square(h) * T(0.25f / k[0]);
+        }
+    };
+
+    //! k = {k}
+    struct SmoothSubstraction
+    {
+        template <typename T>
+        T operator()(T a, T b, const float *k) const
+        {
+            if (k[0] <= 0.f)
+                return simd::max(a, -b);
+            T h = simd::max(T(k[0]) - simd::abs(a + b), T(0.f));
+            return simd::max(a, -b) + simd::square(h) * T(0.25f / k[0]);
+        }
+    };
+
+    /************************** Point operators ******************************/
+
+    //! k = {tx, ty, tz}
+    struct Translate
+    {
+        template <typename T>
+        void operator()(T &x, T &y, T &z, const float *k) const
+        {
+            x = x - T(k[0]);
+            y = y - T(k[1]);
+            z = z - T(k[2]);
+        }
+    };
+
+    //! k = 3x4 row major affine matrix
+    struct Transform
+    {
+        template <typename T>
+        void operator()(T &x, T &y, T &z, const float *k) const
+        {
+            T tx = T(k[0]) * x + T(k[1]) * y + T(k[2]) * z + T(k[3]);
+            T ty = T(k[4]) * x + T(k[5]) * y + T(k[6]) * z + T(k[7]);
+            T tz = T(k[8]) * x + T(k[9]) * y + T(k[10]) * z + T(k[11]);
+            x = tx;
+            y = ty;
+            z = tz;
+        }
+    };
+
+    //! k = {scale}
+    struct InverseScale
+    {
+        template <typename T>
+        void operator()(T &x, T &y, T &z, const float *k) const
+        {
+            T s = T(k[0]);
+            x = x / s;
+            y = y / s;
+            z = z / s;
+        }
+    };
+
+    //! k = {period}
+    struct Repeat
+    {
+        template <typename T>
+        void operator()(T &x, T &y, T &z, const float *k) const
+        {
+            T t = T(k[0]);
+            x = x - t * simd::round(x / t);
+            y = y - t * simd::round(y / t);
+            z = z - t * simd::round(z / t);
+        }
+    };
+
+    /************************** Batch drivers ******************************/
+
+    //! out[i] = kernel(x[i], y[i], z[i])
+    template <typename Kernel>
+    inline void evaluate(const float *xs, const float *ys, const float *zs, float *out, int n, const float *k, Kernel kernel = {})
+    {
+        int i = 0;
+        for (; i + simd::width <= n; i += simd::width)
+            simd::store(out + i, kernel(simd::load(xs + i), simd::load(ys + i), simd::load(zs + i), k));
+        for (; i < n; i++)
+            out[i] = kernel(xs[i], ys[i], zs[i], k);
+    }
+
+    //! a[i] = kernel(a[i])
+    template <typename Kernel>
+    inline void apply(float *a, int n, const float *k, Kernel kernel = {})
+    {
+        int i = 0;
+        for (; i + simd::width <= n; i += simd::width)
+            simd::store(a + i, kernel(simd::load(a + i), k));
+        for (; i < n; i++)
+            a[i] = kernel(a[i], k);
+    }
+
+    //! a[i] = kernel(a[i], b[i])
+    template <typename Kernel>
+    inline void combine(float *a, const float *b, int n, const float *k, Kernel kernel = {})
+    {
+        int i = 0;
+        for (; i + simd::width <= n; i += simd::width)
+            simd::store(a + i, kernel(simd::load(a + i), simd::load(b + i), k));
+        for (; i < n; i++)
+            a[i] = kernel(a[i], b[i], k);
+    }
+
+    //! (x[i], y[i], z[i]) = kernel(x[i], y[i], z[i]), from the input arrays to the output ones (may alias).
+    template <typename Kernel>
+    inline void transform(const float *xs, const float *ys, const float *zs, float *ox, float *oy, float *oz, int n, const float *k, Kernel kernel = {})
+    {
+        int i = 0;
+        for (; i + simd::width <= n; i += simd::width)
+        {
+            simd::vfloat x = simd::load(xs + i), y = simd::load(ys + i), z = simd::load(zs + i);
+            kernel(x, y, z, k);
+            simd::store(ox + i, x);
+            simd::store(oy + i, y);
+            simd::store(oz + i, z);
+        }
+        for (; i < n; i++)
+        {
+            float x = xs[i], y = ys[i], z = zs[i];
+            kernel(x, y, z, k);
+            ox[i] = x;
+            oy[i] = y;
+            oz[i] = z;
+        }
+    }
+} // namespace gm::kernel
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "pch.h"
+
+#include "Box.h"
+#include "Dual.h"
+#include "Utils.h"
+
+namespace gm
+{
+    class SDFNode;
+
+    enum class SDFOpCode : uint8_t
+    {
+        PRIMITIVE_SPHERE = 0,
+        PRIMITIVE_BOX,
+        PRIMITIVE_PLANE,
+        PRIMITIVE_TORUS,
+        PRIMITIVE_CAPSULE,
+        PRIMITIVE_CYLINDER,
+        NODE, //!< Fallback : virtual call to a node that has no bytecode lowering.
+        UNARY_OPERATOR_HULL,
+        BINARY_OPERATOR_UNION,
+        BINARY_OPERATOR_INTERSECTION,
+        BINARY_OPERATOR_SUBSTRACTION,
+        BINARY_OPERATOR_XOR,
+        BINARY_OPERATOR_SMOOTH_UNION,
+        BINARY_OPERATOR_SMOOTH_INTERSECTION,
+        BINARY_OPERATOR_SMOOTH_SUBSTRACTION,
+        POINT_TRANSLATE, //!< Push the current point, then translate it.
+        POINT_TRANSFORM, //!< Push the current point, then apply an affine 3x4 matrix to it.
+        POINT_SCALE,     //!< Push the current point, then divide it by a scale factor.
+        POINT_REPEAT,    //!< Push the current point, then fold it into the repetition cell.
+        POINT_POP,       //!< Restore the previously pushed point.
+        POINT_POP_SCALE, //!< Restore the previously pushed point and multiply the top value by a scale factor.
+        BOUND_SKIP,      //!< Skip the next operand and its union when the point is farther from its bounds than the top value plus a blend radius.
+        LOAD,            //!< Push the value of a memoization slot and skip the sub-tree that fills it, once filled for the current point.
+        STORE,           //!< Copy the top value into a memoization slot.
+        NB_ELT
+    };
+
+    struct SDFInstruction
+    {
+        SDFOpCode op;
+        int param; //!< Offset of the inline parameters in the parameter array (or node index for SDFOpCode::NODE).
+    };
+
+    /*!
+    \brief Flat, stack based representation of an SDF tree.
+
+    Nodes are lowered in postfix order : point operators push a new evaluation frame,
+    primitives push a value, operators pop their operands and push the result.
+    Identical sub-trees evaluated in the same frame are lowered once, see SDFProgram::build.
+    */
+    class SDFProgram
+    {
+    public:
+        SDFProgram() = default;
+
+        void clear();
+        bool empty() const;
+
+        void build(const SDFNode &root);
+        void compile(const SDFNode &node);
+
+        void emit(SDFOpCode op, std::initializer_list<float> params = {});
+        void emit(const SDFNode *node);
+
+        int begin_skip(const Box &bounds, float k = 0.f);
+        void end_skip(int index);
+
+        float value(const Point &p) const;
+        Dual value_dual(const Dual &x, const Dual &y, const Dual &z) const;
+        void value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const;
+
+        int size() const;
+        int weight() const;
+
+    private:
+        template <typename T>
+        T evaluate(T x, T y, T z) const;
+
+        uint64_t key(const SDFNode &node) const;
+
+    private:
+        //! Occurrences of a sub-tree in a given frame, see SDFProgram::build.
+        struct Share
+        {
+            int uses{0};
+            int length{0}; //!< Number of instructions of the sub-tree.
+            int slot{-1};
+            bool lowered{false};
+        };
+
+        static const int s_inline_stack; //!< Stack depth evaluated without heap allocation.
+        static const int s_batch_size;   //!< Number of lanes processed by each instruction in SDFProgram::value_batch.
+        static const int s_skip_size;    //!< Minimum number of instructions guarded by a SDFOpCode::BOUND_SKIP.
+        static const int s_share_size;   //!< Minimum number of instructions of a sub-tree memoized in a slot.
+
+        std::vector<SDFInstruction> m_code;
+        std::vector<float> m_params;
+        std::vector<const SDFNode *> m_nodes;
+
+        int m_depth{0}, m_max_depth{0};           //!< Value stack usage.
+        int m_frames{0}, m_max_frames{0};         //!< Point stack usage.
+        int m_weight{0};                          //!< Number of tree nodes lowered into the program.
+        int m_slots{0};                           //!< Number of memoization slots.
+
+        std::vector<uint64_t> m_keys;                  //!< Hash of the point operators of the current frame, while lowering.
+        std::unordered_map<uint64_t, Share> m_shares;  //!< Sub-trees by fingerprint and frame, while building.
+        bool m_counting{false};
+    };
+} // namespace gm
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "pch.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+//! Minimal SIMD abstraction used by the batched SDF kernels.
+//! AVX2 (8 lanes) or SSE4.1 (4 lanes) are selected at compile time, with a scalar fallback.
+namespace simd
+{
+#if defined(__AVX2__)
+
+    struct vfloat
+    {
+        vfloat() = default;
+        vfloat(__m256 x) : v(x) {}
+        vfloat(float s) : v(_mm256_set1_ps(s)) {}
+
+        __m256 v;
+    };
+
+    constexpr int width = 8;
+
+    inline vfloat load(const float *p) { return _mm256_loadu_ps(p); }
+    inline void store(float *p, vfloat a) { _mm256_storeu_ps(p, a.v); }
+
+    inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+    inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+    inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+    inline vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+    inline vfloat operator-(vfloat a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.f)); }
+
+    inline vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+    inline vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+    inline vfloat sqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+    inline vfloat abs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+    inline vfloat floor(vfloat a) { return _mm256_floor_ps(a.v); }
+    inline vfloat copysign(vfloat m, vfloat s) { return _mm256_or_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.f), m.v), _mm256_and_ps(_mm256_set1_ps(-0.f), s.v)); }
+
+    inline int negative(vfloat a) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, _mm256_setzero_ps(), _CMP_LT_OQ)); }
+
+#elif defined(__SSE4_1__)
+
+    struct vfloat
+    {
+        vfloat() = default;
+        vfloat(__m128 x) : v(x) {}
+        vfloat(float s) : v(_mm_set1_ps(s)) {}
+
+        __m128 v;
+    };
+
+    constexpr int width = 4;
+
+    inline vfloat load(const float *p) { return _mm_loadu_ps(p); }
+    inline void store(float *p, vfloat a) { _mm_storeu_ps(p, a.v); }
+
+    inline vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+    inline vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+    inline vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+    inline vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+    inline vfloat operator-(vfloat a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.f)); }
+
+    inline vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+    inline vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+    inline vfloat sqrt(vfloat a) { return _mm_sqrt_ps(a.v); }
+    inline vfloat abs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+    inline vfloat floor(vfloat a) { return _mm_floor_ps(a.v); }
+    inline vfloat copysign(vfloat m, vfloat s) { return _mm_or_ps(_mm_andnot_ps(_mm_set1_ps(-0.f), m.v), _mm_and_ps(_mm_set1_ps(-0.f), s.v)); }
+
+    inline int negative(vfloat a) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, _mm_setzero_ps())); }
+
+#else
+
+    using vfloat = float;
+
+    constexpr int width = 1;
+
+    inline vfloat load(const float *p) { return *p; }
+    inline void store(float *p, vfloat a) { *p = a; }
+
+#endif
+
+    //! Scalar overloads, so that kernels can be instantiated on both float and vfloat.
+    inline float min(float a, float b) { return std::min(a, b); }
+    inline float max(float a, float b) { return std::max(a, b); }
+    inline float sqrt(float a) { return std::sqrt(a); }
+    inline float abs(float a) { return std::abs(a); }
+    inline float floor(float a) { return std::floor(a); }
+    inline float round(float a) { return std::round(a); }
+
+    //! Bit mask of the lanes lower than 0, lane i in bit i.
+    inline int negative(float a) { return a < 0.f ? 1 : 0; }
+
+    //! a * a, overloaded by types for which a product with itself is not the square (see gm::Interval).
+    template <typename T>
+    inline T square(T a) { return a * a; }
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+    //! Round half away from zero, as std::round.
+    inline vfloat round(vfloat a) { return copysign(floor(abs(a) + vfloat(0.5f)), a); }
+#endif
+} // namespace simd
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "pch.h"
+
+#include "Utils.h"
+
+/*!
+\brief Fixed set of worker threads running parallel loops.
+
+The calling thread takes part in the loop, so a pool of n threads owns n - 1 workers.
+Loops started from a worker are run sequentially to avoid dead locks.
+*/
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    static Ref<ThreadPool> create(int threads = 0);
+
+    int size() const;
+
+    void parallel_for(int count, const std::function<void(int)> &task);
+
+private:
+    void worker();
+    void run();
+
+private:
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_submit;      //!< Serializes concurrent calls to parallel_for.
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+
+    const std::function<void(int)> *m_task{nullptr};
+    int m_count{0};
+    std::atomic<int> m_next{0};
+    int m_generation{0};
+    int m_running{0};
+    bool m_stop{false};
+
+    static thread_local bool s_inside_worker;
+};
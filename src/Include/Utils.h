@@ -13,6 +13,40 @@ constexpr Ref<T> create_ref(Args&& ... args)
 
 namespace utils
 {
+    //! FNV-1a hash of the bytes of a value, chained from a previous hash.
+    template <typename T>
+    uint64_t hash(const T &value, uint64_t seed = 0xcbf29ce484222325ull)
+    {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&value);
+        for (size_t i = 0; i < sizeof(T); i++)
+            seed = (seed ^ bytes[i]) * 0x100000001b3ull;
+        return seed;
+    }
+
+    //! Round a float to the nearest half precision float, saturated to the largest finite half.
+    inline uint16_t float_to_half(float value)
+    {
+        uint32_t u = std::bit_cast<uint32_t>(std::clamp(value, -65504.f, 65504.f));
+        const uint32_t sign = (u >> 16) & 0x8000u;
+        u &= 0x7fffffffu;
+
+        // Subnormal halves are aligned by a float addition, normal ones are rounded to nearest even
+        if (u < (113u << 23))
+            return static_cast<uint16_t>(sign | (std::bit_cast<uint32_t>(std::bit_cast<float>(u) + 0.5f) - std::bit_cast<uint32_t>(0.5f)));
+        u += ((15u - 127u) << 23) + 0xfffu + ((u >> 13) & 1u);
+        return static_cast<uint16_t>(sign | (u >> 13));
+    }
+
+    //! Widen a finite half precision float.
+    inline float half_to_float(uint16_t half)
+    {
+        const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+        const uint32_t bits = static_cast<uint32_t>(half & 0x7fffu) << 13;
+        if (bits < (1u << 23))
+            return std::bit_cast<float>(sign | std::bit_cast<uint32_t>(std::bit_cast<float>(bits + (113u << 23)) - std::bit_cast<float>(113u << 23)));
+        return std::bit_cast<float>(sign | (bits + ((127u - 15u) << 23)));
+    }
+
     // Thanks to https://medium.com/@batteriesnotincludeddev/indexed-for-each-in-modern-c-7df21fce72a1
     auto enumerate(const auto &data)
     {
@@ -114,6 +114,9 @@ private:
     int m_patch_resolution{10};
     int m_spline_resolution{10};
     int m_sdf_resolution{100};
+    bool m_sdf_octree{false};
+    bool m_sdf_lattice_normals{false};
+    int m_sdf_threads{1};
     int m_slide_x{0};
     int m_slide_y{0};
     int m_slide_z{0};
@@ -2,6 +2,7 @@
 #include <memory>
 #include <utility>
 #include <algorithm>
+#include <numeric>
 #include <functional>
 #include <sstream>
 #include <cmath>
@@ -10,10 +11,17 @@
 #include <cassert>
 #include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <bit>
 
 // Data structures 
 #include <string>
 #include <array>
+#include <span>
 #include <set>
 #include <vector>
 #include <unordered_map>
@@ -0,0 +1,88 @@
+#include "BVH.h"
+
+namespace gm
+{
+    const int BVH::s_leaf_size = 4;
+    const int BVH::s_stack = 64;
+
+    /*!
+    \brief Build the hierarchy.
+    \param boxes Boxes, indexed by the items.
+    \param items Items to be stored.
+    */
+    void BVH::build(const std::vector<Box> &boxes, const std::vector<int> &items)
+    {
+        m_cells.clear();
+        m_items = items;
+        m_boxes.resize(items.size());
+        for (size_t i = 0; i < items.size(); i++)
+            m_boxes[i] = boxes[items[i]];
+
+        if (!m_items.empty())
+            build(0, static_cast<int>(m_items.size()));
+    }
+
+    /*!
+    \brief Build the sub-tree over a range of items, split at the median of their centers along their widest axis.
+    \return Index of the cell.
+    */
+    int BVH::build(int first, int last)
+    {
+        const int index = static_cast<int>(m_cells.size());
+        m_cells.emplace_back();
+
+        Box box = m_boxes[first];
+        Box centers(box.center(), box.center());
+        for (int i = first + 1; i < last; i++)
+        {
+            box = Box(box, m_boxes[i]);
+            centers = Box(centers, Box(m_boxes[i].center(), m_boxes[i].center()));
+        }
+        m_cells[index].box = box;
+
+        if (last - first <= s_leaf_size)
+        {
+            m_cells[index].first = first;
+            m_cells[index].count = last - first;
+            return index;
+        }
+
+        const Vector d = centers.diagonal();
+        const int axis = d(0) > d(1) ? (d(0) > d(2) ? 0 : 2) : (d(1) > d(2) ? 1 : 2);
+        const int middle = (first + last) / 2;
+
+        // Items and their boxes are sorted together
+        std::vector<int> order(last - first);
+        std::iota(order.begin(), order.end(), first);
+        std::nth_element(order.begin(), order.begin() + (middle - first), order.end(), [&](int a, int b)
+                         { return m_boxes[a].center()(axis) < m_boxes[b].center()(axis); });
+
+        std::vector<int> items(order.size());
+        std::vector<Box> boxes(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            items[i] = m_items[order[i]];
+            boxes[i] = m_boxes[order[i]];
+        }
+        std::copy(items.begin(), items.end(), m_items.begin() + first);
+        std::copy(boxes.begin(), boxes.end(), m_boxes.begin() + first);
+
+        build(first, middle);
+        const int right = build(middle, last);
+        m_cells[index].right = right;
+        return index;
+    }
+
+    bool BVH::empty() const
+    {
+        return m_cells.empty();
+    }
+
+    /*!
+    \brief Bounds of all the items, the hierarchy should not be empty.
+    */
+    Box BVH::box() const
+    {
+        return m_cells[0].box;
+    }
+} // namespace gm
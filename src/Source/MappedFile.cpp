@@ -0,0 +1,92 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*!
+\brief Map a file, see MappedFile::valid for failures.
+\param filename Name of the file.
+*/
+MappedFile::MappedFile(const char *filename)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        return;
+
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+        return;
+
+    m_data = static_cast<const unsigned char *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data)
+        m_size = static_cast<size_t>(size.QuadPart);
+#else
+    const int file = open(filename, O_RDONLY);
+    if (file < 0)
+        return;
+
+    // The mapping holds its own reference to the file
+    struct stat info;
+    if (fstat(file, &info) == 0 && info.st_size > 0)
+    {
+        void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, file, 0);
+        if (data != MAP_FAILED)
+        {
+            m_data = static_cast<const unsigned char *>(data);
+            m_size = static_cast<size_t>(info.st_size);
+        }
+    }
+    close(file);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file)
+        CloseHandle(m_file);
+#else
+    if (m_data)
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+#endif
+}
+
+Ref<MappedFile> MappedFile::create(const char *filename)
+{
+    return create_ref<MappedFile>(filename);
+}
+
+/*!
+\brief Check that the file was opened and mapped, empty files can not be mapped.
+*/
+bool MappedFile::valid() const
+{
+    return m_data != nullptr;
+}
+
+const unsigned char *MappedFile::data() const
+{
+    return m_data;
+}
+
+size_t MappedFile::size() const
+{
+    return m_size;
+}
@@ -0,0 +1,227 @@
+#include "Renderer.h"
+
+#include "image_io.h"
+
+namespace gm
+{
+    /*!
+    \brief Create a renderer.
+    \param width, height Size of the images.
+    \param threads Number of threads, 0 uses the hardware concurrency.
+    */
+    Renderer::Renderer(int width, int height, int threads) : m_width(width), m_height(height), m_pool(ThreadPool::create(threads))
+    {
+        m_query.relaxation = 1.5f;
+        m_query.t_max = FLT_MAX;
+
+        for (Image &image : m_images)
+            image = Image(m_width, m_height);
+        m_depth.assign(m_width * m_height, -1.f);
+        m_steps.assign(m_width * m_height, 0);
+    }
+
+    Ref<Renderer> Renderer::create(int width, int height, int threads)
+    {
+        return create_ref<Renderer>(width, height, threads);
+    }
+
+    int Renderer::width() const
+    {
+        return m_width;
+    }
+
+    int Renderer::height() const
+    {
+        return m_height;
+    }
+
+    /*!
+    \brief Tracing parameters used by the next renders, over-relaxed and clipped to the bounds of the tree by default.
+    */
+    RayQuery &Renderer::query()
+    {
+        return m_query;
+    }
+
+    void Renderer::tile_size(int size)
+    {
+        m_tile_size = std::max(size, 1);
+    }
+
+    int Renderer::tile_size() const
+    {
+        return m_tile_size;
+    }
+
+    /*!
+    \brief Set the size of the pixel blocks covered by a cone in the pre-pass, see SDFNode::cone_march.
+    Their rays start sphere tracing where the cone met the surface. 0 disables the pre-pass.
+    */
+    void Renderer::cone_size(int size)
+    {
+        m_cone_size = std::max(size, 0);
+    }
+
+    int Renderer::cone_size() const
+    {
+        return m_cone_size;
+    }
+
+    /*!
+    \brief Render a tree into every output.
+    \param tree Tree, compiled before the tiles are traced.
+    \param camera Camera.
+    \param fov Vertical field of view in degrees, see Orbiter::projection.
+    */
+    void Renderer::render(const SDFTree &tree, const Orbiter &camera, float fov)
+    {
+        tree.compile();
+
+        Orbiter view = camera;
+        view.projection(m_width, m_height, fov);
+
+        // Rays go from the camera through the far plane
+        Point plane;
+        Vector dx, dy;
+        view.frame(1.f, plane, dx, dy);
+        const Point origin = view.position();
+
+        // Hits closer than half a pixel are not worth more steps
+        RayQuery query = m_query;
+        const float footprint = 0.5f * length(dy) / length(Vector(origin, plane));
+        query.epsilon_slope = std::max(query.epsilon_slope, footprint);
+
+        const int tx = (m_width + m_tile_size - 1) / m_tile_size;
+        const int ty = (m_height + m_tile_size - 1) / m_tile_size;
+        std::vector<int> cone_steps(tx * ty);
+        m_pool->parallel_for(tx * ty, [&](int tile)
+                             { cone_steps[tile] = render_tile(tree, tile, query, origin, plane, dx, dy); });
+        m_cone_steps = std::accumulate(cone_steps.begin(), cone_steps.end(), 0ll);
+
+        // Depth and steps are normalized over the whole image
+        float closest = FLT_MAX, farthest = 0.f;
+        int steps = 1;
+        for (int i = 0; i < m_width * m_height; i++)
+        {
+            if (m_depth[i] >= 0.f)
+            {
+                closest = std::min(closest, m_depth[i]);
+                farthest = std::max(farthest, m_depth[i]);
+            }
+            steps = std::max(steps, m_steps[i]);
+        }
+
+        Image &depth = m_images[static_cast<int>(RenderOutput::DEPTH)];
+        Image &heatmap = m_images[static_cast<int>(RenderOutput::STEPS)];
+        for (int i = 0; i < m_width * m_height; i++)
+        {
+            const float z = m_depth[i] < 0.f ? 0.f : (farthest > closest ? 1.f - 0.9f * (m_depth[i] - closest) / (farthest - closest) : 1.f);
+            depth(i) = Color(z);
+
+            const float h = static_cast<float>(m_steps[i]) / steps;
+            heatmap(i) = Color(std::clamp(2.f * h - 1.f, 0.f, 1.f), 1.f - std::abs(2.f * h - 1.f), std::clamp(1.f - 2.f * h, 0.f, 1.f));
+        }
+    }
+
+    /*!
+    \brief Trace the pixels of a tile, one packet per cone block.
+    \param tile Index of the tile, row major.
+    \param origin, plane, dx, dy Camera position and image plane, see Orbiter::frame.
+    \return Number of steps of the cone pre-pass.
+    */
+    int Renderer::render_tile(const SDFTree &tree, int tile, const RayQuery &query, const Point &origin, const Point &plane, const Vector &dx, const Vector &dy)
+    {
+        const int tx = (m_width + m_tile_size - 1) / m_tile_size;
+        const int x0 = (tile % tx) * m_tile_size, y0 = (tile / tx) * m_tile_size;
+        const int x1 = std::min(x0 + m_tile_size, m_width), y1 = std::min(y0 + m_tile_size, m_height);
+        const int block = m_cone_size > 0 ? m_cone_size : m_tile_size;
+
+        auto direction = [&](float x, float y)
+        {
+            return normalize(Vector(origin, plane + x * dx + y * dy));
+        };
+
+        Image &shaded = m_images[static_cast<int>(RenderOutput::SHADED)];
+        Image &normal = m_images[static_cast<int>(RenderOutput::NORMAL)];
+
+        int cone_steps = 0;
+        std::vector<Ray> rays;
+        std::vector<RayHit> hits;
+        for (int by = y0; by < y1; by += block)
+            for (int bx = x0; bx < x1; bx += block)
+            {
+                const int ex = std::min(bx + block, x1), ey = std::min(by + block, y1);
+
+                // Pre-pass : a cone through the corners of the block finds where its rays may start
+                RayQuery start = query;
+                if (m_cone_size > 0)
+                {
+                    const Vector axis = direction(0.5f * (bx + ex), 0.5f * (by + ey));
+                    float slope = 0.f;
+                    for (int c = 0; c < 4; c++)
+                    {
+                        const Vector corner = direction((c & 1) ? ex : bx, (c & 2) ? ey : by);
+                        slope = std::max(slope, length(cross(axis, corner)) / dot(axis, corner));
+                    }
+
+                    const RayHit cone = tree.cone_march({origin, axis}, slope * 1.01f, query);
+                    start.t_min = std::max(start.t_min, cone.t);
+                    cone_steps += cone.steps;
+                }
+
+                rays.clear();
+                for (int y = by; y < ey; y++)
+                    for (int x = bx; x < ex; x++)
+                        rays.push_back({origin, direction(x + 0.5f, y + 0.5f)});
+
+                hits.resize(rays.size());
+                tree.trace(rays, hits, start);
+
+                int r = 0;
+                for (int y = by; y < ey; y++)
+                    for (int x = bx; x < ex; x++, r++)
+                    {
+                        const RayHit &hit = hits[r];
+                        const int i = y * m_width + x;
+                        m_steps[i] = hit.steps;
+                        if (!hit.hit())
+                        {
+                            m_depth[i] = -1.f;
+                            shaded(x, y) = Black();
+                            normal(x, y) = Black();
+                            continue;
+                        }
+
+                        m_depth[i] = hit.t;
+                        const float diffuse = std::max(-dot(hit.normal, rays[r].direction), 0.f);
+                        shaded(x, y) = Color(0.1f + 0.8f * diffuse);
+                        normal(x, y) = Color(0.5f + 0.5f * hit.normal.x, 0.5f + 0.5f * hit.normal.y, 0.5f + 0.5f * hit.normal.z);
+                    }
+            }
+        return cone_steps;
+    }
+
+    const Image &Renderer::image(RenderOutput output) const
+    {
+        return m_images[static_cast<int>(output)];
+    }
+
+    /*!
+    \brief Write an output of the last render into a .png or .bmp file.
+    \return 0 on success, see write_image.
+    */
+    int Renderer::write(RenderOutput output, const char *filename) const
+    {
+        return write_image(image(output), filename);
+    }
+
+    /*!
+    \brief Average number of steps per pixel of the last render, the cone pre-pass included.
+    */
+    float Renderer::average_steps() const
+    {
+        if (m_steps.empty())
+            return 0.f;
+        return static_cast<float>(std::accumulate(m_steps.begin(), m_steps.end(), m_cone_steps)) / m_steps.size();
+    }
+} // namespace gm
@@ -1,17 +1,28 @@
 #include "SDF.h"
 
+#include "SDFKernels.h"
+
 namespace gm
 {
     const float SDFNode::s_epsilon = 0.0001f;
     const int SDFNode::s_limit = 10000;
+    const float SDFNode::s_relaxation = 1.5f;
+    const float SDFNode::s_epsilon_slope = 1e-3f;
 
-    int SDFNode::s_value_call_count = 0;
+    thread_local int SDFNode::s_value_call_count = 0;
+    const Box SDFNode::s_unbounded = Box(FLT_MAX);
+    std::atomic<uint64_t> SDFNode::s_generation{0};
 
     Point Ray::point(float t) const
     {
         return origin + direction * t;
     }
 
+    bool RayHit::hit() const
+    {
+        return status == RayStatus::HIT;
+    }
+
     /********************** SDF Node ************************/
 
     SDFNode::SDFNode(float lambda, IntersectMethod method) : m_intersect_method(method), m_lambda(lambda)
@@ -23,6 +34,33 @@ namespace gm
         return FLT_MAX;
     }
 
+    /*!
+    \brief Evaluate the field on a batch of points stored as separate coordinate arrays.
+    Default implementation, calls SDFNode::value for every point.
+    \param xs, ys, zs Point coordinates.
+    \param out Field values, same size as the coordinate arrays.
+    */
+    void SDFNode::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        for (size_t i = 0; i < out.size(); i++)
+            out[i] = value(Point(xs[i], ys[i], zs[i]));
+    }
+
+    /*!
+    \brief Evaluate the field and its gradient with forward mode automatic differentiation.
+
+    The coordinates carry their own gradient with respect to the differentiation variables, so that
+    transforms propagate it to their operand by the chain rule.
+    Default implementation, combines SDFNode::value and the finite differences SDFNode::gradient.
+    \param x, y, z Point coordinates.
+    */
+    Dual SDFNode::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        Point p(x.v, y.v, z.v);
+        Vector g = gradient(p);
+        return Dual(value(p), g.x * x.d + g.y * y.d + g.z * z.d);
+    }
+
     bool SDFNode::inside(const Point &p) const
     {
         return value(p) < 0.0;
@@ -38,6 +76,15 @@ namespace gm
         return Vector(x, y, z) / (2 * s_epsilon);
     }
 
+    /*!
+    \brief Compute the value and the gradient of the field in a single evaluation.
+    \sa SDFNode::value_dual
+    */
+    Dual SDFNode::value_gradient(const Point &p) const
+    {
+        return value_dual(Dual::variable(p.x, 0), Dual::variable(p.y, 1), Dual::variable(p.z, 2));
+    }
+
     bool SDFNode::intersect(const Ray &ray, float t) const
     {
         switch (m_intersect_method)
@@ -46,6 +93,8 @@ namespace gm
             return intersect_ray_marching(ray, t);
         case IntersectMethod::SPHERE_TRACING:
             return intersect_sphere_tracing(ray, t);
+        case IntersectMethod::ENHANCED_SPHERE_TRACING:
+            return intersect_enhanced_sphere_tracing(ray, t);
         }
 
         return false;
@@ -56,6 +105,285 @@ namespace gm
         m_intersect_method = method;
     }
 
+    //! Sphere tracing state of a ray, shared by the SDFNode::trace overloads.
+    struct RayMarch
+    {
+        float scale;   //!< Inverse of the Lipschitz constant times the length of the direction.
+        float t_far;   //!< Distance at which the ray leaves the bounds.
+        float omega;   //!< Current over-relaxation factor.
+        float radius{0.f}; //!< Unbounding radius at the previous point.
+        float step{0.f};   //!< Length of the previous step.
+
+        //! Clip the ray against the bounds of the node, returns false if it misses them.
+        bool start(const Ray &ray, const Box &bounds, float lambda, const RayQuery &query, RayHit &hit)
+        {
+            hit = RayHit();
+            hit.t = std::max(query.t_min, 0.f);
+            scale = 1.f / (lambda * length(ray.direction));
+            t_far = query.t_max;
+            omega = std::max(query.relaxation, 1.f);
+
+            if (query.clip && SDFNode::bounded(bounds))
+            {
+                const Box box(bounds[0] - Vector(query.epsilon), bounds[1] + Vector(query.epsilon));
+                float t_in, t_out;
+                if (!box.intersect(Vector(ray.origin), ray.direction, t_in, t_out))
+                    t_in = t_out = -1.f;
+                hit.t = std::max(hit.t, t_in);
+                t_far = std::min(t_far, t_out);
+            }
+
+            if (hit.t > t_far)
+            {
+                hit.status = RayStatus::MISS_DISTANCE;
+                return false;
+            }
+            return true;
+        }
+
+        //! Step from the field value at the current point, returns false once the ray is done.
+        bool advance(float d, const RayQuery &query, RayHit &hit)
+        {
+            hit.steps++;
+            const float r = d * scale;
+
+            // Disjoint unbounding spheres : the relaxed step may have crossed the surface, take the plain one instead
+            if (omega > 1.f && std::abs(r) + radius < step)
+            {
+                hit.t -= step - radius;
+                step = radius;
+                omega = 1.f;
+                hit.fallbacks++;
+                return true;
+            }
+
+            if (d < query.epsilon + query.epsilon_slope * hit.t)
+            {
+                hit.status = RayStatus::HIT;
+                return false;
+            }
+
+            radius = r;
+            step = omega * r;
+            hit.t += step;
+            if (hit.t > t_far)
+            {
+                hit.status = RayStatus::MISS_DISTANCE;
+                return false;
+            }
+            return true;
+        }
+    };
+
+    /*!
+    \brief Sphere trace a ray.
+
+    Steps are the field value divided by the Lipschitz constant of the node, so that they never cross the surface.
+    Marching starts where the ray enters the bounds of the node and stops where it leaves them.
+    With a relaxation factor above 1, steps are over-relaxed and taken back when the unbounding spheres of
+    two consecutive points do not overlap anymore, see RayQuery.
+    Directions need not be normalized, t is expressed in units of the ray direction.
+    \param ray Ray.
+    \param query Maximum distance, hit tolerance and step budget.
+    */
+    RayHit SDFNode::trace(const Ray &ray, const RayQuery &query) const
+    {
+        RayHit hit;
+        RayMarch march;
+        if (!march.start(ray, bounds(), lipschitz(), query, hit))
+            return hit;
+
+        while (hit.steps < query.steps)
+        {
+            hit.point = ray.point(hit.t);
+            if (!march.advance(value(hit.point), query, hit))
+                break;
+        }
+
+        if (hit.hit() && query.normal)
+            hit.normal = normalize(value_gradient(hit.point).d);
+        return hit;
+    }
+
+    /*!
+    \brief Sphere trace a packet of rays, see SDFNode::trace(const Ray&, const RayQuery&) const.
+
+    Every step evaluates the rays still marching with a single SDFNode::value_batch call, the finished
+    ones being compacted away, so that the field evaluation runs over SIMD lanes of rays.
+    \param rays Rays.
+    \param hits Results, same size as the rays.
+    \param query Maximum distance, hit tolerance and step budget shared by all the rays.
+    */
+    void SDFNode::trace(std::span<const Ray> rays, std::span<RayHit> hits, const RayQuery &query) const
+    {
+        const int n = static_cast<int>(rays.size());
+        const float lambda = lipschitz();
+        const Box box = bounds();
+
+        std::vector<RayMarch> marches(n);
+        std::vector<int> active;
+        active.reserve(n);
+        for (int i = 0; i < n; i++)
+        {
+            if (marches[i].start(rays[i], box, lambda, query, hits[i]))
+                active.push_back(i);
+        }
+
+        std::vector<float> xs, ys, zs, f;
+        for (int step = 0; step < query.steps && !active.empty(); step++)
+        {
+            const int count = static_cast<int>(active.size());
+            xs.resize(count);
+            ys.resize(count);
+            zs.resize(count);
+            f.resize(count);
+            for (int a = 0; a < count; a++)
+            {
+                const Point p = rays[active[a]].point(hits[active[a]].t);
+                xs[a] = p.x;
+                ys[a] = p.y;
+                zs[a] = p.z;
+            }
+            value_batch(xs, ys, zs, f);
+
+            int kept = 0;
+            for (int a = 0; a < count; a++)
+            {
+                const int i = active[a];
+                hits[i].point = Point(xs[a], ys[a], zs[a]);
+                if (marches[i].advance(f[a], query, hits[i]))
+                    active[kept++] = i;
+            }
+            active.resize(kept);
+        }
+
+        if (!query.normal)
+            return;
+        for (RayHit &hit : hits)
+            if (hit.hit())
+                hit.normal = normalize(value_gradient(hit.point).d);
+    }
+
+    /*!
+    \brief Lower the node into a bytecode program.
+    Nodes without a dedicated lowering are called through their virtual SDFNode::value().
+    */
+    void SDFNode::compile(SDFProgram &program) const
+    {
+        program.emit(this);
+    }
+
+    /*!
+    \brief Conservative range of the field over a box.
+    Default implementation, bounds the value at the center of the box with the Lipschitz constant of the node.
+    */
+    Interval SDFNode::interval(const Box &box) const
+    {
+        const float f = value(Point(box.center()));
+        const float r = lipschitz() * box.radius();
+        return Interval(f - r, f + r);
+    }
+
+    /*!
+    \brief Conservative bounding box of the surface and of the inside of the node, in the frame of the node.
+
+    Outside of it, a distance field is at least the distance to the box.
+    Default implementation, unbounded.
+    */
+    Box SDFNode::bounds() const
+    {
+        return s_unbounded;
+    }
+
+    /*!
+    \brief Check whether the field is at least the distance to SDFNode::bounds outside of them.
+
+    Unions skip an operand from its bounds only when it holds : intersections, substractions and blends
+    may be lower than the distance to their bounds, and would be cut into a discontinuous field.
+    Default implementation, false.
+    */
+    bool SDFNode::conservative_bounds() const
+    {
+        return false;
+    }
+
+    /*!
+    \brief Check whether a box returned by SDFNode::bounds is finite.
+    */
+    bool SDFNode::bounded(const Box &box)
+    {
+        return s_unbounded.inside(box);
+    }
+
+    /*!
+    \brief Conservative Lipschitz constant of the field, |f(p) - f(q)| <= lipschitz() * |p - q|.
+
+    Derived bottom-up from the operands : steps of value() / lipschitz() along a ray never cross the surface
+    and a cell farther from the surface than lipschitz() times its radius cannot contain it.
+    Default implementation, the lambda given at construction, 1 for exact distance fields.
+    */
+    float SDFNode::lipschitz() const
+    {
+        return m_lambda > 0.f ? m_lambda : 1.f;
+    }
+
+    /*!
+    \brief Specialize the node for a region of space.
+
+    Operators with an operand that cannot change the field inside the box are replaced by their other operand.
+    The returned tree shares the unchanged sub-trees and evaluates to the same values inside the box.
+    Default implementation, returns the node itself.
+
+    \param box Region.
+    \param range Returned range of the field over the box, see SDFNode::interval.
+    */
+    Ref<SDFNode> SDFNode::prune(const Box &box, Interval &range)
+    {
+        range = interval(box);
+        return shared_from_this();
+    }
+
+    /*!
+    \brief Simplified copy of the node, evaluating to the same field.
+
+    Chains of transforms are fused into a single SDFAffine node with a precomputed inverse, identity transforms
+    are dropped and smooth operators with a null blend radius are replaced by their sharp counterpart.
+    Unchanged sub-trees are shared. Default implementation, returns the node itself.
+    */
+    Ref<SDFNode> SDFNode::optimize()
+    {
+        return shared_from_this();
+    }
+
+    /*!
+    \brief Hash of the type and the parameters of the node and of its operands.
+    Changes when a parameter is edited, see SDFTree::compile.
+    */
+    uint64_t SDFNode::fingerprint() const
+    {
+        return hash({});
+    }
+
+    /*!
+    \brief Record that a parameter may be edited in place through the returned reference of an accessor,
+    so that compiled trees check their fingerprint again before their next evaluation.
+    */
+    void SDFNode::edited()
+    {
+        s_generation.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //! Hash of the type of the node, of its parameters and of the fingerprints of its operands.
+    uint64_t SDFNode::hash(std::initializer_list<float> params, std::initializer_list<uint64_t> children) const
+    {
+        uint64_t h = utils::hash(type());
+        for (float param : params)
+            h = utils::hash(param, h);
+        for (uint64_t child : children)
+            h = utils::hash(child, h);
+        return h;
+    }
+
     Ref<SDFNode> SDFNode::left()
     {
         return nullptr;
@@ -98,20 +426,90 @@ namespace gm
 
     bool SDFNode::intersect_sphere_tracing(const Ray &ray, float eps) const
     {
+        const float lambda = lipschitz();
         float t = 0.0;
         Point point;
         for (int i = 0; i < s_limit; ++i)
         {
             point = ray.point(t);
-            float val = std::max(value(point), eps);
+            float val = value(point);
             if (val < 0.0)
                 return true;
-            t += val / m_lambda;
+            t += std::max(val, eps) / lambda;
         }
 
         return false;
     }
 
+    /*!
+    \brief March a cone along a ray, to find how far the cone is free of surface.
+
+    Each step moves the apex side section of the cone to the farthest position still inside the
+    unbounding sphere of the current point. Every ray inside the cone may then start sphere tracing at the
+    returned distance, see RayQuery::t_min.
+    \param ray Axis of the cone, with a unit direction.
+    \param slope Tangent of the half aperture of the cone.
+    \param query Maximum distance, tolerance and step budget.
+    \return Free distance along the axis and number of steps, the status is RayStatus::HIT if the cone reached the surface.
+    */
+    RayHit SDFNode::cone_march(const Ray &ray, float slope, const RayQuery &query) const
+    {
+        const float lambda = lipschitz();
+
+        // Nothing lies beyond the farthest corner of the bounds
+        float t_far = query.t_max;
+        const Box box = bounds();
+        if (bounded(box))
+        {
+            float corner = 0.f;
+            for (int i = 0; i < 8; i++)
+                corner = std::max(corner, length(box.vertex(i) - Vector(ray.origin)));
+            t_far = std::min(t_far, corner);
+        }
+
+        RayHit hit;
+        hit.t = std::max(query.t_min, 0.f);
+        while (hit.steps < query.steps)
+        {
+            hit.point = ray.point(hit.t);
+            const float d = value(hit.point) / lambda;
+            hit.steps++;
+
+            const float radius = slope * hit.t;
+            if (d < radius + query.epsilon)
+            {
+                hit.status = RayStatus::HIT;
+                break;
+            }
+
+            hit.t += (d - radius) / (1.f + slope);
+            if (hit.t > t_far)
+            {
+                hit.t = t_far;
+                hit.status = RayStatus::MISS_DISTANCE;
+                break;
+            }
+        }
+        return hit;
+    }
+
+    /*!
+    \brief Over-relaxed sphere tracing clipped to the bounds of the node, see SDFNode::trace.
+    \param ray Ray.
+    \param eps Hit tolerance at the origin of the ray, growing with the distance.
+    */
+    bool SDFNode::intersect_enhanced_sphere_tracing(const Ray &ray, float eps) const
+    {
+        RayQuery query;
+        query.t_max = FLT_MAX;
+        query.epsilon = eps;
+        query.epsilon_slope = s_epsilon_slope;
+        query.steps = s_limit;
+        query.relaxation = s_relaxation;
+        query.normal = false;
+        return trace(ray, query).hit();
+    }
+
     /********************** SDF Unary Operator ************************/
 
     SDFUnaryOperator::SDFUnaryOperator(const Ref<SDFNode> &n, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_node(n)
@@ -128,6 +526,29 @@ namespace gm
         return nullptr;
     }
 
+    /*!
+    \brief Lipschitz constant of the operand.
+    Point operators are isometries, scales multiply the distances back, and SDFRepetition folds space without
+    stretching it as long as the operand fits in a cell.
+    */
+    float SDFUnaryOperator::lipschitz() const
+    {
+        return m_node->lipschitz();
+    }
+
+    /*!
+    \brief Isometries and uniform scales keep the bounds of their operand conservative.
+    */
+    bool SDFUnaryOperator::conservative_bounds() const
+    {
+        return m_node->conservative_bounds();
+    }
+
+    uint64_t SDFUnaryOperator::fingerprint() const
+    {
+        return hash({}, {m_node->fingerprint()});
+    }
+
     /********************** SDF Hull ************************/
 
     SDFHull::SDFHull(const Ref<SDFNode> &n, float thickness, float lambda, IntersectMethod im) : SDFUnaryOperator(n, lambda, im), m_thickness(thickness)
@@ -142,7 +563,22 @@ namespace gm
     float SDFHull::value(const Point &p) const
     {
         s_value_call_count++; 
-        return abs(m_node->value(p)) - m_thickness * 0.5;
+        return std::abs(m_node->value(p)) - m_thickness * 0.5;
+    }
+
+    void SDFHull::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        const float k[] = {m_thickness * 0.5f};
+        m_node->value_batch(xs, ys, zs, out);
+        kernel::apply<kernel::Hull>(out.data(), static_cast<int>(out.size()), k);
+    }
+
+    Dual SDFHull::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        const float k[] = {m_thickness * 0.5f};
+        return kernel::Hull()(m_node->value_dual(x, y, z), k);
     }
 
     SDFType SDFHull::type() const
@@ -150,8 +586,45 @@ namespace gm
         return SDFType::UNARY_OPERATOR_HULL;
     }
 
+    void SDFHull::compile(SDFProgram &program) const
+    {
+        program.compile(*m_node);
+        program.emit(SDFOpCode::UNARY_OPERATOR_HULL, {m_thickness * 0.5f});
+    }
+
+    Interval SDFHull::interval(const Box &box) const
+    {
+        const float k[] = {m_thickness * 0.5f};
+        return kernel::Hull{}(m_node->interval(box), k);
+    }
+
+    Box SDFHull::bounds() const
+    {
+        Box box = m_node->bounds();
+        return Box(box[0] - Vector(m_thickness * 0.5f), box[1] + Vector(m_thickness * 0.5f));
+    }
+
+    Ref<SDFNode> SDFHull::prune(const Box &box, Interval &range)
+    {
+        const float k[] = {m_thickness * 0.5f};
+        Ref<SDFNode> node = m_node->prune(box, range);
+        range = kernel::Hull{}(range, k);
+        return rebuild<SDFHull>(node);
+    }
+
+    Ref<SDFNode> SDFHull::optimize()
+    {
+        return rebuild<SDFHull>(m_node->optimize());
+    }
+
+    uint64_t SDFHull::fingerprint() const
+    {
+        return hash({m_thickness}, {m_node->fingerprint()});
+    }
+
     float &SDFHull::thickness()
     {
+        edited();
         return m_thickness;
     }
 
@@ -172,13 +645,93 @@ namespace gm
         return m_node->value(q);
     }
 
+    void SDFRepetition::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        const int n = static_cast<int>(out.size());
+        const float k[] = {m_t};
+        std::vector<float> q(3 * n);
+        kernel::transform<kernel::Repeat>(xs.data(), ys.data(), zs.data(), q.data(), q.data() + n, q.data() + 2 * n, n, k);
+        m_node->value_batch({q.data(), size_t(n)}, {q.data() + n, size_t(n)}, {q.data() + 2 * n, size_t(n)}, out);
+    }
+
+    Dual SDFRepetition::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        const float k[] = {m_t};
+        Dual qx = x, qy = y, qz = z;
+        kernel::Repeat()(qx, qy, qz, k);
+        return m_node->value_dual(qx, qy, qz);
+    }
+
     SDFType SDFRepetition::type() const
     {
         return SDFType::UNARY_OPERATOR_REPETITION;
     }
 
+    void SDFRepetition::compile(SDFProgram &program) const
+    {
+        program.emit(SDFOpCode::POINT_REPEAT, {m_t});
+        program.compile(*m_node);
+        program.emit(SDFOpCode::POINT_POP);
+    }
+
+    Interval SDFRepetition::interval(const Box &box) const
+    {
+        return m_node->interval(local(box));
+    }
+
+    Box SDFRepetition::bounds() const
+    {
+        return s_unbounded;
+    }
+
+    bool SDFRepetition::conservative_bounds() const
+    {
+        return false;
+    }
+
+    Ref<SDFNode> SDFRepetition::prune(const Box &box, Interval &range)
+    {
+        return rebuild<SDFRepetition>(m_node->prune(local(box), range));
+    }
+
+    Ref<SDFNode> SDFRepetition::optimize()
+    {
+        return rebuild<SDFRepetition>(m_node->optimize());
+    }
+
+    uint64_t SDFRepetition::fingerprint() const
+    {
+        return hash({m_t}, {m_node->fingerprint()});
+    }
+
+    /*!
+    \brief Bounding box of the points of a box folded into the repetition cell.
+    A box spanning several cells along an axis covers the whole cell along that axis.
+    */
+    Box SDFRepetition::local(const Box &box) const
+    {
+        Vector a, b;
+        for (int i = 0; i < 3; i++)
+        {
+            float ra = std::round(box[0](i) / m_t);
+            float rb = std::round(box[1](i) / m_t);
+            if (ra == rb)
+            {
+                a(i) = box[0](i) - m_t * ra;
+                b(i) = box[1](i) - m_t * ra;
+            }
+            else
+            {
+                a(i) = -0.5f * std::abs(m_t);
+                b(i) = 0.5f * std::abs(m_t);
+            }
+        }
+        return Box(a, b);
+    }
+
     float &SDFRepetition::t()
     {
+        edited();
         return m_t;
     }
 
@@ -198,6 +751,20 @@ namespace gm
         return m_right;
     }
 
+    /*!
+    \brief Largest Lipschitz constant of the operands.
+    Minimum and maximum select one of them, smooth blends are convex combinations of their gradients.
+    */
+    float SDFBinaryOperator::lipschitz() const
+    {
+        return std::max(m_left->lipschitz(), m_right->lipschitz());
+    }
+
+    uint64_t SDFBinaryOperator::fingerprint() const
+    {
+        return hash({}, {m_left->fingerprint(), m_right->fingerprint()});
+    }
+
     /********************** SDF Smooth Binary Operator ************************/
 
     SDFSmoothBinaryOperator::SDFSmoothBinaryOperator(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im) : SDFBinaryOperator(l, r, lambda, im), m_k(k)
@@ -206,9 +773,15 @@ namespace gm
 
     float &SDFSmoothBinaryOperator::k()
     {
+        edited();
         return m_k;
     }
 
+    uint64_t SDFSmoothBinaryOperator::fingerprint() const
+    {
+        return hash({m_k}, {m_left->fingerprint(), m_right->fingerprint()});
+    }
+
     /*************************** SDF Union *****************************/
 
     SDFUnion::SDFUnion(const Ref<SDFNode> &left, const Ref<SDFNode> &right, float lambda, IntersectMethod im) : SDFBinaryOperator(left, right, lambda, im)
@@ -226,766 +799,4239 @@ namespace gm
         return std::min(m_left->value(p), m_right->value(p));
     }
 
-    SDFType SDFUnion::type() const
+    void SDFUnion::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
     {
-        return SDFType::BINARY_OPERATOR_UNION;
+        s_value_call_count += static_cast<int>(out.size());
+        std::vector<float> right(out.size());
+        m_left->value_batch(xs, ys, zs, out);
+        m_right->value_batch(xs, ys, zs, right);
+        kernel::combine<kernel::Union>(out.data(), right.data(), static_cast<int>(out.size()), nullptr);
     }
 
-    /************************** SDF Intersection ****************************/
-
-    SDFIntersection::SDFIntersection(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im) : SDFBinaryOperator(l, r)
+    Dual SDFUnion::value_dual(const Dual &x, const Dual &y, const Dual &z) const
     {
+        s_value_call_count++;
+        return kernel::Union()(m_left->value_dual(x, y, z), m_right->value_dual(x, y, z), nullptr);
     }
 
-    Ref<SDFIntersection> SDFIntersection::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im)
+    SDFType SDFUnion::type() const
     {
-        return create_ref<SDFIntersection>(l, r, lambda, im);
+        return SDFType::BINARY_OPERATOR_UNION;
     }
 
-    float SDFIntersection::value(const Point &p) const
+    void SDFUnion::compile(SDFProgram &program) const
     {
-        s_value_call_count++; 
-        return std::max(m_left->value(p), m_right->value(p));
+        // The union is symmetric : evaluate the widest operand first and guard the tightest one,
+        // an operand can only be skipped from its bounds if they are conservative
+        const SDFNode *first = m_left.get(), *second = m_right.get();
+        Box bounds = second->bounds(), other = first->bounds();
+        if (first->conservative_bounds() && (!second->conservative_bounds() || other.radius() < bounds.radius()))
+        {
+            std::swap(first, second);
+            std::swap(bounds, other);
+        }
+
+        program.compile(*first);
+        int skip = second->conservative_bounds() ? program.begin_skip(bounds) : -1;
+        program.compile(*second);
+        program.emit(SDFOpCode::BINARY_OPERATOR_UNION);
+        program.end_skip(skip);
     }
 
-    SDFType SDFIntersection::type() const
+    Interval SDFUnion::interval(const Box &box) const
     {
-        return SDFType::BINARY_OPERATOR_INTERSECTION;
+        return kernel::Union{}(m_left->interval(box), m_right->interval(box), nullptr);
     }
 
-    /************************** SDF Substraction ****************************/
-
-    SDFSubstraction::SDFSubstraction(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im) : SDFBinaryOperator(l, r, lambda, im)
+    Box SDFUnion::bounds() const
     {
+        return Box(m_left->bounds(), m_right->bounds());
     }
 
-    Ref<SDFSubstraction> SDFSubstraction::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im)
+    bool SDFUnion::conservative_bounds() const
     {
-        return create_ref<SDFSubstraction>(l, r, lambda, im);
+        return m_left->conservative_bounds() && m_right->conservative_bounds();
     }
 
-    float SDFSubstraction::value(const Point &p) const
+    Ref<SDFNode> SDFUnion::prune(const Box &box, Interval &range)
     {
-        s_value_call_count++; 
-        return std::max(m_left->value(p), -m_right->value(p));
+        Interval a, b;
+        Ref<SDFNode> left = m_left->prune(box, a);
+        Ref<SDFNode> right = m_right->prune(box, b);
+
+        // min(a, b) is a wherever a <= b
+        if (a.hi <= b.lo)
+        {
+            range = a;
+            return left;
+        }
+        if (b.hi < a.lo)
+        {
+            range = b;
+            return right;
+        }
+
+        range = kernel::Union{}(a, b, nullptr);
+        return rebuild<SDFUnion>(left, right);
     }
 
-    SDFType SDFSubstraction::type() const
+    Ref<SDFNode> SDFUnion::optimize()
     {
-        return SDFType::BINARY_OPERATOR_SUBSTRACTION;
+        return rebuild<SDFUnion>(m_left->optimize(), m_right->optimize());
     }
 
-    /************************** SDF XOR ****************************/
+    /************************** SDF Intersection ****************************/
 
-    SDFXOR::SDFXOR(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im) : SDFBinaryOperator(l, r, lambda, im)
+    SDFIntersection::SDFIntersection(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im) : SDFBinaryOperator(l, r)
     {
     }
 
-    Ref<SDFXOR> SDFXOR::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im)
+    Ref<SDFIntersection> SDFIntersection::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im)
     {
-        return std::make_shared<SDFXOR>(l, r, lambda, im);
+        return create_ref<SDFIntersection>(l, r, lambda, im);
     }
 
-    float SDFXOR::value(const Point &p) const
+    float SDFIntersection::value(const Point &p) const
     {
         s_value_call_count++; 
-        float fA = m_left->value(p);
-        float fB = m_right->value(p);
-        return std::max(std::min(fA, fB), -std::max(fA, fB));
+        return std::max(m_left->value(p), m_right->value(p));
     }
 
-    SDFType SDFXOR::type() const
+    void SDFIntersection::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
     {
-        return SDFType::BINARY_OPERATOR_XOR;
+        s_value_call_count += static_cast<int>(out.size());
+        std::vector<float> right(out.size());
+        m_left->value_batch(xs, ys, zs, out);
+        m_right->value_batch(xs, ys, zs, right);
+        kernel::combine<kernel::Intersection>(out.data(), right.data(), static_cast<int>(out.size()), nullptr);
     }
 
-    /************************** SDF Smooth Union ****************************/
-
-    SDFSmoothUnion::SDFSmoothUnion(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im) : SDFSmoothBinaryOperator(l, r, k, lambda, im)
+    Dual SDFIntersection::value_dual(const Dual &x, const Dual &y, const Dual &z) const
     {
+        s_value_call_count++;
+        return kernel::Intersection()(m_left->value_dual(x, y, z), m_right->value_dual(x, y, z), nullptr);
     }
 
-    Ref<SDFSmoothUnion> SDFSmoothUnion::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im)
+    SDFType SDFIntersection::type() const
     {
-        return std::make_shared<SDFSmoothUnion>(l, r, k, lambda, im);
+        return SDFType::BINARY_OPERATOR_INTERSECTION;
     }
 
-    float SDFSmoothUnion::value(const Point &p) const
+    void SDFIntersection::compile(SDFProgram &program) const
     {
-        s_value_call_count++; 
-        float fA = m_left->value(p);
-        float fB = m_right->value(p);
-        float h = std::max(m_k - abs(fA - fB), 0.f);
-
-        float g = m_k > 0. ? h * h * 0.25 / m_k : 0.0;
-        return std::min(fA, fB) - g;
+        program.compile(*m_left);
+        program.compile(*m_right);
+        program.emit(SDFOpCode::BINARY_OPERATOR_INTERSECTION);
     }
 
-    SDFType SDFSmoothUnion::type() const
+    Interval SDFIntersection::interval(const Box &box) const
     {
-        return SDFType::BINARY_OPERATOR_SMOOTH_UNION;
+        return kernel::Intersection{}(m_left->interval(box), m_right->interval(box), nullptr);
     }
 
-    /************************** SDF Smooth Intersection ****************************/
-
-    SDFSmoothIntersection::SDFSmoothIntersection(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im) : SDFSmoothBinaryOperator(l, r, k, lambda, im)
+    Box SDFIntersection::bounds() const
     {
+        Box a = m_left->bounds(), b = m_right->bounds();
+        return Box(max(a[0], b[0]), min(a[1], b[1]));
     }
 
-    Ref<SDFSmoothIntersection> SDFSmoothIntersection::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im)
+    Ref<SDFNode> SDFIntersection::prune(const Box &box, Interval &range)
     {
-        return std::make_shared<SDFSmoothIntersection>(l, r, k, lambda, im);
-    }
+        Interval a, b;
+        Ref<SDFNode> left = m_left->prune(box, a);
+        Ref<SDFNode> right = m_right->prune(box, b);
 
-    float SDFSmoothIntersection::value(const Point &p) const
-    {
-        s_value_call_count++; 
-        float fA = m_left->value(p);
-        float fB = m_right->value(p);
-        float h = std::max(m_k - abs(fA - fB), 0.f);
+        // max(a, b) is a wherever a >= b
+        if (a.lo >= b.hi)
+        {
+            range = a;
+            return left;
+        }
+        if (b.lo > a.hi)
+        {
+            range = b;
+            return right;
+        }
 
-        float g = m_k > 0. ? h * h * 0.25 / m_k : 0.0;
-        return std::max(fA, fB) + g;
+        range = kernel::Intersection{}(a, b, nullptr);
+        return rebuild<SDFIntersection>(left, right);
     }
 
-    SDFType SDFSmoothIntersection::type() const
+    Ref<SDFNode> SDFIntersection::optimize()
     {
-        return SDFType::BINARY_OPERATOR_SMOOTH_INTERSECTION;
+        return rebuild<SDFIntersection>(m_left->optimize(), m_right->optimize());
     }
 
-    /************************** SDF Smooth Substraction ****************************/
+    /************************** SDF Substraction ****************************/
 
-    SDFSmoothSubstraction::SDFSmoothSubstraction(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im) : SDFSmoothBinaryOperator(l, r, k, lambda, im)
+    SDFSubstraction::SDFSubstraction(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im) : SDFBinaryOperator(l, r, lambda, im)
     {
     }
 
-    Ref<SDFSmoothSubstraction> SDFSmoothSubstraction::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im)
+    Ref<SDFSubstraction> SDFSubstraction::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im)
     {
-        return create_ref<SDFSmoothSubstraction>(l, r, k, lambda, im);
+        return create_ref<SDFSubstraction>(l, r, lambda, im);
     }
 
-    float SDFSmoothSubstraction::value(const Point &p) const
+    float SDFSubstraction::value(const Point &p) const
     {
         s_value_call_count++; 
-        float fA = m_left->value(p);
-        float fB = m_right->value(p);
-        float h = std::max(m_k - abs(fA + fB), 0.f);
-
-        float g = m_k > 0. ? h * h * 0.25 / m_k : 0.0;
-        return std::max(fA, -fB) + g;
+        return std::max(m_left->value(p), -m_right->value(p));
     }
 
-    SDFType SDFSmoothSubstraction::type() const
+    void SDFSubstraction::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
     {
-        return SDFType::BINARY_OPERATOR_SMOOTH_SUBSTRACTION;
+        s_value_call_count += static_cast<int>(out.size());
+        std::vector<float> right(out.size());
+        m_left->value_batch(xs, ys, zs, out);
+        m_right->value_batch(xs, ys, zs, right);
+        kernel::combine<kernel::Substraction>(out.data(), right.data(), static_cast<int>(out.size()), nullptr);
     }
 
-    /************************** SDF Sphere ****************************/
-
-    SDFSphere::SDFSphere(const Point &c, float r, float l, IntersectMethod im) : SDFNode(l, im), m_center(c), m_radius(r)
+    Dual SDFSubstraction::value_dual(const Dual &x, const Dual &y, const Dual &z) const
     {
+        s_value_call_count++;
+        return kernel::Substraction()(m_left->value_dual(x, y, z), m_right->value_dual(x, y, z), nullptr);
     }
 
-    Ref<SDFSphere> SDFSphere::create(const Point &c, float r, float l, IntersectMethod im)
+    SDFType SDFSubstraction::type() const
     {
-        return create_ref<SDFSphere>(c, r, l, im);
+        return SDFType::BINARY_OPERATOR_SUBSTRACTION;
     }
 
-    float SDFSphere::value(const Point &p) const
+    void SDFSubstraction::compile(SDFProgram &program) const
     {
-        s_value_call_count++; 
-        Vector cp(m_center, p);
-        return length(cp) - m_radius;
+        program.compile(*m_left);
+        program.compile(*m_right);
+        program.emit(SDFOpCode::BINARY_OPERATOR_SUBSTRACTION);
     }
 
-    SDFType SDFSphere::type() const
+    Interval SDFSubstraction::interval(const Box &box) const
     {
-        return SDFType::PRIMITIVE_SPHERE;
+        return kernel::Substraction{}(m_left->interval(box), m_right->interval(box), nullptr);
     }
 
-    float &SDFSphere::radius()
+    Box SDFSubstraction::bounds() const
     {
-        return m_radius;
+        return m_left->bounds();
     }
 
-    float &SDFSphere::center()
+    Ref<SDFNode> SDFSubstraction::prune(const Box &box, Interval &range)
     {
-        return m_center.x;
-    }
+        Interval a, b;
+        Ref<SDFNode> left = m_left->prune(box, a);
+        Ref<SDFNode> right = m_right->prune(box, b);
 
-    /************************** SDF Box ******************************/
+        // max(a, -b) is a wherever a + b >= 0
+        if (a.lo + b.lo >= 0.f)
+        {
+            range = a;
+            return left;
+        }
 
-    SDFBox::SDFBox(const Point &a, const Point &b, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_pmin(a), m_pmax(b)
-    {
+        range = kernel::Substraction{}(a, b, nullptr);
+        return rebuild<SDFSubstraction>(left, right);
     }
 
-    Ref<SDFBox> SDFBox::create(const Point &a, const Point &b, float l, IntersectMethod im)
+    Ref<SDFNode> SDFSubstraction::optimize()
     {
-        return create_ref<SDFBox>(a, b, l, im);
+        return rebuild<SDFSubstraction>(m_left->optimize(), m_right->optimize());
     }
 
-    float SDFBox::value(const Point &p) const
+    /************************** SDF XOR ****************************/
+
+    SDFXOR::SDFXOR(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im) : SDFBinaryOperator(l, r, lambda, im)
     {
-        s_value_call_count++; 
-        Vector q = Vector(abs(p) - ((m_pmax - m_pmin) * 0.5));
-        return std::min(std::max(q(0), std::max(q(1), q(2))), 0.f) + length(max(q, Vector(0)));
     }
 
-    SDFType SDFBox::type() const
+    Ref<SDFXOR> SDFXOR::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float lambda, IntersectMethod im)
     {
-        return SDFType::PRIMITIVE_BOX;
+        return std::make_shared<SDFXOR>(l, r, lambda, im);
     }
 
-    float &SDFBox::pmin()
+    float SDFXOR::value(const Point &p) const
     {
-        return m_pmin.x;
+        s_value_call_count++; 
+        float fA = m_left->value(p);
+        float fB = m_right->value(p);
+        return std::max(std::min(fA, fB), -std::max(fA, fB));
     }
 
-    float &SDFBox::pmax()
+    void SDFXOR::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
     {
-        return m_pmax.x;
+        s_value_call_count += static_cast<int>(out.size());
+        std::vector<float> right(out.size());
+        m_left->value_batch(xs, ys, zs, out);
+        m_right->value_batch(xs, ys, zs, right);
+        kernel::combine<kernel::XOR>(out.data(), right.data(), static_cast<int>(out.size()), nullptr);
     }
 
-    /************************** SDF Plane ******************************/
+    Dual SDFXOR::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        return kernel::XOR()(m_left->value_dual(x, y, z), m_right->value_dual(x, y, z), nullptr);
+    }
 
-    SDFPlane::SDFPlane(const Vector &normal, float height, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_normal(normal), m_height(height)
+    SDFType SDFXOR::type() const
     {
+        return SDFType::BINARY_OPERATOR_XOR;
     }
 
-    Ref<SDFPlane> SDFPlane::create(const Vector &normal, float height, float l, IntersectMethod im)
+    void SDFXOR::compile(SDFProgram &program) const
     {
-        return std::make_shared<SDFPlane>(normal, height, l, im);
+        program.compile(*m_left);
+        program.compile(*m_right);
+        program.emit(SDFOpCode::BINARY_OPERATOR_XOR);
     }
 
-    float SDFPlane::value(const Point &p) const
+    Interval SDFXOR::interval(const Box &box) const
     {
-        s_value_call_count++; 
-        return dot(Vector(p), m_normal) + m_height;
+        return kernel::XOR{}(m_left->interval(box), m_right->interval(box), nullptr);
     }
 
-    SDFType SDFPlane::type() const
+    Box SDFXOR::bounds() const
     {
-        return SDFType::PRIMITIVE_PLANE;
+        return Box(m_left->bounds(), m_right->bounds());
     }
 
-    float &SDFPlane::height()
+    Ref<SDFNode> SDFXOR::prune(const Box &box, Interval &range)
     {
-        return m_height;
+        Interval a, b;
+        Ref<SDFNode> left = m_left->prune(box, a);
+        Ref<SDFNode> right = m_right->prune(box, b);
+        range = kernel::XOR{}(a, b, nullptr);
+        return rebuild<SDFXOR>(left, right);
     }
 
-    float &SDFPlane::normal()
+    Ref<SDFNode> SDFXOR::optimize()
     {
-        return m_normal.x;
+        return rebuild<SDFXOR>(m_left->optimize(), m_right->optimize());
     }
 
-    /************************** SDF Torus ******************************/
+    /************************** SDF Smooth Union ****************************/
 
-    SDFTorus::SDFTorus(float r1, float r2, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_R(r1), m_r(r2)
+    SDFSmoothUnion::SDFSmoothUnion(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im) : SDFSmoothBinaryOperator(l, r, k, lambda, im)
     {
     }
 
-    Ref<SDFTorus> SDFTorus::create(float r1, float r2, float l, IntersectMethod im)
+    Ref<SDFSmoothUnion> SDFSmoothUnion::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im)
     {
-        return std::make_shared<SDFTorus>(r1, r2, l, im);
+        return std::make_shared<SDFSmoothUnion>(l, r, k, lambda, im);
     }
 
-    float SDFTorus::value(const Point &p) const
+    float SDFSmoothUnion::value(const Point &p) const
     {
         s_value_call_count++; 
-        vec2 q = vec2(length({p.x, p.z}) - m_R, p.y);
-        return length(q) - m_r;
-    }
+        float fA = m_left->value(p);
+        float fB = m_right->value(p);
+        float h = std::max(m_k - std::abs(fA - fB), 0.f);
 
-    SDFType SDFTorus::type() const
-    {
-        return SDFType::PRIMITIVE_TORUS;
+        float g = m_k > 0. ? h * h * 0.25 / m_k : 0.0;
+        return std::min(fA, fB) - g;
     }
 
-    float &SDFTorus::r()
+    void SDFSmoothUnion::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
     {
-        return m_r;
+        s_value_call_count += static_cast<int>(out.size());
+        std::vector<float> right(out.size());
+        m_left->value_batch(xs, ys, zs, out);
+        m_right->value_batch(xs, ys, zs, right);
+        const float k[] = {m_k};
+        kernel::combine<kernel::SmoothUnion>(out.data(), right.data(), static_cast<int>(out.size()), k);
     }
 
-    float &SDFTorus::R()
+    Dual SDFSmoothUnion::value_dual(const Dual &x, const Dual &y, const Dual &z) const
     {
-        return m_R;
+        s_value_call_count++;
+        const float k[] = {m_k};
+        return kernel::SmoothUnion()(m_left->value_dual(x, y, z), m_right->value_dual(x, y, z), k);
     }
 
-    /************************** SDF Capsule ******************************/
-
-    SDFCapsule::SDFCapsule(float radius, float height, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_radius(radius), m_height(height)
+    SDFType SDFSmoothUnion::type() const
     {
+        return SDFType::BINARY_OPERATOR_SMOOTH_UNION;
     }
 
-    Ref<SDFCapsule> SDFCapsule::create(float radius, float height, float l, IntersectMethod im)
+    void SDFSmoothUnion::compile(SDFProgram &program) const
     {
-        return std::make_shared<SDFCapsule>(radius, height, l, im);
+        const SDFNode *first = m_left.get(), *second = m_right.get();
+        Box bounds = second->bounds(), other = first->bounds();
+        if (first->conservative_bounds() && (!second->conservative_bounds() || other.radius() < bounds.radius()))
+        {
+            std::swap(first, second);
+            std::swap(bounds, other);
+        }
+
+        program.compile(*first);
+        int skip = second->conservative_bounds() ? program.begin_skip(bounds, std::max(m_k, 0.f)) : -1;
+        program.compile(*second);
+        program.emit(SDFOpCode::BINARY_OPERATOR_SMOOTH_UNION, {m_k});
+        program.end_skip(skip);
     }
 
-    float SDFCapsule::value(const Point &p) const
+    Interval SDFSmoothUnion::interval(const Box &box) const
     {
-        s_value_call_count++; 
-        Vector point = Vector(p);
-        point.y -= std::clamp(p.y, 0.f, m_height);
-        return length(point) - m_radius;
+        const float k[] = {m_k};
+        return kernel::SmoothUnion{}(m_left->interval(box), m_right->interval(box), k);
     }
 
-    SDFType SDFCapsule::type() const
+    Box SDFSmoothUnion::bounds() const
     {
-        return SDFType::PRIMITIVE_CAPSULE;
+        // The blend lowers the field by at most k / 4
+        Box box(m_left->bounds(), m_right->bounds());
+        return Box(box[0] - Vector(std::max(m_k, 0.f) * 0.25f), box[1] + Vector(std::max(m_k, 0.f) * 0.25f));
     }
 
-    float &SDFCapsule::radius()
+    Ref<SDFNode> SDFSmoothUnion::prune(const Box &box, Interval &range)
     {
-        return m_radius;
+        const float k[] = {m_k};
+        Interval a, b;
+        Ref<SDFNode> left = m_left->prune(box, a);
+        Ref<SDFNode> right = m_right->prune(box, b);
+
+        // The blend vanishes where |a - b| >= k
+        if (a.hi + std::max(m_k, 0.f) <= b.lo)
+        {
+            range = a;
+            return left;
+        }
+        if (b.hi + std::max(m_k, 0.f) < a.lo)
+        {
+            range = b;
+            return right;
+        }
+
+        range = kernel::SmoothUnion{}(a, b, k);
+        return rebuild<SDFSmoothUnion>(left, right);
     }
 
-    float &SDFCapsule::height()
+    Ref<SDFNode> SDFSmoothUnion::optimize()
     {
-        return m_height;
+        // The blend vanishes for k <= 0
+        if (m_k <= 0.f)
+            return SDFUnion::create(m_left->optimize(), m_right->optimize(), m_lambda, m_intersect_method);
+        return rebuild<SDFSmoothUnion>(m_left->optimize(), m_right->optimize());
     }
 
-    /************************** SDF Cylinder ******************************/
+    /************************** SDF Smooth Intersection ****************************/
 
-    SDFCylinder::SDFCylinder(float radius, float height, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_radius(radius), m_height(height)
+    SDFSmoothIntersection::SDFSmoothIntersection(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im) : SDFSmoothBinaryOperator(l, r, k, lambda, im)
     {
     }
 
-    Ref<SDFCylinder> SDFCylinder::create(float radius, float height, float l, IntersectMethod im)
+    Ref<SDFSmoothIntersection> SDFSmoothIntersection::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im)
     {
-        return std::make_shared<SDFCylinder>(radius, height, l, im);
+        return std::make_shared<SDFSmoothIntersection>(l, r, k, lambda, im);
     }
 
-    float SDFCylinder::value(const Point &p) const
+    float SDFSmoothIntersection::value(const Point &p) const
     {
         s_value_call_count++; 
-        vec2 d = abs(vec2(length({p.x, p.z}), p.y)) - vec2(m_radius, m_height);
-        return std::min(std::max(d.x, d.y), 0.f) + length(max(d, 0));
+        float fA = m_left->value(p);
+        float fB = m_right->value(p);
+        float h = std::max(m_k - std::abs(fA - fB), 0.f);
+
+        float g = m_k > 0. ? h * h * 0.25 / m_k : 0.0;
+        return std::max(fA, fB) + g;
     }
 
-    SDFType SDFCylinder::type() const
+    void SDFSmoothIntersection::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
     {
-        return SDFType::PRIMITIVE_CYLINDER;
+        s_value_call_count += static_cast<int>(out.size());
+        std::vector<float> right(out.size());
+        m_left->value_batch(xs, ys, zs, out);
+        m_right->value_batch(xs, ys, zs, right);
+        const float k[] = {m_k};
+        kernel::combine<kernel::SmoothIntersection>(out.data(), right.data(), static_cast<int>(out.size()), k);
     }
 
-    float &SDFCylinder::radius()
+    Dual SDFSmoothIntersection::value_dual(const Dual &x, const Dual &y, const Dual &z) const
     {
-        return m_radius;
+        s_value_call_count++;
+        const float k[] = {m_k};
+        return kernel::SmoothIntersection()(m_left->value_dual(x, y, z), m_right->value_dual(x, y, z), k);
     }
 
-    float &SDFCylinder::height()
+    SDFType SDFSmoothIntersection::type() const
     {
-        return m_height;
+        return SDFType::BINARY_OPERATOR_SMOOTH_INTERSECTION;
     }
 
-    /************************** SDF Translation ******************************/
-
-    SDFTranslation::SDFTranslation(const Ref<SDFNode> &node, const Vector &t, float lambda, IntersectMethod im) : SDFUnaryOperator(node, lambda, im), m_translation(t) 
+    void SDFSmoothIntersection::compile(SDFProgram &program) const
     {
+        program.compile(*m_left);
+        program.compile(*m_right);
+        program.emit(SDFOpCode::BINARY_OPERATOR_SMOOTH_INTERSECTION, {m_k});
     }
 
-    Ref<SDFTranslation> SDFTranslation::create(const Ref<SDFNode> &node, const Vector &t, float l, IntersectMethod im)
+    Interval SDFSmoothIntersection::interval(const Box &box) const
     {
-
-        return std::make_shared<SDFTranslation>(node, t, l, im);
+        const float k[] = {m_k};
+        return kernel::SmoothIntersection{}(m_left->interval(box), m_right->interval(box), k);
     }
 
-    float SDFTranslation::value(const Point &p) const
+    Box SDFSmoothIntersection::bounds() const
     {
-        s_value_call_count++; 
-        Transform tf = Translation(m_translation).inverse();
-        return m_node->value(tf(p));
+        Box a = m_left->bounds(), b = m_right->bounds();
+        return Box(max(a[0], b[0]), min(a[1], b[1]));
     }
 
-    SDFType SDFTranslation::type() const
+    Ref<SDFNode> SDFSmoothIntersection::prune(const Box &box, Interval &range)
     {
-        return SDFType::TRANSFORM_TRANSLATION;
+        const float k[] = {m_k};
+        Interval a, b;
+        Ref<SDFNode> left = m_left->prune(box, a);
+        Ref<SDFNode> right = m_right->prune(box, b);
+
+        // The blend vanishes where |a - b| >= k
+        if (a.lo >= b.hi + std::max(m_k, 0.f))
+        {
+            range = a;
+            return left;
+        }
+        if (b.lo > a.hi + std::max(m_k, 0.f))
+        {
+            range = b;
+            return right;
+        }
+
+        range = kernel::SmoothIntersection{}(a, b, k);
+        return rebuild<SDFSmoothIntersection>(left, right);
     }
 
-    float &SDFTranslation::translation()
+    Ref<SDFNode> SDFSmoothIntersection::optimize()
     {
-        return m_translation.x;
+        // The blend vanishes for k <= 0
+        if (m_k <= 0.f)
+            return SDFIntersection::create(m_left->optimize(), m_right->optimize(), m_lambda, m_intersect_method);
+        return rebuild<SDFSmoothIntersection>(m_left->optimize(), m_right->optimize());
     }
 
-    /************************** SDF Rotation ******************************/
+    /************************** SDF Smooth Substraction ****************************/
 
-    SDFRotation::SDFRotation(const Ref<SDFNode> &node, const Vector &axis, float angle, float lambda, IntersectMethod im) : SDFUnaryOperator(node, lambda, im), m_axis(axis), m_angle(angle)
+    SDFSmoothSubstraction::SDFSmoothSubstraction(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im) : SDFSmoothBinaryOperator(l, r, k, lambda, im)
     {
     }
 
-    Ref<SDFRotation> SDFRotation::create(const Ref<SDFNode> &node, const Vector &axis, float angle, float lambda, IntersectMethod im)
+    Ref<SDFSmoothSubstraction> SDFSmoothSubstraction::create(const Ref<SDFNode> &l, const Ref<SDFNode> &r, float k, float lambda, IntersectMethod im)
     {
-        return std::make_shared<SDFRotation>(node, axis, angle, lambda, im);
+        return create_ref<SDFSmoothSubstraction>(l, r, k, lambda, im);
     }
 
-    float SDFRotation::value(const Point &p) const
+    float SDFSmoothSubstraction::value(const Point &p) const
     {
         s_value_call_count++; 
-        Transform tf = Rotation(m_axis, m_angle).inverse();
-        return m_node->value(tf(p));
+        float fA = m_left->value(p);
+        float fB = m_right->value(p);
+        float h = std::max(m_k - std::abs(fA + fB), 0.f);
+
+        float g = m_k > 0. ? h * h * 0.25 / m_k : 0.0;
+        return std::max(fA, -fB) + g;
     }
 
-    SDFType SDFRotation::type() const
+    void SDFSmoothSubstraction::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
     {
-        return SDFType::TRANSFORM_ROTATION;
+        s_value_call_count += static_cast<int>(out.size());
+        std::vector<float> right(out.size());
+        m_left->value_batch(xs, ys, zs, out);
+        m_right->value_batch(xs, ys, zs, right);
+        const float k[] = {m_k};
+        kernel::combine<kernel::SmoothSubstraction>(out.data(), right.data(), static_cast<int>(out.size()), k);
     }
 
-    float &SDFRotation::axis()
+    Dual SDFSmoothSubstraction::value_dual(const Dual &x, const Dual &y, const Dual &z) const
     {
-        return m_axis.x; 
+        s_value_call_count++;
+        const float k[] = {m_k};
+        return kernel::SmoothSubstraction()(m_left->value_dual(x, y, z), m_right->value_dual(x, y, z), k);
     }
 
-    float &SDFRotation::angle()
+    SDFType SDFSmoothSubstraction::type() const
     {
-        return m_angle;
-    }    
+        return SDFType::BINARY_OPERATOR_SMOOTH_SUBSTRACTION;
+    }
 
-    /************************** SDF Rotation X ******************************/
+    void SDFSmoothSubstraction::compile(SDFProgram &program) const
+    {
+        program.compile(*m_left);
+        program.compile(*m_right);
+        program.emit(SDFOpCode::BINARY_OPERATOR_SMOOTH_SUBSTRACTION, {m_k});
+    }
 
-    SDFRotationX::SDFRotationX(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im) : SDFRotation(node, {1., 0., 0.}, angle, lambda, im)
+    Interval SDFSmoothSubstraction::interval(const Box &box) const
     {
+        const float k[] = {m_k};
+        return kernel::SmoothSubstraction{}(m_left->interval(box), m_right->interval(box), k);
     }
 
-    Ref<SDFRotationX> SDFRotationX::create(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im)
+    Box SDFSmoothSubstraction::bounds() const
     {
-        return std::make_shared<SDFRotationX>(node, angle, lambda, im);
+        return m_left->bounds();
     }
 
-    SDFType SDFRotationX::type() const
+    Ref<SDFNode> SDFSmoothSubstraction::prune(const Box &box, Interval &range)
     {
-        return SDFType::TRANSFORM_ROTATION_X;
+        const float k[] = {m_k};
+        Interval a, b;
+        Ref<SDFNode> left = m_left->prune(box, a);
+        Ref<SDFNode> right = m_right->prune(box, b);
+
+        // The blend vanishes where |a + b| >= k
+        if (a.lo + b.lo >= std::max(m_k, 0.f))
+        {
+            range = a;
+            return left;
+        }
+
+        range = kernel::SmoothSubstraction{}(a, b, k);
+        return rebuild<SDFSmoothSubstraction>(left, right);
     }
 
-    /************************** SDF Rotation Y ******************************/
+    Ref<SDFNode> SDFSmoothSubstraction::optimize()
+    {
+        // The blend vanishes for k <= 0
+        if (m_k <= 0.f)
+            return SDFSubstraction::create(m_left->optimize(), m_right->optimize(), m_lambda, m_intersect_method);
+        return rebuild<SDFSmoothSubstraction>(m_left->optimize(), m_right->optimize());
+    }
 
-    SDFRotationY::SDFRotationY(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im) : SDFRotation(node, {0., 1., 0.}, angle, lambda, im)
+    /************************** SDF Union Set ****************************/
+
+    static float operand_value(const SDFNode &node, float x, float y, float z)
     {
+        return node.value(Point(x, y, z));
     }
 
-    Ref<SDFRotationY> SDFRotationY::create(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im)
+    static Dual operand_value(const SDFNode &node, const Dual &x, const Dual &y, const Dual &z)
     {
-        return std::make_shared<SDFRotationY>(node, angle, lambda, im);
+        return node.value_dual(x, y, z);
     }
 
-    SDFType SDFRotationY::type() const
+    //! Serializes the hierarchy builds of SDFUnionSet and SDFInstances after edits, recursive since nested sets are built from their parent.
+    static std::recursive_mutex s_build_mutex;
+
+    SDFUnionSet::SDFUnionSet(const std::vector<Ref<SDFNode>> &nodes, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_nodes(nodes)
     {
-        return SDFType::TRANSFORM_ROTATION_Y;
+        build();
     }
 
-    /************************** SDF Rotation Z ******************************/
+    Ref<SDFUnionSet> SDFUnionSet::create(const std::vector<Ref<SDFNode>> &nodes, float lambda, IntersectMethod im)
+    {
+        return create_ref<SDFUnionSet>(nodes, lambda, im);
+    }
 
-    SDFRotationZ::SDFRotationZ(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im) : SDFRotation(node, {0., 0., 1.}, angle, lambda, im)
+    /*!
+    \brief Build the hierarchy over the bounds of the operands.
+
+    Operands without SDFNode::conservative_bounds cannot be culled from their bounds, they are evaluated everywhere.
+    */
+    void SDFUnionSet::build() const
+    {
+        const uint64_t generation = s_generation.load(std::memory_order_acquire);
+        std::vector<Box> bounds(m_nodes.size());
+        std::vector<int> items;
+        m_unbounded.clear();
+        m_bounds = Box(0.f);
+        for (int i = 0; i < static_cast<int>(m_nodes.size()); i++)
+        {
+            bounds[i] = m_nodes[i]->bounds();
+            m_bounds = i == 0 ? bounds[i] : Box(m_bounds, bounds[i]);
+            if (bounded(bounds[i]) && m_nodes[i]->conservative_bounds())
+                items.push_back(i);
+            else
+                m_unbounded.push_back(i);
+        }
+        if (!bounded(m_bounds))
+            m_bounds = s_unbounded;
+        m_hierarchy.build(bounds, items);
+        std::atomic_ref<uint64_t>(m_generation).store(generation, std::memory_order_release);
+    }
+
+    /*!
+    \brief Build the hierarchy again if a node accessor was called since it was built.
+
+    Operands edited in place through their accessors may have moved, the hierarchy is rebuilt before the next evaluation.
+    Edits must not happen concurrently with evaluation.
+    */
+    void SDFUnionSet::update() const
     {
+        const uint64_t generation = s_generation.load(std::memory_order_acquire);
+        if (std::atomic_ref<uint64_t>(m_generation).load(std::memory_order_acquire) == generation)
+            return;
+        std::lock_guard<std::recursive_mutex> lock(s_build_mutex);
+        if (std::atomic_ref<uint64_t>(m_generation).load(std::memory_order_acquire) != generation)
+            build();
     }
 
-    Ref<SDFRotationZ> SDFRotationZ::create(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im)
+    /*!
+    \brief Evaluate the union, visiting the operands nearest first.
+
+    An operand farther from the point than the current value plus the blend radius cannot change the result.
+    */
+    template <typename T>
+    T SDFUnionSet::evaluate(const T &x, const T &y, const T &z) const
     {
-        return std::make_shared<SDFRotationZ>(node, angle, lambda, im);
+        update();
+        const float k = std::max(m_k, 0.f);
+        const Vector p(primal(x), primal(y), primal(z));
+
+        T m(FLT_MAX);
+        float threshold = FLT_MAX;
+
+        // Operands that may take part in the blend, kept on the stack unless many of them are blended
+        constexpr int size = 16;
+        T blended[size];
+        std::vector<T> crowded;
+        int count = 0;
+
+        auto operand = [&](int i)
+        {
+            const T d = operand_value(*m_nodes[i], x, y, z);
+            if (primal(d) < primal(m))
+            {
+                m = d;
+                threshold = primal(m) + k;
+            }
+            if (k > 0.f && primal(d) < threshold)
+            {
+                if (count < size)
+                    blended[count] = d;
+                else
+                    crowded.push_back(d);
+                count++;
+            }
+        };
+
+        for (int i : m_unbounded)
+            operand(i);
+        m_hierarchy.traverse([&](const Box &box)
+                             { return box.distance(p); },
+                             operand, threshold);
+
+        if (k <= 0.f || count < 2)
+            return m;
+
+        // Sum of the pairwise blends with the nearest operand, the nearest one included adds k^2
+        T s(-k * k);
+        auto blend = [&](const T &d)
+        {
+            s = s + simd::square(simd::max(T(k) - (d - m), T(0.f)));
+        };
+        std::for_each(blended, blended + std::min(count, size), blend);
+        std::for_each(crowded.begin(), crowded.end(), blend);
+        return m - simd::min(s, T(k * k)) * T(0.25f / k);
     }
 
-    SDFType SDFRotationZ::type() const
+    float SDFUnionSet::value(const Point &p) const
     {
-        return SDFType::TRANSFORM_ROTATION_Z;
+        s_value_call_count++;
+        return evaluate<float>(p.x, p.y, p.z);
     }
 
-    /************************** SDF Scale ******************************/
+    Dual SDFUnionSet::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        return evaluate<Dual>(x, y, z);
+    }
 
-    SDFScale::SDFScale(const Ref<SDFNode> &node, float s, float lambda, IntersectMethod im) : SDFUnaryOperator(node, lambda, im), m_scale(s)
+    /*!
+    \brief Visit the operands that may set the field over a box, nearest first.
+    \param visit Called with the index of every visited operand, returns its range over the box.
+    */
+    template <typename Visit>
+    void SDFUnionSet::traverse(const Box &box, Visit visit) const
+    {
+        update();
+        const float k = std::max(m_k, 0.f);
+        float hi = FLT_MAX, threshold = FLT_MAX;
+
+        auto operand = [&](int i)
+        {
+            hi = std::min(hi, visit(i).hi);
+            threshold = hi + k;
+        };
+
+        for (int i : m_unbounded)
+            operand(i);
+        m_hierarchy.traverse([&](const Box &cell)
+                             { return cell.distance(box); },
+                             operand, threshold);
+    }
+
+    Interval SDFUnionSet::interval(const Box &box) const
     {
+        Interval range(FLT_MAX);
+        int count = 0;
+        traverse(box, [&](int i)
+                 {
+                     const Interval r = m_nodes[i]->interval(box);
+                     range = kernel::Union{}(range, r, nullptr);
+                     count++;
+                     return r;
+                 });
+
+        if (m_k > 0.f && count > 1)
+            range.lo -= 0.25f * m_k;
+        return range;
     }
 
-    Ref<SDFScale> SDFScale::create(const Ref<SDFNode> &node, float s, float l, IntersectMethod im)
+    Box SDFUnionSet::bounds() const
     {
+        update();
+        if (!bounded(m_bounds))
+            return s_unbounded;
 
-        return std::make_shared<SDFScale>(node, s, l, im);
+        // The blend lowers the field by at most k / 4
+        return Box(m_bounds[0] - Vector(std::max(m_k, 0.f) * 0.25f), m_bounds[1] + Vector(std::max(m_k, 0.f) * 0.25f));
     }
 
-    float SDFScale::value(const Point &p) const
+    bool SDFUnionSet::conservative_bounds() const
+    {
+        return std::all_of(m_nodes.begin(), m_nodes.end(), [](const Ref<SDFNode> &node)
+                           { return node->conservative_bounds(); });
+    }
+
+    float SDFUnionSet::lipschitz() const
+    {
+        float lambda = 1.f;
+        for (const Ref<SDFNode> &node : m_nodes)
+            lambda = std::max(lambda, node->lipschitz());
+        return lambda;
+    }
+
+    /*!
+    \brief Keep the operands that may set the field over a box, pruned in turn.
+    */
+    template <typename Node>
+    Ref<SDFNode> SDFUnionSet::prune_set(const Box &box, Interval &range)
+    {
+        if (m_nodes.empty())
+            return SDFNode::prune(box, range);
+
+        std::vector<Ref<SDFNode>> nodes;
+        std::vector<Interval> ranges;
+        bool changed = false;
+        traverse(box, [&](int i)
+                 {
+                     Interval r;
+                     nodes.push_back(m_nodes[i]->prune(box, r));
+                     ranges.push_back(r);
+                     changed = changed || nodes.back() != m_nodes[i];
+                     return r;
+                 });
+
+        // Operands farther than k above the nearest one never take part in the union
+        const float k = std::max(m_k, 0.f);
+        int nearest = 0;
+        for (int i = 1; i < static_cast<int>(ranges.size()); i++)
+        {
+            if (ranges[i].hi < ranges[nearest].hi)
+                nearest = i;
+        }
+
+        std::vector<Ref<SDFNode>> kept;
+        range = ranges[nearest];
+        for (int i = 0; i < static_cast<int>(nodes.size()); i++)
+        {
+            if (i != nearest && ranges[i].lo >= ranges[nearest].hi + k)
+                continue;
+            kept.push_back(nodes[i]);
+            range = kernel::Union{}(range, ranges[i], nullptr);
+        }
+
+        if (kept.size() == 1)
+            return kept[0];
+
+        if (k > 0.f)
+            range.lo -= 0.25f * k;
+        if (!changed && kept.size() == m_nodes.size())
+            return shared_from_this();
+
+        Ref<Node> copy = create_ref<Node>(static_cast<const Node &>(*this));
+        copy->m_nodes = std::move(kept);
+        copy->build();
+        return copy;
+    }
+
+    Ref<SDFNode> SDFUnionSet::prune(const Box &box, Interval &range)
+    {
+        return prune_set<SDFUnionSet>(box, range);
+    }
+
+    /*!
+    \brief Copy of the union of the optimized operands, the hierarchy is built again over their current bounds.
+    */
+    Ref<SDFNode> SDFUnionSet::optimize()
+    {
+        std::vector<Ref<SDFNode>> nodes(m_nodes.size());
+        for (size_t i = 0; i < m_nodes.size(); i++)
+            nodes[i] = m_nodes[i]->optimize();
+        return SDFUnionSet::create(nodes, m_lambda, m_intersect_method);
+    }
+
+    uint64_t SDFUnionSet::fingerprint() const
+    {
+        uint64_t h = hash({m_k});
+        for (const Ref<SDFNode> &node : m_nodes)
+            h = utils::hash(node->fingerprint(), h);
+        return h;
+    }
+
+    SDFType SDFUnionSet::type() const
+    {
+        return SDFType::NARY_OPERATOR_UNION;
+    }
+
+    const std::vector<Ref<SDFNode>> &SDFUnionSet::nodes() const
+    {
+        return m_nodes;
+    }
+
+    /************************** SDF Smooth Union Set ****************************/
+
+    SDFSmoothUnionSet::SDFSmoothUnionSet(const std::vector<Ref<SDFNode>> &nodes, float k, float lambda, IntersectMethod im) : SDFUnionSet(nodes, lambda, im)
+    {
+        m_k = k;
+    }
+
+    Ref<SDFSmoothUnionSet> SDFSmoothUnionSet::create(const std::vector<Ref<SDFNode>> &nodes, float k, float lambda, IntersectMethod im)
+    {
+        return create_ref<SDFSmoothUnionSet>(nodes, k, lambda, im);
+    }
+
+    Ref<SDFNode> SDFSmoothUnionSet::prune(const Box &box, Interval &range)
+    {
+        return prune_set<SDFSmoothUnionSet>(box, range);
+    }
+
+    Ref<SDFNode> SDFSmoothUnionSet::optimize()
+    {
+        std::vector<Ref<SDFNode>> nodes(m_nodes.size());
+        for (size_t i = 0; i < m_nodes.size(); i++)
+            nodes[i] = m_nodes[i]->optimize();
+
+        if (m_k <= 0.f)
+            return SDFUnionSet::create(nodes, m_lambda, m_intersect_method);
+        return SDFSmoothUnionSet::create(nodes, m_k, m_lambda, m_intersect_method);
+    }
+
+    /*!
+    \brief Lipschitz constant of the blend.
+
+    The weights of the blended operand gradients sum to 1, but the nearest one gets a negative weight once the
+    others add up to more than 2k : with n operands, the sum of their absolute values is at most sqrt(n - 1) - 1.
+    */
+    float SDFSmoothUnionSet::lipschitz() const
+    {
+        const float n = static_cast<float>(m_nodes.size());
+        return std::max(1.f, std::sqrt(std::max(n - 1.f, 0.f)) - 1.f) * SDFUnionSet::lipschitz();
+    }
+
+    bool SDFSmoothUnionSet::conservative_bounds() const
+    {
+        return false;
+    }
+
+    SDFType SDFSmoothUnionSet::type() const
+    {
+        return SDFType::NARY_OPERATOR_SMOOTH_UNION;
+    }
+
+    float SDFSmoothUnionSet::k() const
+    {
+        return m_k;
+    }
+
+    /************************** SDF Sphere ****************************/
+
+    SDFSphere::SDFSphere(const Point &c, float r, float l, IntersectMethod im) : SDFNode(l, im), m_center(c), m_radius(r)
+    {
+    }
+
+    Ref<SDFSphere> SDFSphere::create(const Point &c, float r, float l, IntersectMethod im)
+    {
+        return create_ref<SDFSphere>(c, r, l, im);
+    }
+
+    float SDFSphere::value(const Point &p) const
     {
         s_value_call_count++; 
-        return m_node->value(p / m_scale) * m_scale;
+        Vector cp(m_center, p);
+        return length(cp) - m_radius;
     }
 
-    SDFType SDFScale::type() const
+    void SDFSphere::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
     {
-        return SDFType::TRANSFORM_SCALE;
+        s_value_call_count += static_cast<int>(out.size());
+        const float k[] = {m_center.x, m_center.y, m_center.z, m_radius};
+        kernel::evaluate<kernel::Sphere>(xs.data(), ys.data(), zs.data(), out.data(), static_cast<int>(out.size()), k);
     }
 
-    float &SDFScale::scale()
+    Dual SDFSphere::value_dual(const Dual &x, const Dual &y, const Dual &z) const
     {
-        return m_scale;
+        s_value_call_count++;
+        const float k[] = {m_center.x, m_center.y, m_center.z, m_radius};
+        return kernel::Sphere()(x, y, z, k);
     }
 
-    /************************** SDF Tree ******************************/
+    SDFType SDFSphere::type() const
+    {
+        return SDFType::PRIMITIVE_SPHERE;
+    }
 
-    SDFTree::SDFTree(const Ref<SDFNode> &root, float l, IntersectMethod im) : SDFNode(l, im), m_root(root)
+    void SDFSphere::compile(SDFProgram &program) const
     {
+        program.emit(SDFOpCode::PRIMITIVE_SPHERE, {m_center.x, m_center.y, m_center.z, m_radius});
     }
 
-    Ref<SDFTree> SDFTree::create(const Ref<SDFNode> &root, float l, IntersectMethod im)
+    Interval SDFSphere::interval(const Box &box) const
     {
-        return create_ref<SDFTree>(root, l, im);
+        const float k[] = {m_center.x, m_center.y, m_center.z, m_radius};
+        return kernel::Sphere{}(Interval::axis(box, 0), Interval::axis(box, 1), Interval::axis(box, 2), k);
     }
 
-    float SDFTree::value(const Point &p) const
+    Box SDFSphere::bounds() const
+    {
+        return Box(Vector(m_center), m_radius);
+    }
+
+    bool SDFSphere::conservative_bounds() const
+    {
+        return true;
+    }
+
+    uint64_t SDFSphere::fingerprint() const
+    {
+        return hash({m_center.x, m_center.y, m_center.z, m_radius});
+    }
+
+    float &SDFSphere::radius()
     {
-        return m_root->value(p);
+        edited();
+        return m_radius;
+    }
+
+    float &SDFSphere::center()
+    {
+        edited();
+        return m_center.x;
+    }
+
+    /************************** SDF Box ******************************/
+
+    SDFBox::SDFBox(const Point &a, const Point &b, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_pmin(a), m_pmax(b)
+    {
+    }
+
+    Ref<SDFBox> SDFBox::create(const Point &a, const Point &b, float l, IntersectMethod im)
+    {
+        return create_ref<SDFBox>(a, b, l, im);
+    }
+
+    float SDFBox::value(const Point &p) const
+    {
+        s_value_call_count++; 
+        Vector q = Vector(abs(p) - ((m_pmax - m_pmin) * 0.5));
+        return std::min(std::max(q(0), std::max(q(1), q(2))), 0.f) + length(max(q, Vector(0)));
+    }
+
+    void SDFBox::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        Vector h = (m_pmax - m_pmin) * 0.5;
+        const float k[] = {h.x, h.y, h.z};
+        kernel::evaluate<kernel::Box>(xs.data(), ys.data(), zs.data(), out.data(), static_cast<int>(out.size()), k);
+    }
+
+    Dual SDFBox::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        Vector h = (m_pmax - m_pmin) * 0.5;
+        const float k[] = {h.x, h.y, h.z};
+        return kernel::Box()(x, y, z, k);
+    }
+
+    SDFType SDFBox::type() const
+    {
+        return SDFType::PRIMITIVE_BOX;
+    }
+
+    void SDFBox::compile(SDFProgram &program) const
+    {
+        Vector h = (m_pmax - m_pmin) * 0.5;
+        program.emit(SDFOpCode::PRIMITIVE_BOX, {h.x, h.y, h.z});
+    }
+
+    Interval SDFBox::interval(const Box &box) const
+    {
+        Vector h = (m_pmax - m_pmin) * 0.5;
+        const float k[] = {h.x, h.y, h.z};
+        return kernel::Box{}(Interval::axis(box, 0), Interval::axis(box, 1), Interval::axis(box, 2), k);
+    }
+
+    Box SDFBox::bounds() const
+    {
+        Vector h = (m_pmax - m_pmin) * 0.5;
+        return Box(-h, h);
+    }
+
+    bool SDFBox::conservative_bounds() const
+    {
+        return true;
+    }
+
+    uint64_t SDFBox::fingerprint() const
+    {
+        return hash({m_pmin.x, m_pmin.y, m_pmin.z, m_pmax.x, m_pmax.y, m_pmax.z});
+    }
+
+    float &SDFBox::pmin()
+    {
+        edited();
+        return m_pmin.x;
+    }
+
+    float &SDFBox::pmax()
+    {
+        edited();
+        return m_pmax.x;
     }
 
-    Ref<SDFNode> SDFTree::left()
-    {
-        return m_root->left();
-    }
+    /************************** SDF Plane ******************************/
+
+    SDFPlane::SDFPlane(const Vector &normal, float height, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_normal(normal), m_height(height)
+    {
+    }
+
+    Ref<SDFPlane> SDFPlane::create(const Vector &normal, float height, float l, IntersectMethod im)
+    {
+        return std::make_shared<SDFPlane>(normal, height, l, im);
+    }
+
+    float SDFPlane::value(const Point &p) const
+    {
+        s_value_call_count++; 
+        return dot(Vector(p), m_normal) + m_height;
+    }
+
+    void SDFPlane::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        const float k[] = {m_normal.x, m_normal.y, m_normal.z, m_height};
+        kernel::evaluate<kernel::Plane>(xs.data(), ys.data(), zs.data(), out.data(), static_cast<int>(out.size()), k);
+    }
+
+    Dual SDFPlane::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        const float k[] = {m_normal.x, m_normal.y, m_normal.z, m_height};
+        return kernel::Plane()(x, y, z, k);
+    }
+
+    SDFType SDFPlane::type() const
+    {
+        return SDFType::PRIMITIVE_PLANE;
+    }
+
+    void SDFPlane::compile(SDFProgram &program) const
+    {
+        program.emit(SDFOpCode::PRIMITIVE_PLANE, {m_normal.x, m_normal.y, m_normal.z, m_height});
+    }
+
+    Interval SDFPlane::interval(const Box &box) const
+    {
+        const float k[] = {m_normal.x, m_normal.y, m_normal.z, m_height};
+        return kernel::Plane{}(Interval::axis(box, 0), Interval::axis(box, 1), Interval::axis(box, 2), k);
+    }
+
+    Box SDFPlane::bounds() const
+    {
+        return s_unbounded;
+    }
+
+    bool SDFPlane::conservative_bounds() const
+    {
+        return true;
+    }
+
+    float SDFPlane::lipschitz() const
+    {
+        return length(m_normal);
+    }
+
+    uint64_t SDFPlane::fingerprint() const
+    {
+        return hash({m_normal.x, m_normal.y, m_normal.z, m_height});
+    }
+
+    float &SDFPlane::height()
+    {
+        edited();
+        return m_height;
+    }
+
+    float &SDFPlane::normal()
+    {
+        edited();
+        return m_normal.x;
+    }
+
+    /************************** SDF Torus ******************************/
+
+    SDFTorus::SDFTorus(float r1, float r2, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_R(r1), m_r(r2)
+    {
+    }
+
+    Ref<SDFTorus> SDFTorus::create(float r1, float r2, float l, IntersectMethod im)
+    {
+        return std::make_shared<SDFTorus>(r1, r2, l, im);
+    }
+
+    float SDFTorus::value(const Point &p) const
+    {
+        s_value_call_count++; 
+        vec2 q = vec2(length({p.x, p.z}) - m_R, p.y);
+        return length(q) - m_r;
+    }
+
+    void SDFTorus::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        const float k[] = {m_R, m_r};
+        kernel::evaluate<kernel::Torus>(xs.data(), ys.data(), zs.data(), out.data(), static_cast<int>(out.size()), k);
+    }
+
+    Dual SDFTorus::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        const float k[] = {m_R, m_r};
+        return kernel::Torus()(x, y, z, k);
+    }
+
+    SDFType SDFTorus::type() const
+    {
+        return SDFType::PRIMITIVE_TORUS;
+    }
+
+    void SDFTorus::compile(SDFProgram &program) const
+    {
+        program.emit(SDFOpCode::PRIMITIVE_TORUS, {m_R, m_r});
+    }
+
+    Interval SDFTorus::interval(const Box &box) const
+    {
+        const float k[] = {m_R, m_r};
+        return kernel::Torus{}(Interval::axis(box, 0), Interval::axis(box, 1), Interval::axis(box, 2), k);
+    }
+
+    Box SDFTorus::bounds() const
+    {
+        return Box(Vector(-m_R - m_r, -m_r, -m_R - m_r), Vector(m_R + m_r, m_r, m_R + m_r));
+    }
+
+    bool SDFTorus::conservative_bounds() const
+    {
+        return true;
+    }
+
+    uint64_t SDFTorus::fingerprint() const
+    {
+        return hash({m_R, m_r});
+    }
+
+    float &SDFTorus::r()
+    {
+        edited();
+        return m_r;
+    }
+
+    float &SDFTorus::R()
+    {
+        edited();
+        return m_R;
+    }
+
+    /************************** SDF Capsule ******************************/
+
+    SDFCapsule::SDFCapsule(float radius, float height, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_radius(radius), m_height(height)
+    {
+    }
+
+    Ref<SDFCapsule> SDFCapsule::create(float radius, float height, float l, IntersectMethod im)
+    {
+        return std::make_shared<SDFCapsule>(radius, height, l, im);
+    }
+
+    float SDFCapsule::value(const Point &p) const
+    {
+        s_value_call_count++; 
+        Vector point = Vector(p);
+        point.y -= std::clamp(p.y, 0.f, m_height);
+        return length(point) - m_radius;
+    }
+
+    void SDFCapsule::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        const float k[] = {m_radius, m_height};
+        kernel::evaluate<kernel::Capsule>(xs.data(), ys.data(), zs.data(), out.data(), static_cast<int>(out.size()), k);
+    }
+
+    Dual SDFCapsule::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        const float k[] = {m_radius, m_height};
+        return kernel::Capsule()(x, y, z, k);
+    }
+
+    SDFType SDFCapsule::type() const
+    {
+        return SDFType::PRIMITIVE_CAPSULE;
+    }
+
+    void SDFCapsule::compile(SDFProgram &program) const
+    {
+        program.emit(SDFOpCode::PRIMITIVE_CAPSULE, {m_radius, m_height});
+    }
+
+    Interval SDFCapsule::interval(const Box &box) const
+    {
+        const float k[] = {m_radius, m_height};
+        return kernel::Capsule{}(Interval::axis(box, 0), Interval::axis(box, 1), Interval::axis(box, 2), k);
+    }
+
+    Box SDFCapsule::bounds() const
+    {
+        return Box(Vector(-m_radius, -m_radius, -m_radius), Vector(m_radius, m_height + m_radius, m_radius));
+    }
+
+    bool SDFCapsule::conservative_bounds() const
+    {
+        return true;
+    }
+
+    uint64_t SDFCapsule::fingerprint() const
+    {
+        return hash({m_radius, m_height});
+    }
+
+    float &SDFCapsule::radius()
+    {
+        edited();
+        return m_radius;
+    }
+
+    float &SDFCapsule::height()
+    {
+        edited();
+        return m_height;
+    }
+
+    /************************** SDF Cylinder ******************************/
+
+    SDFCylinder::SDFCylinder(float radius, float height, float lambda, IntersectMethod im) : SDFNode(lambda, im), m_radius(radius), m_height(height)
+    {
+    }
+
+    Ref<SDFCylinder> SDFCylinder::create(float radius, float height, float l, IntersectMethod im)
+    {
+        return std::make_shared<SDFCylinder>(radius, height, l, im);
+    }
+
+    float SDFCylinder::value(const Point &p) const
+    {
+        s_value_call_count++; 
+        vec2 d = abs(vec2(length({p.x, p.z}), p.y)) - vec2(m_radius, m_height);
+        return std::min(std::max(d.x, d.y), 0.f) + length(max(d, 0));
+    }
+
+    void SDFCylinder::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        const float k[] = {m_radius, m_height};
+        kernel::evaluate<kernel::Cylinder>(xs.data(), ys.data(), zs.data(), out.data(), static_cast<int>(out.size()), k);
+    }
+
+    Dual SDFCylinder::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        const float k[] = {m_radius, m_height};
+        return kernel::Cylinder()(x, y, z, k);
+    }
+
+    SDFType SDFCylinder::type() const
+    {
+        return SDFType::PRIMITIVE_CYLINDER;
+    }
+
+    void SDFCylinder::compile(SDFProgram &program) const
+    {
+        program.emit(SDFOpCode::PRIMITIVE_CYLINDER, {m_radius, m_height});
+    }
+
+    Interval SDFCylinder::interval(const Box &box) const
+    {
+        const float k[] = {m_radius, m_height};
+        return kernel::Cylinder{}(Interval::axis(box, 0), Interval::axis(box, 1), Interval::axis(box, 2), k);
+    }
+
+    Box SDFCylinder::bounds() const
+    {
+        return Box(Vector(-m_radius, -m_height, -m_radius), Vector(m_radius, m_height, m_radius));
+    }
+
+    bool SDFCylinder::conservative_bounds() const
+    {
+        return true;
+    }
+
+    uint64_t SDFCylinder::fingerprint() const
+    {
+        return hash({m_radius, m_height});
+    }
+
+    float &SDFCylinder::radius()
+    {
+        edited();
+        return m_radius;
+    }
+
+    float &SDFCylinder::height()
+    {
+        edited();
+        return m_height;
+    }
+
+    /************************** SDF Grid ******************************/
+
+    //! Header of the files written by SDFGrid::save, the arrays follow at the given byte offsets.
+    struct GridHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t storage;       //!< GridStorage.
+        uint32_t interpolation; //!< GridInterpolation.
+        int32_t resolution;
+        int32_t size[3];
+        int32_t brick_size;
+        int32_t brick_count[3];
+        float box[6];
+        float cell;
+        float slope;
+        float slopes[3];
+        uint64_t source;
+        uint64_t offsets[3]; //!< Dense samples, bricks and half float samples.
+        uint64_t counts[3];
+    };
+
+    static const char s_grid_magic[8] = {'G', 'M', 'S', 'D', 'F', 'G', 'R', 'D'};
+    static const uint32_t s_grid_version = 1;
+    static const uint64_t s_grid_alignment = 64; //!< Alignment of the arrays in the file, a cache line.
+
+    const int SDFGrid::s_brick_size = 8;
+    const float SDFGrid::s_band = 3.f;
+
+    /*!
+    \brief Bake a node into a grid.
+    \param node Node, sampled with the bytecode of a tree.
+    \param box %Box enclosing the surface, snapped to cubic cells.
+    \param resolution Number of cells along the largest side of the box.
+    \param interpolation Interpolation of the samples.
+    \param storage Storage of the samples, sparse grids fit high resolutions.
+    \param threads Number of threads sampling the grid, 0 uses the hardware concurrency.
+    */
+    SDFGrid::SDFGrid(const Ref<SDFNode> &node, const Box &box, int resolution, GridInterpolation interpolation, GridStorage storage, int threads, float l, IntersectMethod im)
+        : SDFNode(l, im), m_node(node), m_box(box), m_resolution(std::max(resolution, 1)), m_interpolation(interpolation), m_storage(storage)
+    {
+        const Vector size = box.size();
+        m_cell = std::max({size.x, size.y, size.z}) / m_resolution;
+        for (int a = 0; a < 3; a++)
+        {
+            m_size[a] = std::max(static_cast<int>(std::ceil(size(a) / m_cell - 1e-3f)), 1) + 1;
+            m_box[1](a) = m_box[0](a) + (m_size[a] - 1) * m_cell;
+            m_brick_count[a] = (m_size[a] + s_brick_size - 1) / s_brick_size;
+        }
+
+        bake(threads);
+    }
+
+    /*!
+    \brief Grid using the arrays of a mapped file in place, see SDFGrid::load.
+    \param file Mapped file, checked by SDFGrid::load.
+    */
+    SDFGrid::SDFGrid(const Ref<MappedFile> &file, float l, IntersectMethod im) : SDFNode(l, im), m_file(file)
+    {
+        GridHeader header;
+        std::memcpy(&header, file->data(), sizeof(GridHeader));
+
+        m_storage = static_cast<GridStorage>(header.storage);
+        m_interpolation = static_cast<GridInterpolation>(header.interpolation);
+        m_resolution = header.resolution;
+        m_box = Box(Vector(header.box[0], header.box[1], header.box[2]), Vector(header.box[3], header.box[4], header.box[5]));
+        m_cell = header.cell;
+        m_slope = header.slope;
+        m_source = header.source;
+        for (int a = 0; a < 3; a++)
+        {
+            m_size[a] = header.size[a];
+            m_brick_count[a] = header.brick_count[a];
+            m_slopes[a] = header.slopes[a];
+        }
+
+        const unsigned char *data = file->data();
+        m_sample_data = {reinterpret_cast<const float *>(data + header.offsets[0]), header.counts[0]};
+        m_brick_data = {reinterpret_cast<const Brick *>(data + header.offsets[1]), header.counts[1]};
+        m_half_data = {reinterpret_cast<const uint16_t *>(data + header.offsets[2]), header.counts[2]};
+    }
+
+    Ref<SDFGrid> SDFGrid::create(const Ref<SDFNode> &node, const Box &box, int resolution, GridInterpolation interpolation, GridStorage storage, int threads, float l, IntersectMethod im)
+    {
+        return create_ref<SDFGrid>(node, box, resolution, interpolation, storage, threads, l, im);
+    }
+
+    /*!
+    \brief Map a grid saved by SDFGrid::save.
+
+    Only the header and the brick table are read : the pages of the samples are loaded by the system when they are first evaluated.
+    The grid has no node, it can not be baked again.
+    \return The grid, or nullptr if the file can not be mapped or is not a grid of this version.
+    */
+    Ref<SDFGrid> SDFGrid::load(const char *filename, float l, IntersectMethod im)
+    {
+        Ref<MappedFile> file = MappedFile::create(filename);
+        if (!file->valid())
+        {
+            utils::error("Can not map grid file ", filename);
+            return nullptr;
+        }
+
+        GridHeader header{};
+        if (file->size() >= sizeof(GridHeader))
+            std::memcpy(&header, file->data(), sizeof(GridHeader));
+        bool valid = std::equal(std::begin(s_grid_magic), std::end(s_grid_magic), header.magic) && header.version == s_grid_version &&
+                     header.storage < static_cast<uint32_t>(GridStorage::NB_ELT) && header.interpolation < static_cast<uint32_t>(GridInterpolation::NB_ELT) &&
+                     header.brick_size == s_brick_size && header.cell > 0.f;
+
+        // Arrays must fit in the file and match the size of the grid
+        const size_t element[3] = {sizeof(float), sizeof(Brick), sizeof(uint16_t)};
+        for (int a = 0; valid && a < 3; a++)
+        {
+            valid = header.offsets[a] % s_grid_alignment == 0 && header.counts[a] <= (file->size() - std::min<uint64_t>(header.offsets[a], file->size())) / element[a];
+            valid = valid && header.size[a] >= 2 && header.brick_count[a] == (header.size[a] + s_brick_size - 1) / s_brick_size;
+        }
+        if (valid)
+        {
+            const uint64_t samples = static_cast<uint64_t>(header.size[0]) * header.size[1] * header.size[2];
+            const uint64_t bricks = static_cast<uint64_t>(header.brick_count[0]) * header.brick_count[1] * header.brick_count[2];
+            const uint64_t brick = s_brick_size * s_brick_size * s_brick_size;
+            if (header.storage == static_cast<uint32_t>(GridStorage::DENSE))
+                valid = header.counts[0] == samples && header.counts[1] == 0 && header.counts[2] == 0;
+            else
+                valid = header.counts[1] == bricks && header.counts[2] % brick == 0;
+
+            // Bricks of the band must address whole blocks of the half float payload
+            const Brick *table = reinterpret_cast<const Brick *>(file->data() + header.offsets[1]);
+            for (uint64_t b = 0; valid && b < header.counts[1]; b++)
+                valid = table[b].offset == -1 || (table[b].offset >= 0 && static_cast<uint64_t>(table[b].offset) + brick <= header.counts[2]);
+        }
+
+        if (!valid)
+        {
+            utils::error("Invalid grid file ", filename);
+            return nullptr;
+        }
+        return create_ref<SDFGrid>(file, l, im);
+    }
+
+    /*!
+    \brief Save the grid in a file that SDFGrid::load maps.
+
+    The header is followed by the dense samples, the bricks and the half float samples, each aligned to a cache line.
+    Values are stored in the byte order of the machine.
+    \return 0 on success, -1 if the file can not be written.
+    */
+    int SDFGrid::save(const char *filename) const
+    {
+        GridHeader header{};
+        std::copy(std::begin(s_grid_magic), std::end(s_grid_magic), header.magic);
+        header.version = s_grid_version;
+        header.storage = static_cast<uint32_t>(m_storage);
+        header.interpolation = static_cast<uint32_t>(m_interpolation);
+        header.resolution = m_resolution;
+        header.brick_size = s_brick_size;
+        header.cell = m_cell;
+        header.slope = m_slope;
+        header.source = m_source;
+        for (int a = 0; a < 3; a++)
+        {
+            header.size[a] = m_size[a];
+            header.brick_count[a] = m_brick_count[a];
+            header.box[a] = m_box[0](a);
+            header.box[3 + a] = m_box[1](a);
+            header.slopes[a] = m_slopes[a];
+        }
+
+        const void *arrays[3] = {m_sample_data.data(), m_brick_data.data(), m_half_data.data()};
+        const size_t bytes[3] = {m_sample_data.size_bytes(), m_brick_data.size_bytes(), m_half_data.size_bytes()};
+        const size_t counts[3] = {m_sample_data.size(), m_brick_data.size(), m_half_data.size()};
+        uint64_t offset = sizeof(GridHeader);
+        for (int a = 0; a < 3; a++)
+        {
+            offset = (offset + s_grid_alignment - 1) / s_grid_alignment * s_grid_alignment;
+            header.offsets[a] = offset;
+            header.counts[a] = counts[a];
+            offset += bytes[a];
+        }
+
+        FILE *out = fopen(filename, "wb");
+        if (!out)
+        {
+            utils::error("Can not write grid file ", filename);
+            return -1;
+        }
+
+        bool written = fwrite(&header, sizeof(GridHeader), 1, out) == 1;
+        uint64_t position = sizeof(GridHeader);
+        const char padding[s_grid_alignment] = {};
+        for (int a = 0; written && a < 3; a++)
+        {
+            written = fwrite(padding, 1, header.offsets[a] - position, out) == header.offsets[a] - position;
+            written = written && (bytes[a] == 0 || fwrite(arrays[a], 1, bytes[a], out) == bytes[a]);
+            position = header.offsets[a] + bytes[a];
+        }
+        written = fclose(out) == 0 && written;
+
+        if (!written)
+        {
+            utils::error("Can not write grid file ", filename);
+            return -1;
+        }
+        return 0;
+    }
+
+    /*!
+    \brief Sample the node again, after it was edited.
+    \param threads Number of threads, 0 uses the hardware concurrency.
+    */
+    void SDFGrid::bake(int threads)
+    {
+        // Loaded grids keep the samples of their file
+        if (!m_node)
+            return;
+
+        m_file = nullptr;
+        SDFTree tree(m_node);
+        tree.compile();
+
+        Ref<ThreadPool> pool = ThreadPool::create(threads);
+        if (m_storage == GridStorage::SPARSE)
+            bake_sparse(tree, *pool);
+        else
+            bake_dense(tree, *pool);
+
+        m_source = m_node->fingerprint();
+        measure();
+    }
+
+    /*!
+    \brief Sample every point of the grid, the z layers are evaluated in parallel as batches.
+    */
+    void SDFGrid::bake_dense(const SDFTree &tree, ThreadPool &pool)
+    {
+        const int nx = m_size[0], ny = m_size[1], nz = m_size[2];
+        m_samples.resize(static_cast<size_t>(nx) * ny * nz);
+        m_bricks.clear();
+        m_halfs.clear();
+
+        pool.parallel_for(nz, [&](int k)
+                          {
+                              std::vector<float> xs(nx * ny), ys(nx * ny), zs(nx * ny, m_box[0].z + k * m_cell);
+                              for (int j = 0; j < ny; j++)
+                                  for (int i = 0; i < nx; i++)
+                                  {
+                                      xs[j * nx + i] = m_box[0].x + i * m_cell;
+                                      ys[j * nx + i] = m_box[0].y + j * m_cell;
+                                  }
+                              tree.value_batch(xs, ys, zs, std::span<float>(m_samples.data() + static_cast<size_t>(k) * nx * ny, nx * ny)); });
+
+        m_sample_data = m_samples;
+        m_brick_data = {};
+        m_half_data = {};
+    }
+
+    /*!
+    \brief Sample the bricks of the narrow band, the layers of bricks are processed in parallel.
+
+    The range of the tree over a brick discards most of the bricks away from the surface without sampling them.
+    The samples of the other bricks are evaluated as a batch, then stored as half floats if one of them is in the band.
+    */
+    void SDFGrid::bake_sparse(const SDFTree &tree, ThreadPool &pool)
+    {
+        const int n = s_brick_size, bx = m_brick_count[0], by = m_brick_count[1], bz = m_brick_count[2];
+        const float band = s_band * m_cell;
+        m_samples.clear();
+        m_bricks.assign(static_cast<size_t>(bx) * by * bz, Brick());
+
+        std::vector<std::vector<uint16_t>> layers(bz);
+        pool.parallel_for(bz, [&](int k)
+                          {
+                              std::vector<float> xs(n * n * n), ys(n * n * n), zs(n * n * n), values(n * n * n);
+                              for (int j = 0; j < by; j++)
+                                  for (int i = 0; i < bx; i++)
+                                  {
+                                      Brick &brick = m_bricks[(static_cast<size_t>(k) * by + j) * bx + i];
+                                      const Vector a = m_box[0] + Vector(i, j, k) * (n * m_cell);
+                                      const Interval range = tree.interval(Box(a, a + Vector(n - 1, n - 1, n - 1) * m_cell));
+                                      if (range.lo > band || range.hi < -band)
+                                      {
+                                          brick.bound = range.lo > band ? range.lo : range.hi;
+                                          continue;
+                                      }
+
+                                      for (int s = 0; s < n * n * n; s++)
+                                      {
+                                          xs[s] = a.x + (s % n) * m_cell;
+                                          ys[s] = a.y + ((s / n) % n) * m_cell;
+                                          zs[s] = a.z + (s / (n * n)) * m_cell;
+                                      }
+                                      tree.value_batch(xs, ys, zs, values);
+
+                                      // Bricks of a single sign outside of the band keep the sample closest to the surface
+                                      const auto [lo, hi] = std::minmax_element(values.begin(), values.end());
+                                      if (*lo > band || *hi < -band)
+                                      {
+                                          brick.bound = *lo > band ? *lo : *hi;
+                                          continue;
+                                      }
+
+                                      brick.offset = static_cast<int>(layers[k].size());
+                                      for (float value : values)
+                                          layers[k].push_back(utils::float_to_half(value));
+                                  } });
+
+        // Offsets were local to the layers
+        m_halfs.clear();
+        for (int k = 0; k < bz; k++)
+        {
+            const int first = static_cast<int>(m_halfs.size());
+            for (size_t b = static_cast<size_t>(k) * by * bx; b < static_cast<size_t>(k + 1) * by * bx; b++)
+                if (m_bricks[b].offset >= 0)
+                    m_bricks[b].offset += first;
+            m_halfs.insert(m_halfs.end(), layers[k].begin(), layers[k].end());
+        }
+        m_halfs.shrink_to_fit();
+
+        m_sample_data = {};
+        m_brick_data = m_bricks;
+        m_half_data = m_halfs;
+    }
+
+    /*!
+    \brief Measure the slopes between neighbor samples, which bound the Lipschitz constant of the interpolation.
+
+    Inside a cell, a partial derivative of the trilinear interpolation is bounded by the differences along the edges of its axis.
+    The cells of sparse grids that reach a brick reduced to its bound are skipped : the bound is below the field,
+    so that steps taken from it are conservative whatever the slope.
+    */
+    void SDFGrid::measure()
+    {
+        const int nx = m_size[0], ny = m_size[1], nz = m_size[2];
+        const int n = m_storage == GridStorage::SPARSE ? s_brick_size : std::max({nx, ny, nz});
+
+        m_slope = 0.f;
+        for (float &slope : m_slopes)
+            slope = 0.f;
+        for (int k0 = 0; k0 < nz - 1; k0 += n)
+            for (int j0 = 0; j0 < ny - 1; j0 += n)
+                for (int i0 = 0; i0 < nx - 1; i0 += n)
+                {
+                    const Brick *origin = brick(i0, j0, k0);
+                    if (origin && origin->offset < 0)
+                        continue;
+
+                    for (int k = k0; k < std::min(k0 + n, nz - 1); k++)
+                        for (int j = j0; j < std::min(j0 + n, ny - 1); j++)
+                            for (int i = i0; i < std::min(i0 + n, nx - 1); i++)
+                            {
+                                const Brick *last = brick(i + 1, j + 1, k + 1);
+                                if (last != origin && (last->offset < 0 || brick(i + 1, j, k)->offset < 0 || brick(i, j + 1, k)->offset < 0 ||
+                                                       brick(i, j, k + 1)->offset < 0 || brick(i + 1, j + 1, k)->offset < 0 ||
+                                                       brick(i + 1, j, k + 1)->offset < 0 || brick(i, j + 1, k + 1)->offset < 0))
+                                    continue;
+
+                                float d[3] = {0.f, 0.f, 0.f};
+                                for (int e = 0; e < 4; e++)
+                                {
+                                    const int u = e & 1, v = e >> 1;
+                                    d[0] = std::max(d[0], std::abs(at(i + 1, j + u, k + v) - at(i, j + u, k + v)));
+                                    d[1] = std::max(d[1], std::abs(at(i + u, j + 1, k + v) - at(i + u, j, k + v)));
+                                    d[2] = std::max(d[2], std::abs(at(i + u, j + v, k + 1) - at(i + u, j + v, k)));
+                                }
+                                for (int a = 0; a < 3; a++)
+                                    m_slopes[a] = std::max(m_slopes[a], d[a] / m_cell);
+                                m_slope = std::max(m_slope, std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) / m_cell);
+                            }
+                }
+    }
+
+    /*!
+    \brief Brick of a sample of a sparse grid, nullptr for dense grids.
+    */
+    const SDFGrid::Brick *SDFGrid::brick(int i, int j, int k) const
+    {
+        if (m_storage != GridStorage::SPARSE)
+            return nullptr;
+        return &m_brick_data[(static_cast<size_t>(k / s_brick_size) * m_brick_count[1] + j / s_brick_size) * m_brick_count[0] + i / s_brick_size];
+    }
+
+    float SDFGrid::at(int i, int j, int k) const
+    {
+        if (m_storage == GridStorage::DENSE)
+            return m_sample_data[(static_cast<size_t>(k) * m_size[1] + j) * m_size[0] + i];
+
+        const Brick &b = *brick(i, j, k);
+        if (b.offset < 0)
+            return b.bound;
+        const int n = s_brick_size;
+        return utils::half_to_float(m_half_data[b.offset + ((k % n) * n + j % n) * n + i % n]);
+    }
+
+    /*!
+    \brief Interpolate the samples.
+    \param u Coordinates of the point in the lattice, within the grid.
+    */
+    template <typename T>
+    T SDFGrid::interpolate(const T u[3]) const
+    {
+        int c[3];
+        T f[3];
+        for (int a = 0; a < 3; a++)
+        {
+            c[a] = std::clamp(static_cast<int>(std::floor(primal(u[a]))), 0, m_size[a] - 2);
+            f[a] = u[a] - T(static_cast<float>(c[a]));
+        }
+
+        if (m_interpolation == GridInterpolation::TRILINEAR)
+        {
+            T v(0.f);
+            for (int e = 0; e < 8; e++)
+            {
+                const int di = e & 1, dj = (e >> 1) & 1, dk = e >> 2;
+                T w = (di ? f[0] : T(1.f) - f[0]) * (dj ? f[1] : T(1.f) - f[1]) * (dk ? f[2] : T(1.f) - f[2]);
+                v = v + w * T(at(c[0] + di, c[1] + dj, c[2] + dk));
+            }
+            return v;
+        }
+
+        // Catmull-Rom weights of the samples c - 1 to c + 2, clamped to the grid
+        T w[3][4];
+        int id[3][4];
+        for (int a = 0; a < 3; a++)
+        {
+            const T t = f[a], t2 = t * t, t3 = t2 * t;
+            w[a][0] = (t2 * T(2.f) - t3 - t) * T(0.5f);
+            w[a][1] = (t3 * T(3.f) - t2 * T(5.f) + T(2.f)) * T(0.5f);
+            w[a][2] = (t2 * T(4.f) - t3 * T(3.f) + t) * T(0.5f);
+            w[a][3] = (t3 - t2) * T(0.5f);
+            for (int s = 0; s < 4; s++)
+                id[a][s] = std::clamp(c[a] + s - 1, 0, m_size[a] - 1);
+        }
+
+        T v(0.f);
+        for (int k = 0; k < 4; k++)
+            for (int j = 0; j < 4; j++)
+            {
+                T row(0.f);
+                for (int i = 0; i < 4; i++)
+                    row = row + w[0][i] * T(at(id[0][i], id[1][j], id[2][k]));
+                v = v + w[1][j] * w[2][k] * row;
+            }
+        return v;
+    }
+
+    /*!
+    \brief Evaluate the grid, instantiated on float and on Dual.
+
+    Outside of the box, the point is clamped to the box. If the surface is enclosed in the box,
+    the distance is at least the hypotenuse of the distance to the box and of the distance at the clamped point.
+    */
+    template <typename T>
+    T SDFGrid::evaluate(const T &x, const T &y, const T &z) const
+    {
+        const T p[3] = {x, y, z};
+        T u[3], d(0.f);
+        bool outside = false;
+        for (int a = 0; a < 3; a++)
+        {
+            const float lo = m_box[0](a), hi = m_box[1](a);
+            T q = p[a];
+            if (primal(q) < lo || primal(q) > hi)
+            {
+                q = T(primal(q) < lo ? lo : hi);
+                d = d + simd::square(p[a] - q);
+                outside = true;
+            }
+            u[a] = (q - T(lo)) * T(1.f / m_cell);
+        }
+
+        const T v = interpolate(u);
+        if (!outside)
+            return v;
+        return simd::sqrt(d + simd::square(simd::max(v, T(0.f))));
+    }
+
+    float SDFGrid::value(const Point &p) const
+    {
+        s_value_call_count++;
+        return evaluate<float>(p.x, p.y, p.z);
+    }
+
+    Dual SDFGrid::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        return evaluate<Dual>(x, y, z);
+    }
+
+    /*!
+    \brief Gradient of the interpolation, exact rather than finite differences.
+    */
+    Vector SDFGrid::gradient(const Point &p) const
+    {
+        return value_gradient(p).d;
+    }
+
+    SDFType SDFGrid::type() const
+    {
+        return SDFType::PRIMITIVE_GRID;
+    }
+
+    Box SDFGrid::bounds() const
+    {
+        return m_box;
+    }
+
+    /*!
+    \brief Outside of the box, the field is at least the distance to the box.
+    */
+    bool SDFGrid::conservative_bounds() const
+    {
+        return true;
+    }
+
+    /*!
+    \brief Lipschitz constant of the interpolated samples, from the slopes measured when baking.
+    */
+    float SDFGrid::lipschitz() const
+    {
+        float slope = m_slope;
+        if (m_interpolation == GridInterpolation::TRICUBIC)
+        {
+            // Catmull-Rom derivatives reach 1.5 times the largest difference, through weights whose absolute values sum up to 1.25 along the other axes
+            slope = 1.5f * 1.25f * 1.25f * std::sqrt(m_slopes[0] * m_slopes[0] + m_slopes[1] * m_slopes[1] + m_slopes[2] * m_slopes[2]);
+        }
+
+        // Outside of the box, the extension of the field grows at most as fast as the distance to the box
+        return std::max(slope, 1.f);
+    }
+
+    /*!
+    \brief Fingerprint of the grid, the fingerprint of the baked node identifies the samples.
+    */
+    uint64_t SDFGrid::fingerprint() const
+    {
+        return hash({m_box[0].x, m_box[0].y, m_box[0].z, m_cell, static_cast<float>(m_resolution), static_cast<float>(m_interpolation), static_cast<float>(m_storage)}, {m_source});
+    }
+
+    /*!
+    \brief Change the interpolation of the samples, without baking them again.
+    */
+    void SDFGrid::interpolation(GridInterpolation interpolation)
+    {
+        m_interpolation = interpolation;
+    }
+
+    GridInterpolation SDFGrid::interpolation() const
+    {
+        return m_interpolation;
+    }
+
+    const Ref<SDFNode> &SDFGrid::node() const
+    {
+        return m_node;
+    }
+
+    const Box &SDFGrid::box() const
+    {
+        return m_box;
+    }
+
+    int SDFGrid::resolution() const
+    {
+        return m_resolution;
+    }
+
+    float SDFGrid::cell_size() const
+    {
+        return m_cell;
+    }
+
+    GridStorage SDFGrid::storage() const
+    {
+        return m_storage;
+    }
+
+    /*!
+    \brief Size of the samples in bytes, owned or mapped.
+    */
+    size_t SDFGrid::memory() const
+    {
+        return m_sample_data.size_bytes() + m_brick_data.size_bytes() + m_half_data.size_bytes();
+    }
+
+    /************************** SDF Translation ******************************/
+
+    SDFTranslation::SDFTranslation(const Ref<SDFNode> &node, const Vector &t, float lambda, IntersectMethod im) : SDFUnaryOperator(node, lambda, im), m_translation(t) 
+    {
+    }
+
+    Ref<SDFTranslation> SDFTranslation::create(const Ref<SDFNode> &node, const Vector &t, float l, IntersectMethod im)
+    {
+
+        return std::make_shared<SDFTranslation>(node, t, l, im);
+    }
+
+    float SDFTranslation::value(const Point &p) const
+    {
+        s_value_call_count++; 
+        Transform tf = Translation(m_translation).inverse();
+        return m_node->value(tf(p));
+    }
+
+    void SDFTranslation::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        const int n = static_cast<int>(out.size());
+        const float k[] = {m_translation.x, m_translation.y, m_translation.z};
+        std::vector<float> q(3 * n);
+        kernel::transform<kernel::Translate>(xs.data(), ys.data(), zs.data(), q.data(), q.data() + n, q.data() + 2 * n, n, k);
+        m_node->value_batch({q.data(), size_t(n)}, {q.data() + n, size_t(n)}, {q.data() + 2 * n, size_t(n)}, out);
+    }
+
+    Dual SDFTranslation::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        const float k[] = {m_translation.x, m_translation.y, m_translation.z};
+        Dual qx = x, qy = y, qz = z;
+        kernel::Translate()(qx, qy, qz, k);
+        return m_node->value_dual(qx, qy, qz);
+    }
+
+    SDFType SDFTranslation::type() const
+    {
+        return SDFType::TRANSFORM_TRANSLATION;
+    }
+
+    void SDFTranslation::compile(SDFProgram &program) const
+    {
+        program.emit(SDFOpCode::POINT_TRANSLATE, {m_translation.x, m_translation.y, m_translation.z});
+        program.compile(*m_node);
+        program.emit(SDFOpCode::POINT_POP);
+    }
+
+    Interval SDFTranslation::interval(const Box &box) const
+    {
+        return m_node->interval(local(box));
+    }
+
+    Box SDFTranslation::bounds() const
+    {
+        Box box = m_node->bounds();
+        if (!bounded(box))
+            return s_unbounded;
+        return Box(box[0] + m_translation, box[1] + m_translation);
+    }
+
+    Ref<SDFNode> SDFTranslation::prune(const Box &box, Interval &range)
+    {
+        return rebuild<SDFTranslation>(m_node->prune(local(box), range));
+    }
+
+    Ref<SDFNode> SDFTranslation::optimize()
+    {
+        return SDFAffine::fuse(m_node->optimize(), Translation(m_translation), 1.f, m_lambda, m_intersect_method);
+    }
+
+    uint64_t SDFTranslation::fingerprint() const
+    {
+        return hash({m_translation.x, m_translation.y, m_translation.z}, {m_node->fingerprint()});
+    }
+
+    /*!
+    \brief Bounding box of a box mapped into the frame of the operand.
+    */
+    Box SDFTranslation::local(const Box &box) const
+    {
+        const float k[] = {m_translation.x, m_translation.y, m_translation.z};
+        Interval x = Interval::axis(box, 0), y = Interval::axis(box, 1), z = Interval::axis(box, 2);
+        kernel::Translate{}(x, y, z, k);
+        return Box(Vector(x.lo, y.lo, z.lo), Vector(x.hi, y.hi, z.hi));
+    }
+
+    float &SDFTranslation::translation()
+    {
+        edited();
+        return m_translation.x;
+    }
+
+    /************************** SDF Rotation ******************************/
+
+    SDFRotation::SDFRotation(const Ref<SDFNode> &node, const Vector &axis, float angle, float lambda, IntersectMethod im) : SDFUnaryOperator(node, lambda, im), m_axis(axis), m_angle(angle)
+    {
+    }
+
+    Ref<SDFRotation> SDFRotation::create(const Ref<SDFNode> &node, const Vector &axis, float angle, float lambda, IntersectMethod im)
+    {
+        return std::make_shared<SDFRotation>(node, axis, angle, lambda, im);
+    }
+
+    float SDFRotation::value(const Point &p) const
+    {
+        s_value_call_count++; 
+        Transform tf = Rotation(m_axis, m_angle).inverse();
+        return m_node->value(tf(p));
+    }
+
+    void SDFRotation::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        const int n = static_cast<int>(out.size());
+        Transform tf = Rotation(m_axis, m_angle).inverse();
+        const float k[] = {tf.m[0][0], tf.m[0][1], tf.m[0][2], tf.m[0][3],
+                           tf.m[1][0], tf.m[1][1], tf.m[1][2], tf.m[1][3],
+                           tf.m[2][0], tf.m[2][1], tf.m[2][2], tf.m[2][3]};
+        std::vector<float> q(3 * n);
+        kernel::transform<kernel::Transform>(xs.data(), ys.data(), zs.data(), q.data(), q.data() + n, q.data() + 2 * n, n, k);
+        m_node->value_batch({q.data(), size_t(n)}, {q.data() + n, size_t(n)}, {q.data() + 2 * n, size_t(n)}, out);
+    }
+
+    Dual SDFRotation::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        Transform tf = Rotation(m_axis, m_angle).inverse();
+        const float k[] = {tf.m[0][0], tf.m[0][1], tf.m[0][2], tf.m[0][3],
+                           tf.m[1][0], tf.m[1][1], tf.m[1][2], tf.m[1][3],
+                           tf.m[2][0], tf.m[2][1], tf.m[2][2], tf.m[2][3]};
+        Dual qx = x, qy = y, qz = z;
+        kernel::Transform()(qx, qy, qz, k);
+        return m_node->value_dual(qx, qy, qz);
+    }
+
+    SDFType SDFRotation::type() const
+    {
+        return SDFType::TRANSFORM_ROTATION;
+    }
+
+    void SDFRotation::compile(SDFProgram &program) const
+    {
+        Transform tf = Rotation(m_axis, m_angle).inverse();
+        program.emit(SDFOpCode::POINT_TRANSFORM, {tf.m[0][0], tf.m[0][1], tf.m[0][2], tf.m[0][3],
+                                                  tf.m[1][0], tf.m[1][1], tf.m[1][2], tf.m[1][3],
+                                                  tf.m[2][0], tf.m[2][1], tf.m[2][2], tf.m[2][3]});
+        program.compile(*m_node);
+        program.emit(SDFOpCode::POINT_POP);
+    }
+
+    Interval SDFRotation::interval(const Box &box) const
+    {
+        return m_node->interval(local(box));
+    }
+
+    Box SDFRotation::bounds() const
+    {
+        Box box = m_node->bounds();
+        if (!bounded(box))
+            return s_unbounded;
+
+        Transform tf = Rotation(m_axis, m_angle);
+        const float k[] = {tf.m[0][0], tf.m[0][1], tf.m[0][2], tf.m[0][3],
+                           tf.m[1][0], tf.m[1][1], tf.m[1][2], tf.m[1][3],
+                           tf.m[2][0], tf.m[2][1], tf.m[2][2], tf.m[2][3]};
+        Interval x = Interval::axis(box, 0), y = Interval::axis(box, 1), z = Interval::axis(box, 2);
+        kernel::Transform()(x, y, z, k);
+        return Box(Vector(x.lo, y.lo, z.lo), Vector(x.hi, y.hi, z.hi));
+    }
+
+    Ref<SDFNode> SDFRotation::prune(const Box &box, Interval &range)
+    {
+        return rebuild<SDFRotation>(m_node->prune(local(box), range));
+    }
+
+    Ref<SDFNode> SDFRotation::optimize()
+    {
+        return SDFAffine::fuse(m_node->optimize(), Rotation(m_axis, m_angle), 1.f, m_lambda, m_intersect_method);
+    }
+
+    uint64_t SDFRotation::fingerprint() const
+    {
+        return hash({m_axis.x, m_axis.y, m_axis.z, m_angle}, {m_node->fingerprint()});
+    }
+
+    /*!
+    \brief Bounding box of a box mapped into the frame of the operand.
+    */
+    Box SDFRotation::local(const Box &box) const
+    {
+        Transform tf = Rotation(m_axis, m_angle).inverse();
+        const float k[] = {tf.m[0][0], tf.m[0][1], tf.m[0][2], tf.m[0][3],
+                           tf.m[1][0], tf.m[1][1], tf.m[1][2], tf.m[1][3],
+                           tf.m[2][0], tf.m[2][1], tf.m[2][2], tf.m[2][3]};
+        Interval x = Interval::axis(box, 0), y = Interval::axis(box, 1), z = Interval::axis(box, 2);
+        kernel::Transform{}(x, y, z, k);
+        return Box(Vector(x.lo, y.lo, z.lo), Vector(x.hi, y.hi, z.hi));
+    }
+
+    float &SDFRotation::axis()
+    {
+        edited();
+        return m_axis.x; 
+    }
+
+    float &SDFRotation::angle()
+    {
+        edited();
+        return m_angle;
+    }    
+
+    /************************** SDF Rotation X ******************************/
+
+    SDFRotationX::SDFRotationX(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im) : SDFRotation(node, {1., 0., 0.}, angle, lambda, im)
+    {
+    }
+
+    Ref<SDFRotationX> SDFRotationX::create(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im)
+    {
+        return std::make_shared<SDFRotationX>(node, angle, lambda, im);
+    }
+
+    SDFType SDFRotationX::type() const
+    {
+        return SDFType::TRANSFORM_ROTATION_X;
+    }
+
+    Ref<SDFNode> SDFRotationX::prune(const Box &box, Interval &range)
+    {
+        return rebuild<SDFRotationX>(m_node->prune(local(box), range));
+    }
+
+    /************************** SDF Rotation Y ******************************/
+
+    SDFRotationY::SDFRotationY(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im) : SDFRotation(node, {0., 1., 0.}, angle, lambda, im)
+    {
+    }
+
+    Ref<SDFRotationY> SDFRotationY::create(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im)
+    {
+        return std::make_shared<SDFRotationY>(node, angle, lambda, im);
+    }
+
+    SDFType SDFRotationY::type() const
+    {
+        return SDFType::TRANSFORM_ROTATION_Y;
+    }
+
+    Ref<SDFNode> SDFRotationY::prune(const Box &box, Interval &range)
+    {
+        return rebuild<SDFRotationY>(m_node->prune(local(box), range));
+    }
+
+    /************************** SDF Rotation Z ******************************/
+
+    SDFRotationZ::SDFRotationZ(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im) : SDFRotation(node, {0., 0., 1.}, angle, lambda, im)
+    {
+    }
+
+    Ref<SDFRotationZ> SDFRotationZ::create(const Ref<SDFNode> &node, float angle, float lambda, IntersectMethod im)
+    {
+        return std::make_shared<SDFRotationZ>(node, angle, lambda, im);
+    }
+
+    SDFType SDFRotationZ::type() const
+    {
+        return SDFType::TRANSFORM_ROTATION_Z;
+    }
+
+    Ref<SDFNode> SDFRotationZ::prune(const Box &box, Interval &range)
+    {
+        return rebuild<SDFRotationZ>(m_node->prune(local(box), range));
+    }
+
+    /************************** SDF Scale ******************************/
+
+    SDFScale::SDFScale(const Ref<SDFNode> &node, float s, float lambda, IntersectMethod im) : SDFUnaryOperator(node, lambda, im), m_scale(s)
+    {
+    }
+
+    Ref<SDFScale> SDFScale::create(const Ref<SDFNode> &node, float s, float l, IntersectMethod im)
+    {
+
+        return std::make_shared<SDFScale>(node, s, l, im);
+    }
+
+    float SDFScale::value(const Point &p) const
+    {
+        s_value_call_count++; 
+        return m_node->value(p / m_scale) * m_scale;
+    }
+
+    void SDFScale::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        const int n = static_cast<int>(out.size());
+        const float k[] = {m_scale};
+        std::vector<float> q(3 * n);
+        kernel::transform<kernel::InverseScale>(xs.data(), ys.data(), zs.data(), q.data(), q.data() + n, q.data() + 2 * n, n, k);
+        m_node->value_batch({q.data(), size_t(n)}, {q.data() + n, size_t(n)}, {q.data() + 2 * n, size_t(n)}, out);
+        kernel::apply<kernel::Scale>(out.data(), n, k);
+    }
+
+    Dual SDFScale::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        const float k[] = {m_scale};
+        Dual qx = x, qy = y, qz = z;
+        kernel::InverseScale()(qx, qy, qz, k);
+        return kernel::Scale()(m_node->value_dual(qx, qy, qz), k);
+    }
+
+    SDFType SDFScale::type() const
+    {
+        return SDFType::TRANSFORM_SCALE;
+    }
+
+    void SDFScale::compile(SDFProgram &program) const
+    {
+        program.emit(SDFOpCode::POINT_SCALE, {m_scale});
+        program.compile(*m_node);
+        program.emit(SDFOpCode::POINT_POP_SCALE, {m_scale});
+    }
+
+    Interval SDFScale::interval(const Box &box) const
+    {
+        const float k[] = {m_scale};
+        return kernel::Scale{}(m_node->interval(local(box)), k);
+    }
+
+    Box SDFScale::bounds() const
+    {
+        Box box = m_node->bounds();
+        if (!bounded(box))
+            return s_unbounded;
+        return Box(min(box[0] * m_scale, box[1] * m_scale), max(box[0] * m_scale, box[1] * m_scale));
+    }
+
+    Ref<SDFNode> SDFScale::prune(const Box &box, Interval &range)
+    {
+        const float k[] = {m_scale};
+        Ref<SDFNode> node = m_node->prune(local(box), range);
+        range = kernel::Scale{}(range, k);
+        return rebuild<SDFScale>(node);
+    }
+
+    Ref<SDFNode> SDFScale::optimize()
+    {
+        return SDFAffine::fuse(m_node->optimize(), Scale(m_scale, m_scale, m_scale), m_scale, m_lambda, m_intersect_method);
+    }
+
+    uint64_t SDFScale::fingerprint() const
+    {
+        return hash({m_scale}, {m_node->fingerprint()});
+    }
+
+    /*!
+    \brief Bounding box of a box mapped into the frame of the operand.
+    */
+    Box SDFScale::local(const Box &box) const
+    {
+        const float k[] = {m_scale};
+        Interval x = Interval::axis(box, 0), y = Interval::axis(box, 1), z = Interval::axis(box, 2);
+        kernel::InverseScale{}(x, y, z, k);
+        return Box(Vector(x.lo, y.lo, z.lo), Vector(x.hi, y.hi, z.hi));
+    }
+
+    float &SDFScale::scale()
+    {
+        edited();
+        return m_scale;
+    }
+
+    /************************** SDF Affine ******************************/
+
+    //! Largest singular value of the linear part of a 3x4 row major matrix.
+    static float stretch(const float *k)
+    {
+        // Largest eigenvalue of the symmetric matrix A^T A, in closed form
+        double a[3][3];
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                a[i][j] = double(k[i]) * k[j] + double(k[4 + i]) * k[4 + j] + double(k[8 + i]) * k[8 + j];
+
+        const double p1 = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        if (p1 == 0.0)
+            return static_cast<float>(std::sqrt(std::max(a[0][0], std::max(a[1][1], a[2][2]))));
+
+        const double q = (a[0][0] + a[1][1] + a[2][2]) / 3.0;
+        const double p2 = (a[0][0] - q) * (a[0][0] - q) + (a[1][1] - q) * (a[1][1] - q) + (a[2][2] - q) * (a[2][2] - q) + 2.0 * p1;
+        const double p = std::sqrt(p2 / 6.0);
+
+        double b[3][3];
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                b[i][j] = (a[i][j] - (i == j ? q : 0.0)) / p;
+        const double det = b[0][0] * (b[1][1] * b[2][2] - b[1][2] * b[2][1]) - b[0][1] * (b[1][0] * b[2][2] - b[1][2] * b[2][0]) + b[0][2] * (b[1][0] * b[2][1] - b[1][1] * b[2][0]);
+        const double phi = std::acos(std::clamp(det / 2.0, -1.0, 1.0)) / 3.0;
+        return static_cast<float>(std::sqrt(q + 2.0 * p * std::cos(phi)));
+    }
+
+    //! Check whether a transform is a uniform scale of a given ratio, the identity for a ratio of 1.
+    static bool scaling(const Transform &tf, float s)
+    {
+        for (int r = 0; r < 4; r++)
+            for (int c = 0; c < 4; c++)
+                if (tf.m[r][c] != (r != c ? 0.f : (r < 3 ? s : 1.f)))
+                    return false;
+        return true;
+    }
+
+    //! Check whether a transform is a translation.
+    static bool translation(const Transform &tf)
+    {
+        Transform linear = tf;
+        for (int r = 0; r < 3; r++)
+            linear.m[r][3] = 0.f;
+        return scaling(linear, 1.f);
+    }
+
+    /*!
+    \brief Create the node.
+    \param node Operand.
+    \param transform Operand to world transform, a similarity.
+    \param scale Ratio of the similarity, the distances of the operand are multiplied by it.
+    */
+    SDFAffine::SDFAffine(const Ref<SDFNode> &node, const Transform &transform, float scale, float lambda, IntersectMethod im) : SDFUnaryOperator(node, lambda, im), m_transform(transform), m_scale(scale)
+    {
+        const Transform inverse = transform.inverse();
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                m_inverse[4 * r + c] = inverse.m[r][c];
+    }
+
+    Ref<SDFAffine> SDFAffine::create(const Ref<SDFNode> &node, const Transform &transform, float scale, float l, IntersectMethod im)
+    {
+        return create_ref<SDFAffine>(node, transform, scale, l, im);
+    }
+
+    /*!
+    \brief Apply a transform to a node, fused with the node if it is already transformed.
+    Identity transforms are dropped.
+    */
+    Ref<SDFNode> SDFAffine::fuse(const Ref<SDFNode> &node, const Transform &transform, float scale, float l, IntersectMethod im)
+    {
+        Ref<SDFNode> operand = node;
+        Transform tf = transform;
+        if (Ref<SDFAffine> affine = std::dynamic_pointer_cast<SDFAffine>(node))
+        {
+            operand = affine->m_node;
+            tf = transform * affine->m_transform;
+            scale *= affine->m_scale;
+        }
+
+        if (scaling(tf, 1.f) && scale == 1.f)
+            return operand;
+        return SDFAffine::create(operand, tf, scale, l, im);
+    }
+
+    float SDFAffine::value(const Point &p) const
+    {
+        s_value_call_count++;
+        const float k[] = {m_scale};
+        float x = p.x, y = p.y, z = p.z;
+        kernel::Transform()(x, y, z, m_inverse);
+        return kernel::Scale()(m_node->value(Point(x, y, z)), k);
+    }
+
+    void SDFAffine::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        s_value_call_count += static_cast<int>(out.size());
+        const int n = static_cast<int>(out.size());
+        const float k[] = {m_scale};
+        std::vector<float> q(3 * n);
+        kernel::transform<kernel::Transform>(xs.data(), ys.data(), zs.data(), q.data(), q.data() + n, q.data() + 2 * n, n, m_inverse);
+        m_node->value_batch({q.data(), size_t(n)}, {q.data() + n, size_t(n)}, {q.data() + 2 * n, size_t(n)}, out);
+        kernel::apply<kernel::Scale>(out.data(), n, k);
+    }
+
+    Dual SDFAffine::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        const float k[] = {m_scale};
+        Dual qx = x, qy = y, qz = z;
+        kernel::Transform()(qx, qy, qz, m_inverse);
+        return kernel::Scale()(m_node->value_dual(qx, qy, qz), k);
+    }
+
+    SDFType SDFAffine::type() const
+    {
+        return SDFType::TRANSFORM_AFFINE;
+    }
+
+    /*!
+    \brief Lower the node, translations and uniform scales keep their dedicated instructions.
+    */
+    void SDFAffine::compile(SDFProgram &program) const
+    {
+        const Transform &tf = m_transform;
+        if (translation(tf))
+            program.emit(SDFOpCode::POINT_TRANSLATE, {tf.m[0][3], tf.m[1][3], tf.m[2][3]});
+        else if (scaling(tf, m_scale))
+            program.emit(SDFOpCode::POINT_SCALE, {m_scale});
+        else
+            program.emit(SDFOpCode::POINT_TRANSFORM, {m_inverse[0], m_inverse[1], m_inverse[2], m_inverse[3],
+                                                      m_inverse[4], m_inverse[5], m_inverse[6], m_inverse[7],
+                                                      m_inverse[8], m_inverse[9], m_inverse[10], m_inverse[11]});
+        program.compile(*m_node);
+        if (m_scale != 1.f)
+            program.emit(SDFOpCode::POINT_POP_SCALE, {m_scale});
+        else
+            program.emit(SDFOpCode::POINT_POP);
+    }
+
+    Interval SDFAffine::interval(const Box &box) const
+    {
+        const float k[] = {m_scale};
+        return kernel::Scale{}(m_node->interval(local(box)), k);
+    }
+
+    Box SDFAffine::bounds() const
+    {
+        Box box = m_node->bounds();
+        if (!bounded(box))
+            return s_unbounded;
+
+        const Transform &tf = m_transform;
+        const float k[] = {tf.m[0][0], tf.m[0][1], tf.m[0][2], tf.m[0][3],
+                           tf.m[1][0], tf.m[1][1], tf.m[1][2], tf.m[1][3],
+                           tf.m[2][0], tf.m[2][1], tf.m[2][2], tf.m[2][3]};
+        Interval x = Interval::axis(box, 0), y = Interval::axis(box, 1), z = Interval::axis(box, 2);
+        kernel::Transform{}(x, y, z, k);
+        return Box(Vector(x.lo, y.lo, z.lo), Vector(x.hi, y.hi, z.hi));
+    }
+
+    /*!
+    \brief Lipschitz constant of the operand, times the distance scale and the largest stretch of the inverse transform.
+    Both cancel out for a similarity.
+    */
+    float SDFAffine::lipschitz() const
+    {
+        return std::abs(m_scale) * stretch(m_inverse) * m_node->lipschitz();
+    }
+
+    Ref<SDFNode> SDFAffine::prune(const Box &box, Interval &range)
+    {
+        const float k[] = {m_scale};
+        Ref<SDFNode> node = m_node->prune(local(box), range);
+        range = kernel::Scale{}(range, k);
+        return rebuild<SDFAffine>(node);
+    }
+
+    Ref<SDFNode> SDFAffine::optimize()
+    {
+        return fuse(m_node->optimize(), m_transform, m_scale, m_lambda, m_intersect_method);
+    }
+
+    uint64_t SDFAffine::fingerprint() const
+    {
+        return utils::hash(m_transform.m, hash({m_scale}, {m_node->fingerprint()}));
+    }
+
+    /*!
+    \brief Bounding box of a box mapped into the frame of the operand.
+    */
+    Box SDFAffine::local(const Box &box) const
+    {
+        Interval x = Interval::axis(box, 0), y = Interval::axis(box, 1), z = Interval::axis(box, 2);
+        kernel::Transform{}(x, y, z, m_inverse);
+        return Box(Vector(x.lo, y.lo, z.lo), Vector(x.hi, y.hi, z.hi));
+    }
+
+    const Transform &SDFAffine::transform() const
+    {
+        return m_transform;
+    }
+
+    float SDFAffine::scale() const
+    {
+        return m_scale;
+    }
+
+    /************************** SDF Instances ******************************/
+
+    SDFInstances::SDFInstances(const Ref<SDFNode> &node, const std::vector<Transform> &transforms, float lambda, IntersectMethod im) : SDFUnaryOperator(node, lambda, im), m_transforms(transforms)
+    {
+        build();
+    }
+
+    Ref<SDFInstances> SDFInstances::create(const Ref<SDFNode> &node, const std::vector<Transform> &transforms, float l, IntersectMethod im)
+    {
+        return create_ref<SDFInstances>(node, transforms, l, im);
+    }
+
+    /*!
+    \brief Precompute the inverse transforms and build the hierarchy over the bounds of the instances.
+    */
+    void SDFInstances::build() const
+    {
+        const uint64_t generation = s_generation.load(std::memory_order_acquire);
+        const int n = static_cast<int>(m_transforms.size());
+        m_inverses.resize(12 * n);
+        m_scales.resize(n);
+
+        // Distances scaled by the smallest stretch are at least the distances to the instance bounds for similarities only
+        const Box box = m_node->bounds();
+        bool conservative = m_node->conservative_bounds();
+        std::vector<Box> bounds(n);
+        m_bounds = Box(0.f);
+        for (int i = 0; i < n; i++)
+        {
+            const Transform &tf = m_transforms[i];
+            const Transform inverse = tf.inverse();
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 4; c++)
+                    m_inverses[12 * i + 4 * r + c] = inverse.m[r][c];
+            m_scales[i] = 1.f / stretch(&m_inverses[12 * i]);
+
+            const float k[] = {tf.m[0][0], tf.m[0][1], tf.m[0][2], tf.m[0][3],
+                               tf.m[1][0], tf.m[1][1], tf.m[1][2], tf.m[1][3],
+                               tf.m[2][0], tf.m[2][1], tf.m[2][2], tf.m[2][3]};
+            Interval x = Interval::axis(box, 0), y = Interval::axis(box, 1), z = Interval::axis(box, 2);
+            kernel::Transform{}(x, y, z, k);
+            bounds[i] = Box(Vector(x.lo, y.lo, z.lo), Vector(x.hi, y.hi, z.hi));
+            m_bounds = i == 0 ? bounds[i] : Box(m_bounds, bounds[i]);
+            conservative = conservative && stretch(k) <= m_scales[i] * 1.0001f;
+        }
+        if (!bounded(box))
+            m_bounds = s_unbounded;
+
+        std::vector<int> items;
+        if (bounded(box) && conservative)
+        {
+            items.resize(n);
+            std::iota(items.begin(), items.end(), 0);
+        }
+        m_hierarchy.build(bounds, items);
+        std::atomic_ref<uint64_t>(m_generation).store(generation, std::memory_order_release);
+    }
+
+    /*!
+    \brief Build the hierarchy again if a node accessor was called since it was built, see SDFUnionSet::update.
+    */
+    void SDFInstances::update() const
+    {
+        const uint64_t generation = s_generation.load(std::memory_order_acquire);
+        if (std::atomic_ref<uint64_t>(m_generation).load(std::memory_order_acquire) == generation)
+            return;
+        std::lock_guard<std::recursive_mutex> lock(s_build_mutex);
+        if (std::atomic_ref<uint64_t>(m_generation).load(std::memory_order_acquire) != generation)
+            build();
+    }
+
+    /*!
+    \brief Evaluate the nearest instance, visiting the instances nearest first.
+    */
+    template <typename T>
+    T SDFInstances::evaluate(const T &x, const T &y, const T &z) const
+    {
+        update();
+        const Vector p(primal(x), primal(y), primal(z));
+
+        T m(FLT_MAX);
+        float threshold = FLT_MAX;
+
+        auto instance = [&](int i)
+        {
+            T qx = x, qy = y, qz = z;
+            kernel::Transform()(qx, qy, qz, &m_inverses[12 * i]);
+            const T d = operand_value(*m_node, qx, qy, qz) * T(m_scales[i]);
+            if (primal(d) < primal(m))
+            {
+                m = d;
+                threshold = primal(m);
+            }
+        };
+
+        if (m_hierarchy.empty())
+        {
+            for (int i = 0; i < static_cast<int>(m_transforms.size()); i++)
+                instance(i);
+        }
+        else
+            m_hierarchy.traverse([&](const Box &box)
+                                 { return box.distance(p); },
+                                 instance, threshold);
+        return m;
+    }
+
+    float SDFInstances::value(const Point &p) const
+    {
+        s_value_call_count++;
+        return evaluate<float>(p.x, p.y, p.z);
+    }
+
+    Dual SDFInstances::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        s_value_call_count++;
+        return evaluate<Dual>(x, y, z);
+    }
+
+    SDFType SDFInstances::type() const
+    {
+        return SDFType::TRANSFORM_INSTANCES;
+    }
+
+    /*!
+    \brief Visit the instances that may set the field over a box, nearest first.
+    \param visit Called with the index of every visited instance, returns its range over the box.
+    */
+    template <typename Visit>
+    void SDFInstances::traverse(const Box &box, Visit visit) const
+    {
+        update();
+        float threshold = FLT_MAX;
+        auto instance = [&](int i)
+        {
+            threshold = std::min(threshold, visit(i).hi);
+        };
+
+        if (m_hierarchy.empty())
+        {
+            for (int i = 0; i < static_cast<int>(m_transforms.size()); i++)
+                instance(i);
+        }
+        else
+            m_hierarchy.traverse([&](const Box &cell)
+                                 { return cell.distance(box); },
+                                 instance, threshold);
+    }
+
+    Interval SDFInstances::interval(const Box &box) const
+    {
+        Interval range(FLT_MAX);
+        traverse(box, [&](int i)
+                 {
+                     const float k[] = {m_scales[i]};
+                     const Interval r = kernel::Scale{}(m_node->interval(local(i, box)), k);
+                     range = kernel::Union{}(range, r, nullptr);
+                     return r;
+                 });
+        return range;
+    }
+
+    Box SDFInstances::bounds() const
+    {
+        update();
+        return m_bounds;
+    }
+
+    /*!
+    \brief Instances are culled from their bounds only when the operand has conservative bounds
+    and every transform is a similarity, see SDFInstances::build.
+    */
+    bool SDFInstances::conservative_bounds() const
+    {
+        update();
+        return m_transforms.empty() || !m_hierarchy.empty();
+    }
+
+    /*!
+    \brief Keep the instances that may set the field over a box, the shared operand is left unchanged.
+    */
+    Ref<SDFNode> SDFInstances::prune(const Box &box, Interval &range)
+    {
+        if (m_transforms.empty())
+            return SDFNode::prune(box, range);
+
+        std::vector<int> instances;
+        std::vector<Interval> ranges;
+        traverse(box, [&](int i)
+                 {
+                     const float k[] = {m_scales[i]};
+                     instances.push_back(i);
+                     ranges.push_back(kernel::Scale{}(m_node->interval(local(i, box)), k));
+                     return ranges.back();
+                 });
+
+        // Instances above the nearest one never take part in the union
+        int nearest = 0;
+        for (int i = 1; i < static_cast<int>(ranges.size()); i++)
+        {
+            if (ranges[i].hi < ranges[nearest].hi)
+                nearest = i;
+        }
+
+        std::vector<Transform> transforms;
+        range = ranges[nearest];
+        for (int i = 0; i < static_cast<int>(instances.size()); i++)
+        {
+            if (i != nearest && ranges[i].lo >= ranges[nearest].hi)
+                continue;
+            transforms.push_back(m_transforms[instances[i]]);
+            range = kernel::Union{}(range, ranges[i], nullptr);
+        }
+
+        if (transforms.size() == m_transforms.size())
+            return shared_from_this();
+
+        Ref<SDFInstances> copy = create_ref<SDFInstances>(*this);
+        copy->m_transforms = std::move(transforms);
+        copy->build();
+        return copy;
+    }
+
+    /*!
+    \brief Copy of the instances of the optimized operand, the bounds of the instances are computed again.
+    */
+    Ref<SDFNode> SDFInstances::optimize()
+    {
+        return SDFInstances::create(m_node->optimize(), m_transforms, m_lambda, m_intersect_method);
+    }
+
+    uint64_t SDFInstances::fingerprint() const
+    {
+        uint64_t h = hash({}, {m_node->fingerprint()});
+        for (const Transform &tf : m_transforms)
+            h = utils::hash(tf.m, h);
+        return h;
+    }
+
+    /*!
+    \brief Bounding box of a box mapped into the frame of an instance.
+    */
+    Box SDFInstances::local(int i, const Box &box) const
+    {
+        Interval x = Interval::axis(box, 0), y = Interval::axis(box, 1), z = Interval::axis(box, 2);
+        kernel::Transform{}(x, y, z, &m_inverses[12 * i]);
+        return Box(Vector(x.lo, y.lo, z.lo), Vector(x.hi, y.hi, z.hi));
+    }
+
+    const std::vector<Transform> &SDFInstances::transforms() const
+    {
+        return m_transforms;
+    }
+
+    /************************** SDF Tree ******************************/
+
+    SDFTree::SDFTree(const Ref<SDFNode> &root, float l, IntersectMethod im) : SDFNode(l, im), m_root(root)
+    {
+    }
+
+    Ref<SDFTree> SDFTree::create(const Ref<SDFNode> &root, float l, IntersectMethod im)
+    {
+        return create_ref<SDFTree>(root, l, im);
+    }
+
+    float SDFTree::value(const Point &p) const
+    {
+        if (!compiled())
+            return m_root->value(p);
+
+        s_value_call_count += m_program.weight();
+        return m_program.value(p);
+    }
+
+    void SDFTree::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        if (!compiled())
+        {
+            m_root->value_batch(xs, ys, zs, out);
+            return;
+        }
+
+        s_value_call_count += m_program.weight() * static_cast<int>(out.size());
+        m_program.value_batch(xs, ys, zs, out);
+    }
+
+    Dual SDFTree::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        if (!compiled())
+            return m_root->value_dual(x, y, z);
+
+        s_value_call_count += m_program.weight();
+        return m_program.value_dual(x, y, z);
+    }
+
+    /*!
+    \brief Optimize the current tree and lower it into a flat program used by SDFTree::value, identical
+    sub-trees being evaluated once per point.
+
+    Nothing is done if neither the root nor the fingerprint of the tree changed since the last call.
+    Once compiled, the evaluations of the tree compile it again on their own after a call to a node accessor
+    returning a parameter by reference, see SDFTree::compiled. Trees that were never compiled evaluate the nodes.
+    \sa SDFNode::optimize, SDFNode::fingerprint, SDFProgram::build
+    */
+    void SDFTree::compile() const
+    {
+        std::lock_guard<std::mutex> lock(m_compile_mutex);
+
+        // Edits made while compiling are caught by the next check
+        const uint64_t generation = s_generation.load(std::memory_order_relaxed);
+        const uint64_t fingerprint = m_root ? m_root->fingerprint() : 0;
+        if (m_program_root != m_root || m_fingerprint != fingerprint || m_program.empty())
+        {
+            m_program.clear();
+            m_program_root = m_root;
+            m_fingerprint = fingerprint;
+            m_optimized = m_root ? m_root->optimize() : nullptr;
+            if (m_optimized)
+                m_program.build(*m_optimized);
+        }
+        m_generation.store(generation, std::memory_order_release);
+    }
+
+    /*!
+    \brief Check whether the program can be evaluated, compiling the tree again if a node accessor was called since
+    the last compilation. Parameters must not be edited while the tree is evaluated by other threads.
+    \return false if the tree was never compiled, the nodes are then evaluated directly.
+    */
+    bool SDFTree::compiled() const
+    {
+        if (!m_program_root)
+            return false;
+        if (m_generation.load(std::memory_order_acquire) != s_generation.load(std::memory_order_relaxed))
+            compile();
+        return m_program_root == m_root && !m_program.empty();
+    }
+
+    /*!
+    \brief Create a tree evaluating to the same values inside a box, with the operands that do not
+    contribute to the field inside that box pruned away.
+    \sa SDFNode::prune
+    */
+    Ref<SDFTree> SDFTree::specialize(const Box &box) const
+    {
+        Interval range;
+        return SDFTree::create(m_root->prune(box, range), m_lambda, m_intersect_method);
+    }
+
+    Ref<SDFNode> SDFTree::left()
+    {
+        return m_root->left();
+    }
+
+    Ref<SDFNode> SDFTree::right()
+    {
+        return m_root->right();
+    }
+
+    /*!
+        \brief Compute the polygonal mesh approximating the implicit surface.
+
+        \sa SDFTree::polygonize_method(PolygonizeMethod), SDFTree::normal_method(NormalMethod)
+
+        \param box %Box defining the region that will be polygonized.
+        \param n Discretization parameter.
+        */
+    Ref<Mesh> SDFTree::polygonize(int n, const Box &box) const
+    {
+        compile();
+
+        switch (m_polygonize_method)
+        {
+        case PolygonizeMethod::OCTREE:
+            return polygonize_octree(n, box);
+        case PolygonizeMethod::CONTINUATION:
+            return polygonize_continuation(n, box, {});
+        case PolygonizeMethod::DUAL_CONTOURING:
+            return polygonize_dual(n, box);
+        default:
+            return polygonize_uniform(n, box);
+        }
+    }
+
+    /*!
+        \brief Polygonize the components of the surface reached from seed points, whatever the polygonization method.
+        \sa SDFTree::polygonize_continuation
+
+        \param box %Box defining the region that will be polygonized.
+        \param n Discretization parameter.
+        \param seeds Points on or close to the surface, such as the hits of SDFNode::trace.
+        */
+    Ref<Mesh> SDFTree::polygonize(int n, const Box &box, std::span<const Point> seeds) const
+    {
+        compile();
+        return polygonize_continuation(n, box, seeds);
+    }
+
+    /*!
+        \brief Marching cubes over every cell of the grid.
+
+        The z layers are split into slabs polygonized in parallel when more than one thread is set,
+        see SDFTree::thread_count(int). Vertices of the planes shared by two slabs are stitched while
+        merging, so that the mesh is the same whatever the thread count.
+
+        \param box %Box defining the region that will be polygonized.
+        \param n Discretization parameter.
+        */
+    Ref<Mesh> SDFTree::polygonize_uniform(int n, const Box &box) const
+    {
+        Ref<Mesh> mesh = create_ref<Mesh>(GL_TRIANGLES);
+
+        const int nz = n;
+        int slab_count = 1;
+        if (m_thread_count != 1)
+        {
+            int threads = m_thread_count > 0 ? m_thread_count : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+            if (!m_pool || m_pool->size() != threads)
+                m_pool = ThreadPool::create(threads);
+            slab_count = std::min(nz, 4 * threads);
+        }
+
+        std::vector<PolygonizeSlab> slabs(slab_count);
+        auto run_slab = [&](int s)
+        {
+            polygonize_slab(n, box, nz * s / slab_count, nz * (s + 1) / slab_count, slabs[s]);
+        };
+
+        if (slab_count == 1)
+        {
+            run_slab(0);
+        }
+        else
+        {
+            // Value calls and refinements are counted per thread, gather the workers ones
+            std::atomic<int> count{0}, refinements{0};
+            m_pool->parallel_for(slab_count, [&](int s)
+                                 {
+                                     int before = s_value_call_count, refined = s_refine_count;
+                                     run_slab(s);
+                                     count += s_value_call_count - before;
+                                     refinements += s_refine_count - refined;
+                                     s_value_call_count = before;
+                                     s_refine_count = refined; });
+            s_value_call_count += count;
+            s_refine_count += refinements;
+        }
+
+        // Merge slabs, the lower plane vertices of a slab are the upper plane ones of the previous slab
+        int top_first = 0;
+        for (int s = 0; s < slab_count; s++)
+        {
+            const PolygonizeSlab &slab = slabs[s];
+            const int shared = s == 0 ? 0 : slab.bottom;
+            const int base = mesh->vertex_count() - shared;
+            assert(s == 0 || slab.bottom == slabs[s - 1].top);
+
+            for (int i = shared; i < int(slab.vertices.size()); i++)
+            {
+                mesh->normal(slab.normals[i]);
+                mesh->vertex(slab.vertices[i]);
+            }
+
+            for (int t = 0; t < int(slab.triangles.size()); t += 3)
+            {
+                int id[3];
+                for (int c = 0; c < 3; c++)
+                {
+                    int v = slab.triangles[t + c];
+                    id[c] = v < shared ? top_first + v : base + v;
+                }
+                mesh->triangle(id[0], id[1], id[2]);
+            }
+
+            top_first = base + slab.top_first;
+        }
+
+        return mesh;
+    }
+
+    /*!
+        \brief Polygonize the layers [k0, k1) of the grid.
+
+        \param n Discretization parameter.
+        \param box %Box defining the region that will be polygonized.
+        \param k0, k1 Range of layers.
+        \param slab Returned vertices and triangles, indexed locally.
+        */
+    void SDFTree::polygonize_slab(int n, const Box &box, int k0, int k1, PolygonizeSlab &slab) const
+    {
+        int nv = 0;
+        const int nx = n;
+        const int ny = n;
+
+        Box clipped = box;
+
+        // Clamped integer values
+        const int nax = 0;
+        const int nbx = nx;
+        const int nay = 0;
+        const int nby = ny;
+        const int naz = k0;
+        const int nbz = k1;
+
+        const int size = nx * ny;
+
+        // Intensities
+        float *a = new float[size];
+        float *b = new float[size];
+
+        // vertex
+        Vector *u = new Vector[size];
+        Vector *v = new Vector[size];
+
+        // Slices below a and above b, for lattice normals
+        const bool lattice = m_normal_method == NormalMethod::LATTICE;
+        float *below = lattice ? new float[size] : nullptr;
+        float *ahead = lattice ? new float[size] : nullptr;
+        Vector *w = lattice ? new Vector[size] : nullptr;
+
+        // Edges
+        int *eax = new int[size];
+        int *eay = new int[size];
+        int *ebx = new int[size];
+        int *eby = new int[size];
+        int *ez = new int[size];
+
+        // diagonal of a cell
+        Vector d = clipped.diagonal() / (n - 1);
+
+        float za = naz * d(2);
+
+        // Coordinates of an Oxy slice, evaluated as a single batch
+        std::vector<float> xs(size), ys(size), zs(size);
+        auto sample = [&](Vector *p, float *f, float z)
+        {
+            for (int i = nax; i < nbx; i++)
+            {
+                for (int j = nay; j < nby; j++)
+                {
+                    Vector q = clipped[0] + Vector(i * d(0), j * d(1), z);
+                    if (p)
+                        p[i * ny + j] = q;
+                    xs[i * ny + j] = q.x;
+                    ys[i * ny + j] = q.y;
+                    zs[i * ny + j] = q.z;
+                }
+            }
+            value_batch(xs, ys, zs, {f, static_cast<size_t>(size)});
+        };
+
+        // Gradient at lattice vertex (i, j) of slice f[1], from central differences with its neighbors
+        // in the slice and in the slices f[0] below and f[2] above, one sided on the borders of the slice
+        auto lattice_gradient = [&](float *const *f, int i, int j)
+        {
+            const int i0 = std::max(i - 1, 0), i1 = std::min(i + 1, nx - 1);
+            const int j0 = std::max(j - 1, 0), j1 = std::min(j + 1, ny - 1);
+            return Vector((f[1][i1 * ny + j] - f[1][i0 * ny + j]) / ((i1 - i0) * d(0)),
+                          (f[1][i * ny + j1] - f[1][i * ny + j0]) / ((j1 - j0) * d(1)),
+                          (f[2][i * ny + j] - f[0][i * ny + j]) / (2 * d(2)));
+        };
+
+        // Store a vertex of the edge starting at lattice vertex (i, j) of slice f[1] along an axis,
+        // with a normal interpolated between the lattice gradients at the ends of the edge
+        auto push_vertex = [&](const Vector &vertex, const Vector &origin, int axis, int i, int j, float *const *f)
+        {
+            slab.vertices.push_back(vertex);
+            if (!lattice)
+            {
+                slab.normals.push_back(normal(vertex));
+                return;
+            }
+
+            float t = std::clamp((vertex(axis) - origin(axis)) / d(axis), 0.f, 1.f);
+            Vector g = (1 - t) * lattice_gradient(f, i, j) + t * lattice_gradient(axis == 2 ? f + 1 : f, axis == 0 ? i + 1 : i, axis == 1 ? j + 1 : j);
+            slab.normals.push_back(length2(g) > 0 ? normalize(g) : normal(vertex));
+        };
+
+        // Sign bits of the slices, one bit per lattice vertex, rows padded with a word so that j + 1 can be read past the end
+        const int words = (ny + 63) / 64 + 1;
+        std::vector<uint64_t> sa(nx * words), sb(nx * words);
+        auto pack = [&](const float *f, uint64_t *s)
+        {
+            std::fill_n(s, nx * words, 0);
+            for (int i = nax; i < nbx; i++)
+            {
+                const float *row = f + i * ny;
+                uint64_t *bits = s + i * words;
+                int j = 0;
+                for (; j + simd::width <= ny; j += simd::width)
+                    bits[j >> 6] |= uint64_t(simd::negative(simd::load(row + j))) << (j & 63);
+                for (; j < ny; j++)
+                    bits[j >> 6] |= uint64_t(simd::negative(row[j])) << (j & 63);
+            }
+        };
+
+        // Straddling edges of a slice, collected then refined together by SDFTree::refine_batch
+        std::vector<RefineEdge> edges;
+        std::vector<std::pair<int, int>> origins; // Lattice vertex and axis of the edges
+        std::vector<Vector> vertices;
+
+        // Collect the edges along an axis between lattice vertices of slices p, f and q, g
+        auto collect = [&](const Vector *p, const float *f, const Vector *q, const float *g, int axis)
+        {
+            const int offset = axis == 0 ? ny : (axis == 1 ? 1 : 0);
+            for (int i = nax; i < nbx - (axis == 0 ? 1 : 0); i++)
+            {
+                for (int j = nay; j < nby - (axis == 1 ? 1 : 0); j++)
+                {
+                    const int c = i * ny + j;
+                    // We need a xor b, which can be implemented a == !b
+                    if (!((f[c] < 0.0) == !(g[c + offset] >= 0.0)))
+                    {
+                        edges.push_back({p[c], q[c + offset], f[c], g[c + offset], d(axis)});
+                        origins.push_back({c, axis});
+                    }
+                }
+            }
+        };
+
+        // Refine the collected edges and store their vertices, in the order they were collected
+        auto flush = [&](float *const *f, float *const *fz, int *const *index)
+        {
+            vertices.resize(edges.size());
+            refine_batch(edges, vertices);
+            for (size_t e = 0; e < edges.size(); e++)
+            {
+                const auto [c, axis] = origins[e];
+                push_vertex(vertices[e], edges[e].a, axis, c / ny, c % ny, axis == 2 ? fz : f);
+                index[axis][c] = nv;
+                nv++;
+            }
+            edges.clear();
+            origins.clear();
+        };
+
+        // Compute field inside lower Oxy plane, and in the neighboring ones for lattice normals
+        sample(u, a, za);
+        if (lattice)
+        {
+            sample(nullptr, below, (naz - 1) * d(2));
+            sample(v, b, (naz + 1) * d(2));
+        }
+        float *layers[] = {below, a, b, ahead};
+        int *bottom[] = {eax, eay, nullptr};
+
+        // Compute straddling edges inside lower Oxy plane
+        collect(u, a, u, a, 0);
+        collect(u, a, u, a, 1);
+        flush(layers, layers, bottom);
+        pack(a, sa.data());
+
+        slab.bottom = nv;
+
+        // Array for s_edge vertices
+        int e[12];
+
+        // For all layers
+        for (int k = naz; k < nbz; k++)
+        {
+            // Layer heights are computed from their index, so that slabs sharing a plane sample it identically
+            float zb = (k + 1) * d(2);
+            if (lattice)
+                sample(w, ahead, (k + 2) * d(2));
+            else
+                sample(v, b, zb);
+            layers[3] = ahead;
+
+            slab.top_first = nv;
+
+            // Compute straddling edges inside upper Oxy plane, then vertical ones, refined together
+            collect(v, b, v, b, 0);
+            collect(v, b, v, b, 1);
+            slab.top = static_cast<int>(edges.size());
+            collect(u, a, v, b, 2);
+            int *top[] = {ebx, eby, ez};
+            flush(layers + 1, layers, top);
+
+            // Create mesh, classifying the cells of a row 64 at a time from the sign bits of the slices
+            pack(b, sb.data());
+            for (int i = nax; i < nbx - 1; i++)
+            {
+                const uint64_t *rows[4] = {&sa[i * words], &sa[(i + 1) * words], &sb[i * words], &sb[(i + 1) * words]};
+                for (int w = 0; w < words - 1; w++)
+                {
+                    // Bit t of corner c is the sign of the corner c of cell j = 64 w + t, see s_cell_edge
+                    uint64_t corner[8];
+                    for (int r = 0; r < 4; r++)
+                    {
+                        const int c = (r & 1) + 4 * (r >> 1);
+                        corner[c] = rows[r][w];
+                        corner[c + 2] = (rows[r][w] >> 1) | (rows[r][w + 1] << 63);
+                    }
+
+                    uint64_t inside = ~uint64_t(0), outside = ~uint64_t(0);
+                    for (int c = 0; c < 8; c++)
+                    {
+                        inside &= corner[c];
+                        outside &= ~corner[c];
+                    }
+
+                    // Cubes straddling the surface, among the cells j < ny - 1
+                    const int last = ny - 1 - 64 * w;
+                    uint64_t straddling = ~(inside | outside) & (last >= 64 ? ~uint64_t(0) : (uint64_t(1) << last) - 1);
+                    while (straddling)
+                    {
+                        const int t = std::countr_zero(straddling);
+                        straddling &= straddling - 1;
+
+                        int cubeindex = 0;
+                        for (int c = 0; c < 8; c++)
+                            cubeindex |= static_cast<int>((corner[c] >> t) & 1) << c;
+
+                        const int j = 64 * w + t;
+                        e[0] = eax[i * ny + j];
+                        e[1] = eax[i * ny + (j + 1)];
+                        e[2] = ebx[i * ny + j];
+                        e[3] = ebx[i * ny + (j + 1)];
+                        e[4] = eay[i * ny + j];
+                        e[5] = eay[(i + 1) * ny + j];
+                        e[6] = eby[i * ny + j];
+                        e[7] = eby[(i + 1) * ny + j];
+                        e[8] = ez[i * ny + j];
+                        e[9] = ez[(i + 1) * ny + j];
+                        e[10] = ez[i * ny + (j + 1)];
+                        e[11] = ez[(i + 1) * ny + (j + 1)];
+
+                        const uint8_t *triangles = s_triangle_table[cubeindex];
+                        for (int h = 0; h < 3 * s_triangle_count[cubeindex]; h++)
+                            slab.triangles.push_back(e[triangles[h]]);
+                    }
+                }
+            }
+
+            std::swap(a, b);
+            std::swap(sa, sb);
+
+            za = zb;
+            std::swap(eax, ebx);
+            std::swap(eay, eby);
+            std::swap(u, v);
+
+            // Shift the slices down, the look-ahead slice becomes the upper one
+            if (lattice)
+            {
+                std::swap(below, b);
+                std::swap(b, ahead);
+                std::swap(v, w);
+            }
+            layers[0] = below;
+            layers[1] = a;
+            layers[2] = b;
+        }
+
+        delete[] a;
+        delete[] b;
+        delete[] u;
+        delete[] v;
+        delete[] below;
+        delete[] ahead;
+        delete[] w;
+
+        delete[] eax;
+        delete[] eay;
+        delete[] ebx;
+        delete[] eby;
+        delete[] ez;
+    }
+
+    /*!
+        \brief Marching cubes restricted to the cells an octree could not prove empty.
+
+        The grid cells are grouped into a power of two octree, subdivided with Box::sub. Down to bricks
+        of SDFTree::s_brick_size cells, the tree is specialized for every node with SDFNode::prune, and
+        nodes whose range of values excludes 0 are discarded. Inside a brick, the specialized tree
+        is compiled and a node whose center value satisfies |f(c)| > L r, where L is the Lipschitz
+        constant of the field and r the radius of the node box, is discarded with all its cells.
+        The work is thus proportional to the area of the surface rather than to the volume of the box,
+        and every cell only evaluates the primitives that contribute to the field around it.
+
+        Surviving cells are polygonized with the same lattice, tables and edge refinement as
+        SDFTree::polygonize_uniform, so both methods produce the same triangles.
+
+        \param box %Box defining the region that will be polygonized.
+        \param n Discretization parameter.
+        */
+    Ref<Mesh> SDFTree::polygonize_octree(int n, const Box &box) const
+    {
+        Ref<Mesh> mesh = create_ref<Mesh>(GL_TRIANGLES);
+
+        // Cells of the uniform grid, which samples one layer above the box
+        const int cx = n - 1;
+        const int cy = n - 1;
+        const int cz = n;
+        if (!m_root || cx <= 0 || cy <= 0)
+            return mesh;
+
+        const Vector d = box.diagonal() / (n - 1);
+
+        int size = 1;
+        while (size < std::max(cx, std::max(cy, cz)))
+            size *= 2;
+
+        struct Brick
+        {
+            OctreeCell cell;
+            Ref<SDFNode> node; //!< Tree specialized for the cell.
+        };
+
+        const Box root(box[0], box[0] + Vector(size * d(0), size * d(1), size * d(2)));
+        std::vector<Brick> level{{{root, 0, 0, 0, size}, m_optimized}};
+        std::vector<Brick> bricks;
+        while (!level.empty())
+        {
+            std::vector<Brick> next;
+            for (const Brick &brick : level)
+            {
+                const OctreeCell &cell = brick.cell;
+
+                Interval range;
+                Ref<SDFNode> node = brick.node->prune(cell.box, range);
+                if (range.lo > 0.f || range.hi < 0.f)
+                    continue;
+
+                if (cell.size <= s_brick_size)
+                {
+                    bricks.push_back({cell, node});
+                    continue;
+                }
+
+                const int h = cell.size / 2;
+                for (int o = 0; o < 8; o++)
+                {
+                    OctreeCell child{cell.box.sub(o), cell.i + ((o & 1) ? h : 0), cell.j + ((o & 2) ? h : 0), cell.k + ((o & 4) ? h : 0), h};
+                    if (child.i < cx && child.j < cy && child.k < cz)
+                        next.push_back({child, node});
+                }
+            }
+            level.swap(next);
+        }
+
+        // Edge vertices, keyed by lower lattice vertex and axis, shared between bricks
+        std::unordered_map<uint64_t, int> edges;
+        for (const Brick &brick : bricks)
+        {
+            SDFTree tree(brick.node, m_lambda, m_intersect_method);
+            tree.m_normal_method = m_normal_method;
+            tree.m_refine_method = m_refine_method;
+            tree.m_refine_tolerance = m_refine_tolerance;
+            tree.compile();
+            tree.polygonize_brick(n, box, brick.cell, *mesh, edges);
+        }
+
+        return mesh;
+    }
+
+    /*!
+        \brief Marching cubes following the surface from seed cells.
+
+        Cells are flooded breadth first from the cells around every seed, through the faces whose corners
+        differ in sign, the only ones crossed by the triangles of a cell. The missing corners of a wave of cells
+        are evaluated as a single batch, so that the work is proportional to the number of cells crossed by
+        the surface rather than to the volume of the box. Components without seeds are missed, see
+        SDFTree::seed_resolution for the coarse scan seeding all of them.
+        Cells are polygonized with the same lattice, tables and edge refinement as SDFTree::polygonize_uniform,
+        so that the triangles of the components reached are the same.
+
+        \param box %Box defining the region that will be polygonized.
+        \param n Discretization parameter.
+        \param seeds Points on or close to the surface.
+        */
+    Ref<Mesh> SDFTree::polygonize_continuation(int n, const Box &box, std::span<const Point> seeds) const
+    {
+        Ref<Mesh> mesh = create_ref<Mesh>(GL_TRIANGLES);
+
+        // Cells of the uniform grid, which samples one layer above the box
+        const int cx = n - 1;
+        const int cy = n - 1;
+        const int cz = n;
+        if (!m_root || cx <= 0 || cy <= 0)
+            return mesh;
+
+        const Vector d = box.diagonal() / (n - 1);
+
+        std::vector<Point> points(seeds.begin(), seeds.end());
+        if (m_seed_resolution > 0)
+            seed(box, points);
+
+        // Cells and lattice vertices share their identifiers, a cell is keyed by its lower vertex
+        auto lattice_id = [&](int i, int j, int k)
+        {
+            return (uint64_t(k) * n + i) * n + j;
+        };
+
+        std::unordered_map<uint64_t, float> values;
+        std::unordered_set<uint64_t> visited;
+        std::unordered_map<uint64_t, int> edges;
+        std::vector<std::array<int, 3>> wave, next;
+        std::vector<uint64_t> pending;
+        std::vector<float> xs, ys, zs, f;
+
+        auto visit = [&](int i, int j, int k, std::vector<std::array<int, 3>> &cells)
+        {
+            if (i >= 0 && j >= 0 && k >= 0 && i < cx && j < cy && k < cz && visited.insert(lattice_id(i, j, k)).second)
+                cells.push_back({i, j, k});
+        };
+
+        for (const Point &p : points)
+        {
+            const int si = static_cast<int>(std::floor((p.x - box[0].x) / d(0)));
+            const int sj = static_cast<int>(std::floor((p.y - box[0].y) / d(1)));
+            const int sk = static_cast<int>(std::floor((p.z - box[0].z) / d(2)));
+            if (si < 0 || sj < 0 || sk < 0 || si >= cx || sj >= cy || sk >= cz || visited.count(lattice_id(si, sj, sk)))
+                continue;
+
+            // Seeds are not exactly on the surface, start from their neighbor cells too
+            wave.clear();
+            for (int c = 0; c < 27; c++)
+                visit(si + c % 3 - 1, sj + (c / 3) % 3 - 1, sk + c / 9 - 1, wave);
+
+            while (!wave.empty())
+            {
+                pending.clear();
+                for (const std::array<int, 3> &cell : wave)
+                    for (int c = 0; c < 8; c++)
+                    {
+                        const uint64_t id = lattice_id(cell[0] + (c & 1), cell[1] + ((c & 2) >> 1), cell[2] + ((c & 4) >> 2));
+                        if (values.try_emplace(id, 0.f).second)
+                            pending.push_back(id);
+                    }
+
+                const int count = int(pending.size());
+                xs.resize(count);
+                ys.resize(count);
+                zs.resize(count);
+                f.resize(count);
+                for (int c = 0; c < count; c++)
+                {
+                    const int j = int(pending[c] % n);
+                    const int i = int((pending[c] / n) % n);
+                    const int k = int(pending[c] / (uint64_t(n) * n));
+                    xs[c] = box[0].x + i * d(0);
+                    ys[c] = box[0].y + j * d(1);
+                    zs[c] = box[0].z + k * d(2);
+                }
+                value_batch(xs, ys, zs, f);
+                for (int c = 0; c < count; c++)
+                    values[pending[c]] = f[c];
+
+                next.clear();
+                float a[8];
+                for (const std::array<int, 3> &cell : wave)
+                {
+                    for (int c = 0; c < 8; c++)
+                        a[c] = values[lattice_id(cell[0] + (c & 1), cell[1] + ((c & 2) >> 1), cell[2] + ((c & 4) >> 2))];
+                    polygonize_cell(n, box, cell[0], cell[1], cell[2], a, *mesh, edges);
+
+                    // Follow the surface through the faces it crosses
+                    for (int face = 0; face < 6; face++)
+                    {
+                        const int axis = face / 2, side = face % 2;
+                        int inside = 0;
+                        for (int c = 0; c < 8; c++)
+                            if (((c >> axis) & 1) == side && a[c] < 0.0)
+                                inside++;
+                        if (inside == 0 || inside == 4)
+                            continue;
+
+                        std::array<int, 3> neighbor = cell;
+                        neighbor[axis] += side ? 1 : -1;
+                        visit(neighbor[0], neighbor[1], neighbor[2], next);
+                    }
+                }
+                wave.swap(next);
+            }
+        }
+
+        return mesh;
+    }
+
+    /*!
+        \brief Seed every component of the surface with a coarse scan, see SDFTree::seed_resolution.
+
+        The centers of the coarse cells are evaluated as a single batch. Those closer to the surface
+        than the radius of their cell, up to the Lipschitz constant, are projected on the surface by a few Newton steps.
+        \param box %Box defining the region that will be polygonized.
+        \param seeds Seeds, the projected points are appended.
+        */
+    void SDFTree::seed(const Box &box, std::vector<Point> &seeds) const
+    {
+        const int m = m_seed_resolution;
+        const Vector d = box.diagonal() / m;
+        const float radius = 0.5f * length(d) * lipschitz();
+
+        const int count = m * m * m;
+        std::vector<float> xs(count), ys(count), zs(count), f(count);
+        for (int c = 0; c < count; c++)
+        {
+            xs[c] = box[0].x + (c % m + 0.5f) * d(0);
+            ys[c] = box[0].y + ((c / m) % m + 0.5f) * d(1);
+            zs[c] = box[0].z + (c / (m * m) + 0.5f) * d(2);
+        }
+        value_batch(xs, ys, zs, f);
+
+        for (int c = 0; c < count; c++)
+        {
+            if (std::abs(f[c]) > radius)
+                continue;
+
+            Point p(xs[c], ys[c], zs[c]);
+            for (int step = 0; step < 4; step++)
+            {
+                const Dual g = value_gradient(p);
+                if (length2(g.d) == 0.f)
+                    break;
+                p = p - g.d * (g.v / length2(g.d));
+            }
+            seeds.push_back(p);
+        }
+    }
+
+    //! Quadratic error function of a dual contouring cell, sum of the squared distances to the tangent planes of its edge intersections.
+    struct Qef
+    {
+        float ata[6]{0.f, 0.f, 0.f, 0.f, 0.f, 0.f}; //!< Upper triangle of the symmetric matrix, xx, xy, xz, yy, yz, zz.
+        Vector atb{0, 0, 0};
+        Vector mass{0, 0, 0}; //!< Sum of the intersections.
+        Vector normal{0, 0, 0}; //!< Sum of the normals.
+        int count{0};
+
+        void add(const Vector &p, const Vector &n)
+        {
+            ata[0] += n.x * n.x;
+            ata[1] += n.x * n.y;
+            ata[2] += n.x * n.z;
+            ata[3] += n.y * n.y;
+            ata[4] += n.y * n.z;
+            ata[5] += n.z * n.z;
+            atb = atb + n * dot(n, p);
+            mass = mass + p;
+            normal = normal + n;
+            count++;
+        }
+
+        /*!
+        \brief Minimize the error with the pseudo inverse of the matrix, from the mass point.
+
+        Eigenvalues below a fraction of the largest one are discarded, so that flat and edge cells
+        slide their vertex along the surface and feature to the mass point instead of diverging.
+        */
+        Vector solve(float threshold) const
+        {
+            const Vector c = mass / static_cast<float>(count);
+            float a[3][3] = {{ata[0], ata[1], ata[2]}, {ata[1], ata[3], ata[4]}, {ata[2], ata[4], ata[5]}};
+            float v[3][3] = {{1.f, 0.f, 0.f}, {0.f, 1.f, 0.f}, {0.f, 0.f, 1.f}};
+
+            // Cyclic Jacobi rotations diagonalize the matrix, v gathers the eigenvectors in columns
+            for (int sweep = 0; sweep < 8; sweep++)
+            {
+                const float off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+                if (off < 1e-12f)
+                    break;
+                for (int p = 0; p < 2; p++)
+                    for (int q = p + 1; q < 3; q++)
+                    {
+                        if (std::abs(a[p][q]) < 1e-12f)
+                            continue;
+                        const float theta = (a[q][q] - a[p][p]) / (2.f * a[p][q]);
+                        const float t = (theta >= 0.f ? 1.f : -1.f) / (std::abs(theta) + std::sqrt(theta * theta + 1.f));
+                        const float cs = 1.f / std::sqrt(t * t + 1.f), sn = t * cs;
+                        for (int k = 0; k < 3; k++)
+                        {
+                            const float akp = a[k][p], akq = a[k][q];
+                            a[k][p] = cs * akp - sn * akq;
+                            a[k][q] = sn * akp + cs * akq;
+                        }
+                        for (int k = 0; k < 3; k++)
+                        {
+                            const float apk = a[p][k], aqk = a[q][k];
+                            a[p][k] = cs * apk - sn * aqk;
+                            a[q][k] = sn * apk + cs * aqk;
+                        }
+                        for (int k = 0; k < 3; k++)
+                        {
+                            const float vkp = v[k][p], vkq = v[k][q];
+                            v[k][p] = cs * vkp - sn * vkq;
+                            v[k][q] = sn * vkp + cs * vkq;
+                        }
+                    }
+            }
+
+            // x = c + V D+ V^T (A^T b - A^T A c)
+            const float largest = std::max({a[0][0], a[1][1], a[2][2]});
+            const Vector r = atb - Vector(ata[0] * c.x + ata[1] * c.y + ata[2] * c.z,
+                                          ata[1] * c.x + ata[3] * c.y + ata[4] * c.z,
+                                          ata[2] * c.x + ata[4] * c.y + ata[5] * c.z);
+            Vector x = c;
+            for (int e = 0; e < 3; e++)
+            {
+                if (a[e][e] <= threshold * largest)
+                    continue;
+                const Vector axis(v[0][e], v[1][e], v[2][e]);
+                x = x + axis * (dot(axis, r) / a[e][e]);
+            }
+            return x;
+        }
+    };
+
+    /*!
+        \brief Dual contouring, one vertex per cell crossed by the surface and one quad per straddling edge.
+
+        Edge intersections are refined as in SDFTree::polygonize_uniform and their normals given by the gradient.
+        The vertex of a cell minimizes the squared distances to the tangent planes of its intersections,
+        see Qef::solve, so that it lands on the sharp edges and corners of CSG shapes instead of cutting them,
+        and is clamped to its cell. The quad of a straddling edge joins the vertices of the four cells around it,
+        edges on the border of the grid are left open.
+
+        \param box %Box defining the region that will be polygonized.
+        \param n Discretization parameter.
+        */
+    Ref<Mesh> SDFTree::polygonize_dual(int n, const Box &box) const
+    {
+        Ref<Mesh> mesh = create_ref<Mesh>(GL_TRIANGLES);
+
+        // Same lattice as the marching cubes, which samples one layer above the box
+        const int nx = n;
+        const int ny = n;
+        const int nz = n + 1;
+        const int cx = nx - 1;
+        const int cy = ny - 1;
+        const int cz = nz - 1;
+        if (!m_root || cx <= 0 || cy <= 0)
+            return mesh;
+
+        const Vector d = box.diagonal() / (n - 1);
+        auto lattice = [&](int i, int j, int k)
+        {
+            return box[0] + Vector(i * d(0), j * d(1), k * d(2));
+        };
+        auto lattice_id = [&](int i, int j, int k)
+        {
+            return (size_t(k) * nx + i) * ny + j;
+        };
+        auto cell_id = [&](int i, int j, int k)
+        {
+            return (size_t(k) * cx + i) * cy + j;
+        };
+
+        // Field at every lattice vertex, one Oxy slice per batch
+        std::vector<float> f(size_t(nx) * ny * nz);
+        std::vector<float> xs(nx * ny), ys(nx * ny), zs(nx * ny);
+        for (int k = 0; k < nz; k++)
+        {
+            for (int i = 0; i < nx; i++)
+                for (int j = 0; j < ny; j++)
+                {
+                    const Vector q = lattice(i, j, k);
+                    xs[i * ny + j] = q.x;
+                    ys[i * ny + j] = q.y;
+                    zs[i * ny + j] = q.z;
+                }
+            value_batch(xs, ys, zs, {f.data() + lattice_id(0, 0, k), size_t(nx) * ny});
+        }
+
+        // Gather the intersections of the straddling edges in the cells around them
+        std::vector<int> cells(size_t(cx) * cy * cz, -1);
+        std::vector<Qef> qefs;
+        std::vector<std::array<int, 5>> quads; //!< Lower vertex and axis of the straddling edges, and the sign of their lower vertex.
+        for (int k = 0; k < nz; k++)
+            for (int i = 0; i < nx; i++)
+                for (int j = 0; j < ny; j++)
+                {
+                    const float fa = f[lattice_id(i, j, k)];
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        const int di = axis == 0, dj = axis == 1, dk = axis == 2;
+                        if (i + di >= nx || j + dj >= ny || k + dk >= nz)
+                            continue;
+                        const float fb = f[lattice_id(i + di, j + dj, k + dk)];
+                        if ((fa < 0.0) == (fb < 0.0))
+                            continue;
+
+                        const Vector p = refine(lattice(i, j, k), lattice(i + di, j + dj, k + dk), fa, fb, d(axis));
+                        const Vector g = normal(p);
+
+                        // Cells sharing the edge are offset by -1 or 0 along the two other axes
+                        bool inner = true;
+                        for (int c = 0; c < 4; c++)
+                        {
+                            int id[3] = {i, j, k};
+                            id[(axis + 1) % 3] -= (c == 0 || c == 3) ? 1 : 0;
+                            id[(axis + 2) % 3] -= (c < 2) ? 1 : 0;
+                            if (id[0] < 0 || id[1] < 0 || id[2] < 0 || id[0] >= cx || id[1] >= cy || id[2] >= cz)
+                            {
+                                inner = false;
+                                continue;
+                            }
+
+                            int &cell = cells[cell_id(id[0], id[1], id[2])];
+                            if (cell < 0)
+                            {
+                                cell = int(qefs.size());
+                                qefs.emplace_back();
+                            }
+                            qefs[cell].add(p, g);
+                        }
+                        if (inner)
+                            quads.push_back({i, j, k, axis, fa < 0.0 ? 1 : 0});
+                    }
+                }
+
+        // One vertex per cell, clamped to its cell
+        std::vector<Vector> vertices(qefs.size());
+        for (int k = 0; k < cz; k++)
+            for (int i = 0; i < cx; i++)
+                for (int j = 0; j < cy; j++)
+                {
+                    const int cell = cells[cell_id(i, j, k)];
+                    if (cell < 0)
+                        continue;
+
+                    const Vector a = lattice(i, j, k), b = lattice(i + 1, j + 1, k + 1);
+                    Vector v = qefs[cell].solve(s_qef_threshold);
+                    for (int c = 0; c < 3; c++)
+                        v(c) = std::clamp(v(c), a(c), b(c));
+                    vertices[cell] = v;
+                }
+
+        for (size_t c = 0; c < qefs.size(); c++)
+        {
+            const Vector g = qefs[c].normal;
+            mesh->normal(m_normal_method == NormalMethod::LATTICE && length2(g) > 0 ? normalize(g) : normal(vertices[c]));
+            mesh->vertex(vertices[c]);
+        }
+
+        // Quads turn clockwise seen from the outside, as the marching cubes triangles
+        for (const std::array<int, 5> &quad : quads)
+        {
+            const int axis = quad[3];
+            int v[4];
+            for (int c = 0; c < 4; c++)
+            {
+                int id[3] = {quad[0], quad[1], quad[2]};
+                id[(axis + 1) % 3] -= (c == 0 || c == 3) ? 1 : 0;
+                id[(axis + 2) % 3] -= (c < 2) ? 1 : 0;
+                v[c] = cells[cell_id(id[0], id[1], id[2])];
+            }
+            if (quad[4])
+                std::swap(v[1], v[3]);
+
+            // Split along the shortest diagonal
+            if (length2(vertices[v[0]] - vertices[v[2]]) <= length2(vertices[v[1]] - vertices[v[3]]))
+            {
+                mesh->triangle(v[0], v[1], v[2]);
+                mesh->triangle(v[0], v[2], v[3]);
+            }
+            else
+            {
+                mesh->triangle(v[0], v[1], v[3]);
+                mesh->triangle(v[1], v[2], v[3]);
+            }
+        }
 
-    Ref<SDFNode> SDFTree::right()
-    {
-        return m_root->right();
+        return mesh;
     }
 
     /*!
-        \brief Compute the polygonal mesh approximating the implicit surface.
+        \brief Polygonize the cells of an octree node, see SDFTree::polygonize_octree.
 
-        \param box %Box defining the region that will be polygonized.
         \param n Discretization parameter.
-        \param g Returned geometry.
-        \param s_epsilon Epsilon value for computing vertices on straddling edges.
+        \param box %Box defining the region that will be polygonized.
+        \param brick Octree node.
+        \param mesh Mesh receiving the vertices and triangles.
+        \param edges Vertex index of the edges already refined.
         */
-    Ref<Mesh> SDFTree::polygonize(int n, const Box &box) const
+    void SDFTree::polygonize_brick(int n, const Box &box, const OctreeCell &brick, Mesh &mesh, std::unordered_map<uint64_t, int> &edges) const
     {
-        Ref<Mesh> mesh = create_ref<Mesh>(GL_TRIANGLES);
-
-        int nv = 0;
         const int nx = n;
         const int ny = n;
         const int nz = n;
 
-        Box clipped = box;
+        const int cx = nx - 1;
+        const int cy = ny - 1;
+        const int cz = nz;
 
-        // Clamped integer values
-        const int nax = 0;
-        const int nbx = nx;
-        const int nay = 0;
-        const int nby = ny;
-        const int naz = 0;
-        const int nbz = nz;
+        const Vector d = box.diagonal() / (n - 1);
+        const float lambda = lipschitz();
 
-        const int size = nx * ny;
+        auto lattice = [&](int i, int j, int k)
+        {
+            return box[0] + Vector(i * d(0), j * d(1), k * d(2));
+        };
+        auto lattice_id = [&](int i, int j, int k)
+        {
+            return (uint64_t(k) * nx + i) * ny + j;
+        };
 
-        // Intensities
-        float *a = new float[size];
-        float *b = new float[size];
+        std::vector<OctreeCell> level{brick};
+        std::vector<OctreeCell> leaves;
+        std::vector<float> xs, ys, zs, f;
 
-        // vertex
-        Vector *u = new Vector[size];
-        Vector *v = new Vector[size];
+        // Breadth first traversal, the centers of a level are evaluated as a single batch
+        while (!level.empty())
+        {
+            const int count = int(level.size());
+            xs.resize(count);
+            ys.resize(count);
+            zs.resize(count);
+            f.resize(count);
+            for (int c = 0; c < count; c++)
+            {
+                Vector center = level[c].box.center();
+                xs[c] = center(0);
+                ys[c] = center(1);
+                zs[c] = center(2);
+            }
+            value_batch(xs, ys, zs, f);
 
-        // Edges
-        int *eax = new int[size];
-        int *eay = new int[size];
-        int *ebx = new int[size];
-        int *eby = new int[size];
-        int *ez = new int[size];
+            std::vector<OctreeCell> next;
+            for (int c = 0; c < count; c++)
+            {
+                const OctreeCell &cell = level[c];
 
-        // diagonal of a cell
-        Vector d = clipped.diagonal() / (n - 1);
+                // Small slack so that rounding in Box::sub never discards a straddling cell
+                if (std::abs(f[c]) > lambda * cell.box.radius() * 1.001f)
+                    continue;
+
+                if (cell.size == 1)
+                {
+                    leaves.push_back(cell);
+                    continue;
+                }
+
+                const int h = cell.size / 2;
+                for (int o = 0; o < 8; o++)
+                {
+                    OctreeCell child{cell.box.sub(o), cell.i + ((o & 1) ? h : 0), cell.j + ((o & 2) ? h : 0), cell.k + ((o & 4) ? h : 0), h};
+                    if (child.i < cx && child.j < cy && child.k < cz)
+                        next.push_back(child);
+                }
+            }
+            level.swap(next);
+        }
+
+        // Evaluate the corners of the leaves, shared corners once
+        std::vector<uint64_t> corners;
+        corners.reserve(leaves.size() * 8);
+        for (const OctreeCell &cell : leaves)
+            for (int c = 0; c < 8; c++)
+                corners.push_back(lattice_id(cell.i + (c & 1), cell.j + ((c & 2) >> 1), cell.k + ((c & 4) >> 2)));
+        std::sort(corners.begin(), corners.end());
+        corners.erase(std::unique(corners.begin(), corners.end()), corners.end());
+
+        const int count = int(corners.size());
+        xs.resize(count);
+        ys.resize(count);
+        zs.resize(count);
+        f.resize(count);
+        for (int c = 0; c < count; c++)
+        {
+            const int j = int(corners[c] % ny);
+            const int i = int((corners[c] / ny) % nx);
+            const int k = int(corners[c] / (uint64_t(nx) * ny));
+            Vector p = lattice(i, j, k);
+            xs[c] = p(0);
+            ys[c] = p(1);
+            zs[c] = p(2);
+        }
+        value_batch(xs, ys, zs, f);
+
+        auto corner_value = [&](uint64_t id)
+        {
+            return f[std::lower_bound(corners.begin(), corners.end(), id) - corners.begin()];
+        };
+
+        float a[8];
+        for (const OctreeCell &cell : leaves)
+        {
+            for (int c = 0; c < 8; c++)
+                a[c] = corner_value(lattice_id(cell.i + (c & 1), cell.j + ((c & 2) >> 1), cell.k + ((c & 4) >> 2)));
+            polygonize_cell(n, box, cell.i, cell.j, cell.k, a, mesh, edges);
+        }
+    }
+
+    /*!
+        \brief Triangulate a cell of the lattice, shared by the sparse polygonizations.
+
+        \param n Discretization parameter.
+        \param box %Box defining the region that will be polygonized.
+        \param i, j, k Lower lattice vertex of the cell.
+        \param a Field values at the corners of the cell, corner c at (i + (c & 1), j + ((c & 2) >> 1), k + ((c & 4) >> 2)).
+        \param mesh Mesh receiving the vertices and triangles.
+        \param edges Vertex index of the edges already refined, keyed by lower lattice vertex and axis.
+        */
+    void SDFTree::polygonize_cell(int n, const Box &box, int i, int j, int k, const float a[8], Mesh &mesh, std::unordered_map<uint64_t, int> &edges) const
+    {
+        const Vector d = box.diagonal() / (n - 1);
+
+        auto lattice = [&](int li, int lj, int lk)
+        {
+            return box[0] + Vector(li * d(0), lj * d(1), lk * d(2));
+        };
+
+        // Normal from the gradient of the trilinear interpolation of the cell corner values
+        auto cell_normal = [&](const Vector &vertex, const Vector &origin)
+        {
+            float t[3];
+            for (int c = 0; c < 3; c++)
+                t[c] = std::clamp((vertex(c) - origin(c)) / d(c), 0.f, 1.f);
+
+            Vector g(0, 0, 0);
+            for (int c = 0; c < 8; c++)
+            {
+                float w[3] = {(c & 1) ? t[0] : 1 - t[0], (c & 2) ? t[1] : 1 - t[1], (c & 4) ? t[2] : 1 - t[2]};
+                g = g + a[c] * Vector(((c & 1) ? 1 : -1) * w[1] * w[2] / d(0),
+                                      ((c & 2) ? 1 : -1) * w[0] * w[2] / d(1),
+                                      ((c & 4) ? 1 : -1) * w[0] * w[1] / d(2));
+            }
+            return length2(g) > 0 ? normalize(g) : normal(vertex);
+        };
+
+        int cubeindex = 0;
+        for (int c = 0; c < 8; c++)
+            if (a[c] < 0.0)
+                cubeindex |= 1 << c;
 
-        float za = 0.0;
+        // Cube is straddling the surface
+        if ((cubeindex == 255) || (cubeindex == 0))
+            return;
 
-        // Compute field inside lower Oxy plane
-        for (int i = nax; i < nbx; i++)
+        int e[3];
+        for (int h = 0; h < 3 * s_triangle_count[cubeindex]; h++)
         {
-            for (int j = nay; j < nby; j++)
+            const int edge = s_triangle_table[cubeindex][h];
+            const int axis = s_cell_edge[edge][0];
+            const int di = s_cell_edge[edge][1], dj = s_cell_edge[edge][2], dk = s_cell_edge[edge][3];
+
+            const uint64_t key = ((uint64_t(k + dk) * n + (i + di)) * n + (j + dj)) * 3 + axis;
+            auto [it, inserted] = edges.try_emplace(key, mesh.vertex_count());
+            if (inserted)
             {
-                u[i * ny + j] = clipped[0] + Vector(i * d(0), j * d(1), za);
-                a[i * ny + j] = value(Point(u[i * ny + j]));
+                const int c0 = di + 2 * dj + 4 * dk;
+                const int c1 = c0 + (1 << axis);
+                Vector p0 = lattice(i + di, j + dj, k + dk);
+                Vector p1 = lattice(i + (c1 & 1), j + ((c1 & 2) >> 1), k + ((c1 & 4) >> 2));
+
+                auto vertex = refine(p0, p1, a[c0], a[c1], d(axis));
+                mesh.normal(m_normal_method == NormalMethod::LATTICE ? cell_normal(vertex, lattice(i, j, k)) : normal(vertex));
+                mesh.vertex(vertex);
             }
+            e[h % 3] = it->second;
+            if (h % 3 == 2)
+                mesh.triangle(e[0], e[1], e[2]);
         }
+    }
 
-        // Compute straddling edges inside lower Oxy plane
-        for (int i = nax; i < nbx - 1; i++)
+    /*!
+    \brief Compute the intersection between a segment and the surface with the refinement method of the tree.
+    \sa SDFTree::refine_method, SDFTree::refine_count
+
+    \param a,b End vertices of the segment straddling the surface.
+    \param va,vb Field function value at those end vertices.
+    \param length Distance between vertices.
+    \return Point on the implicit surface.
+    */
+    Vector SDFTree::refine(const Vector &a, const Vector &b, float va, float vb, float length) const
+    {
+        switch (m_refine_method)
+        {
+        case RefineMethod::LINEAR:
+            return (vb * a - va * b) / (vb - va);
+        case RefineMethod::REGULA_FALSI:
         {
-            for (int j = nay; j < nby; j++)
+            // Illinois : when the same end is replaced twice in a row, the value of the other one is halved
+            Vector lo = a, hi = b;
+            float flo = va, fhi = vb, bracket = length;
+            int side = 0;
+            Vector c = (fhi * lo - flo * hi) / (fhi - flo);
+            for (int i = 0; i < s_refine_limit && bracket > m_refine_tolerance; i++)
             {
-                // We need a xor b, which can be implemented a == !b
-                if (!((a[i * ny + j] < 0.0) == !(a[(i + 1) * ny + j] >= 0.0)))
+                const float vc = value(Point(c));
+                s_refine_count++;
+                if (std::abs(vc) <= m_refine_tolerance)
+                    break;
+
+                if ((vc < 0.f) == (flo < 0.f))
+                {
+                    lo = c;
+                    flo = vc;
+                    if (side == 1)
+                        fhi *= 0.5f;
+                    side = 1;
+                }
+                else
                 {
-                    auto vertex = dichotomy(u[i * ny + j], u[(i + 1) * ny + j], a[i * ny + j], a[(i + 1) * ny + j], d(0));
-                    mesh->vertex(vertex);
-                    mesh->normal(normal(vertex));
-                    eax[i * ny + j] = nv;
-                    nv++;
+                    hi = c;
+                    fhi = vc;
+                    if (side == -1)
+                        flo *= 0.5f;
+                    side = -1;
                 }
+                bracket = ::length(hi - lo);
+                c = (fhi * lo - flo * hi) / (fhi - flo);
             }
+            return c;
         }
-        for (int i = nax; i < nbx; i++)
+        case RefineMethod::NEWTON:
         {
-            for (int j = nay; j < nby - 1; j++)
+            // Parameter t along the segment, kept inside the bracket [lo, hi] of the sign change
+            const Vector ab = b - a;
+            float lo = 0.f, hi = 1.f;
+            const bool inside = va < 0.f;
+            float t = va / (va - vb);
+            for (int i = 0; i < s_refine_limit && (hi - lo) * length > m_refine_tolerance; i++)
             {
-                if (!((a[i * ny + j] < 0.0) == !(a[i * ny + (j + 1)] >= 0.0)))
-                {
-                    auto vertex = dichotomy(u[i * ny + j], u[i * ny + (j + 1)], a[i * ny + j], a[i * ny + (j + 1)], d(1));
-                    mesh->vertex(vertex);
-                    mesh->normal(normal(vertex));
-                    eay[i * ny + j] = nv;
-                    nv++;
-                }
+                const Dual g = value_gradient(Point(a + ab * t));
+                s_refine_count++;
+                if (std::abs(g.v) <= m_refine_tolerance)
+                    break;
+
+                if ((g.v < 0.f) == inside)
+                    lo = t;
+                else
+                    hi = t;
+
+                // Fall back to bisection when the step leaves the bracket
+                const float slope = dot(g.d, ab);
+                const float next = slope != 0.f ? t - g.v / slope : -1.f;
+                t = next > lo && next < hi ? next : 0.5f * (lo + hi);
             }
+            return a + ab * t;
+        }
+        default:
+            return dichotomy(a, b, va, vb, length, m_refine_tolerance);
         }
+    }
 
-        // Array for s_edge vertices
-        int e[12];
+    /*!
+    \brief Refine straddling edges in lockstep, with the refinement method of the tree, see SDFTree::refine.
 
-        // For all layers
-        for (int k = naz; k < nbz; k++)
+    Every iteration evaluates the next points of the edges still refined with a single SDFNode::value_batch call,
+    the converged ones being compacted away, so that the field evaluation runs over SIMD lanes of edges.
+    RefineMethod::NEWTON needs gradients, its edges are refined one at a time.
+    \param edges Straddling edges.
+    \param vertices Returned points on the surface, same size as the edges.
+    */
+    void SDFTree::refine_batch(std::span<const RefineEdge> edges, std::span<Vector> vertices) const
+    {
+        const int n = static_cast<int>(edges.size());
+        if (m_refine_method == RefineMethod::NEWTON)
         {
-            float zb = za + d(2);
-            for (int i = nax; i < nbx; i++)
-            {
-                for (int j = nay; j < nby; j++)
-                {
-                    v[i * ny + j] = clipped[0] + Vector(i * d(0), j * d(1), zb);
-                    b[i * ny + j] = value(Point(v[i * ny + j]));
-                }
-            }
+            for (int i = 0; i < n; i++)
+                vertices[i] = refine(edges[i].a, edges[i].b, edges[i].va, edges[i].vb, edges[i].length);
+            return;
+        }
 
-            // Compute straddling edges inside lower Oxy plane
-            for (int i = nax; i < nbx - 1; i++)
+        // Brackets are narrowed in place, the vertices hold the next points to evaluate
+        std::vector<RefineEdge> brackets(edges.begin(), edges.end());
+        std::vector<int> sides(n, 0);
+        std::vector<int> active;
+        active.reserve(n);
+        for (int i = 0; i < n; i++)
+        {
+            const RefineEdge &edge = edges[i];
+            vertices[i] = (edge.vb * edge.a - edge.va * edge.b) / (edge.vb - edge.va);
+            if (m_refine_method != RefineMethod::LINEAR && edge.length > m_refine_tolerance)
+                active.push_back(i);
+        }
+
+        std::vector<float> xs, ys, zs, f;
+        for (int iteration = 1; !active.empty(); iteration++)
+        {
+            const int count = static_cast<int>(active.size());
+            xs.resize(count);
+            ys.resize(count);
+            zs.resize(count);
+            f.resize(count);
+            for (int a = 0; a < count; a++)
             {
-                for (int j = nay; j < nby; j++)
-                {
-                    //   if (((b[i*ny + j] < 0.0) && (b[(i + 1)*ny + j] >= 0.0)) || ((b[i*ny + j] >= 0.0) && (b[(i + 1)*ny + j] < 0.0)))
-                    if (!((b[i * ny + j] < 0.0) == !(b[(i + 1) * ny + j] >= 0.0)))
-                    {
-                        auto vertex = dichotomy(v[i * ny + j], v[(i + 1) * ny + j], b[i * ny + j], b[(i + 1) * ny + j], d(0));
-                        mesh->vertex(vertex);
-                        mesh->normal(normal(vertex));
-                        ebx[i * ny + j] = nv;
-                        nv++;
-                    }
-                }
+                const Vector &c = vertices[active[a]];
+                xs[a] = c.x;
+                ys[a] = c.y;
+                zs[a] = c.z;
             }
+            value_batch(xs, ys, zs, f);
+            s_refine_count += count;
 
-            for (int i = nax; i < nbx; i++)
+            int kept = 0;
+            for (int a = 0; a < count; a++)
             {
-                for (int j = nay; j < nby - 1; j++)
+                const int i = active[a];
+                RefineEdge &edge = brackets[i];
+                Vector &c = vertices[i];
+                if (m_refine_method == RefineMethod::BISECTION)
                 {
-                    // if (((b[i*ny + j] < 0.0) && (b[i*ny + (j + 1)] >= 0.0)) || ((b[i*ny + j] >= 0.0) && (b[i*ny + (j + 1)] < 0.0)))
-                    if (!((b[i * ny + j] < 0.0) == !(b[i * ny + (j + 1)] >= 0.0)))
+                    // Same steps as SDFTree::dichotomy, va keeps the sign of the end a
+                    if ((f[a] > 0.f) != (edge.va > 0.f))
+                        edge.b = c;
+                    else
                     {
-                        auto vertex = dichotomy(v[i * ny + j], v[i * ny + (j + 1)], b[i * ny + j], b[i * ny + (j + 1)], d(1));
-                        mesh->vertex(vertex);
-                        mesh->normal(normal(vertex));
-                        eby[i * ny + j] = nv;
-                        nv++;
+                        edge.a = c;
+                        edge.va = f[a];
                     }
+                    edge.length *= 0.5f;
+                    c = 0.5f * (edge.a + edge.b);
                 }
-            }
-
-            // Create vertical straddling edges
-            for (int i = nax; i < nbx; i++)
-            {
-                for (int j = nay; j < nby; j++)
+                else
                 {
-                    // if ((a[i*ny + j] < 0.0) && (b[i*ny + j] >= 0.0) || (a[i*ny + j] >= 0.0) && (b[i*ny + j] < 0.0))
-                    if (!((a[i * ny + j] < 0.0) == !(b[i * ny + j] >= 0.0)))
+                    // Illinois, as in SDFTree::refine
+                    if (std::abs(f[a]) <= m_refine_tolerance)
+                        continue;
+
+                    if ((f[a] < 0.f) == (edge.va < 0.f))
                     {
-                        auto vertex = dichotomy(u[i * ny + j], v[i * ny + j], a[i * ny + j], b[i * ny + j], d(2));
-                        mesh->vertex(vertex);
-                        mesh->normal(normal(vertex));
-                        ez[i * ny + j] = nv;
-                        nv++;
+                        edge.a = c;
+                        edge.va = f[a];
+                        if (sides[i] == 1)
+                            edge.vb *= 0.5f;
+                        sides[i] = 1;
                     }
-                }
-            }
-
-            // Create mesh
-            for (int i = nax; i < nbx - 1; i++)
-            {
-                for (int j = nay; j < nby - 1; j++)
-                {
-                    int cubeindex = 0;
-                    if (a[i * ny + j] < 0.0)
-                        cubeindex |= 1;
-                    if (a[(i + 1) * ny + j] < 0.0)
-                        cubeindex |= 2;
-                    if (a[i * ny + j + 1] < 0.0)
-                        cubeindex |= 4;
-                    if (a[(i + 1) * ny + j + 1] < 0.0)
-                        cubeindex |= 8;
-                    if (b[i * ny + j] < 0.0)
-                        cubeindex |= 16;
-                    if (b[(i + 1) * ny + j] < 0.0)
-                        cubeindex |= 32;
-                    if (b[i * ny + j + 1] < 0.0)
-                        cubeindex |= 64;
-                    if (b[(i + 1) * ny + j + 1] < 0.0)
-                        cubeindex |= 128;
-
-                    // Cube is straddling the surface
-                    if ((cubeindex != 255) && (cubeindex != 0))
+                    else
                     {
-                        e[0] = eax[i * ny + j];
-                        e[1] = eax[i * ny + (j + 1)];
-                        e[2] = ebx[i * ny + j];
-                        e[3] = ebx[i * ny + (j + 1)];
-                        e[4] = eay[i * ny + j];
-                        e[5] = eay[(i + 1) * ny + j];
-                        e[6] = eby[i * ny + j];
-                        e[7] = eby[(i + 1) * ny + j];
-                        e[8] = ez[i * ny + j];
-                        e[9] = ez[(i + 1) * ny + j];
-                        e[10] = ez[i * ny + (j + 1)];
-                        e[11] = ez[(i + 1) * ny + (j + 1)];
-
-                        for (int h = 0; s_triangle_table[cubeindex][h] != -1; h += 3)
-                        {
-                            mesh->triangle(e[s_triangle_table[cubeindex][h]], e[s_triangle_table[cubeindex][h + 1]], e[s_triangle_table[cubeindex][h + 2]]);
-                        }
+                        edge.b = c;
+                        edge.vb = f[a];
+                        if (sides[i] == -1)
+                            edge.va *= 0.5f;
+                        sides[i] = -1;
                     }
+                    edge.length = ::length(edge.b - edge.a);
+                    c = (edge.vb * edge.a - edge.va * edge.b) / (edge.vb - edge.va);
+                    if (iteration >= s_refine_limit)
+                        continue;
                 }
+                if (edge.length > m_refine_tolerance)
+                    active[kept++] = i;
             }
-
-            std::swap(a, b);
-
-            za = zb;
-            std::swap(eax, ebx);
-            std::swap(eay, eby);
-            std::swap(u, v);
+            active.resize(kept);
         }
-
-        delete[] a;
-        delete[] b;
-        delete[] u;
-        delete[] v;
-
-        delete[] eax;
-        delete[] eay;
-        delete[] ebx;
-        delete[] eby;
-        delete[] ez;
-
-        return mesh;
     }
 
     /*!
-    \brief Compute the intersection between a segment and an implicit surface.
+    \brief Compute the intersection between a segment and an implicit surface by bisection.
 
     \param a,b End vertices of the segment straddling the surface.
     \param va,vb Field function value at those end vertices.
     \param length Distance between vertices.
-    \param s_epsilon Precision.
+    \param tolerance Length of the segment at which the bisection stops.
     \return Point on the implicit surface.
     */
-    Vector SDFTree::dichotomy(Vector a, Vector b, float va, float vb, float length) const
+    Vector SDFTree::dichotomy(Vector a, Vector b, float va, float vb, float length, float tolerance) const
     {
         int ia = va > 0.0 ? 1 : -1;
 
         // Get an accurate first guess
         Vector c = (vb * a - va * b) / (vb - va);
 
-        while (length > s_epsilon)
+        while (length > tolerance)
         {
             float vc = value(Point(c));
+            s_refine_count++;
             int ic = vc > 0.0 ? 1 : -1;
             if (ia + ic == 0)
             {
@@ -1002,13 +5048,110 @@ namespace gm
         return c;
     }
 
+    /*!
+    \brief Set the number of threads used by SDFTree::polygonize.
+    \param threads 1 for a sequential evaluation, 0 for the hardware concurrency.
+    */
+    void SDFTree::thread_count(int threads)
+    {
+        m_thread_count = std::max(threads, 0);
+    }
+
+    int SDFTree::thread_count() const
+    {
+        return m_thread_count;
+    }
+
+    /*!
+    \brief Set the algorithm used by SDFTree::polygonize.
+    */
+    void SDFTree::polygonize_method(PolygonizeMethod method)
+    {
+        m_polygonize_method = method;
+    }
+
+    PolygonizeMethod SDFTree::polygonize_method() const
+    {
+        return m_polygonize_method;
+    }
+
+    /*!
+    \brief Set how SDFTree::polygonize computes the vertex normals.
+    */
+    void SDFTree::normal_method(NormalMethod method)
+    {
+        m_normal_method = method;
+    }
+
+    NormalMethod SDFTree::normal_method() const
+    {
+        return m_normal_method;
+    }
+
+    /*!
+    \brief Set the number of cells along each axis of the coarse scan seeding PolygonizeMethod::CONTINUATION.
+    It should be fine enough for every component of the surface to lie closer to the center of a coarse cell than its radius.
+    \param resolution 0 disables the scan, only the seeds given to SDFTree::polygonize are followed.
+    */
+    void SDFTree::seed_resolution(int resolution)
+    {
+        m_seed_resolution = std::max(resolution, 0);
+    }
+
+    int SDFTree::seed_resolution() const
+    {
+        return m_seed_resolution;
+    }
+
+    /*!
+    \brief Set how the meshers refine the intersection of the straddling edges, see SDFTree::refine.
+    */
+    void SDFTree::refine_method(RefineMethod method)
+    {
+        m_refine_method = method;
+    }
+
+    RefineMethod SDFTree::refine_method() const
+    {
+        return m_refine_method;
+    }
+
+    /*!
+    \brief Set the tolerance of the refinement : the length of the bracket for RefineMethod::BISECTION,
+    the absolute value of the field for the iterative methods, which also stop with a bracket that short.
+    */
+    void SDFTree::refine_tolerance(float tolerance)
+    {
+        m_refine_tolerance = std::max(tolerance, 0.f);
+    }
+
+    float SDFTree::refine_tolerance() const
+    {
+        return m_refine_tolerance;
+    }
+
+    /*!
+    \brief Number of evaluations spent refining edges since the last reset, see SDFTree::refine.
+    */
+    int SDFTree::refine_count() const
+    {
+        return s_refine_count;
+    }
+
+    void SDFTree::reset_refine_count()
+    {
+        s_refine_count = 0;
+    }
+
     void SDFTree::root(const Ref<SDFNode> &node)
     {
+        edited();
         m_root = node;
     }
 
     Ref<SDFNode> &SDFTree::root()
     {
+        edited();
         return m_root;
     }
 
@@ -1017,6 +5160,49 @@ namespace gm
         return SDFType::TREE;
     }
 
+    void SDFTree::compile(SDFProgram &program) const
+    {
+        program.compile(*m_root);
+    }
+
+    Interval SDFTree::interval(const Box &box) const
+    {
+        return m_root->interval(box);
+    }
+
+    Box SDFTree::bounds() const
+    {
+        return m_root->bounds();
+    }
+
+    bool SDFTree::conservative_bounds() const
+    {
+        return m_root->conservative_bounds();
+    }
+
+    /*!
+    \brief Lipschitz constant derived from the root, the lambda of the tree is only used when it has none.
+    */
+    float SDFTree::lipschitz() const
+    {
+        return m_root ? m_root->lipschitz() : SDFNode::lipschitz();
+    }
+
+    Ref<SDFNode> SDFTree::prune(const Box &box, Interval &range)
+    {
+        return m_root->prune(box, range);
+    }
+
+    Ref<SDFNode> SDFTree::optimize()
+    {
+        return m_root ? m_root->optimize() : shared_from_this();
+    }
+
+    uint64_t SDFTree::fingerprint() const
+    {
+        return m_root ? m_root->fingerprint() : hash({});
+    }
+
     std::vector<SDFType> SDFTree::tree_type() const
     {
         return tree_type(m_root);
@@ -1041,18 +5227,30 @@ namespace gm
     /*!
     \brief Compute the normal to the surface.
 
-    \sa SDFTree::gradient(const Vector&) const
+    The gradient is differentiated along with the value, in a single evaluation of the tree.
+
+    \sa SDFNode::value_gradient(const Point&) const
 
     \param p Point (should be on the surface).
     */
     Vector SDFTree::normal(const Vector &p) const
     {
-        Vector normal = normalize(gradient(Point(p)));
+        Vector normal = normalize(value_gradient(Point(p)).d);
 
         return normal;
     }
 
-    int SDFTree::s_edge_table[256] = {
+    const int SDFTree::s_cell_edge[12][4] = {
+        {0, 0, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}, {0, 0, 1, 1},
+        {1, 0, 0, 0}, {1, 1, 0, 0}, {1, 0, 0, 1}, {1, 1, 0, 1},
+        {2, 0, 0, 0}, {2, 1, 0, 0}, {2, 0, 1, 0}, {2, 1, 1, 0}};
+
+    const int SDFTree::s_brick_size = 8;
+    const float SDFTree::s_qef_threshold = 0.1f;
+    const int SDFTree::s_refine_limit = 32;
+    thread_local int SDFTree::s_refine_count = 0;
+
+    const uint16_t SDFTree::s_edge_table[256] = {
         0, 273, 545, 816, 1042, 1283, 1587, 1826, 2082, 2355, 2563, 2834, 3120, 3361, 3601, 3840,
         324, 85, 869, 628, 1366, 1095, 1911, 1638, 2406, 2167, 2887, 2646, 3444, 3173, 3925, 3652,
         644, 917, 165, 436, 1686, 1927, 1207, 1446, 2726, 2999, 2183, 2454, 3764, 4005, 3221, 3460,
@@ -1070,263 +5268,281 @@ namespace gm
         3652, 3925, 3173, 3444, 2646, 2887, 2167, 2406, 1638, 1911, 1095, 1366, 628, 869, 85, 324,
         3840, 3601, 3361, 3120, 2834, 2563, 2355, 2082, 1826, 1587, 1283, 1042, 816, 545, 273, 0};
 
-    int SDFTree::s_triangle_table[256][16] = {
-        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 8, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 5, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 8, 4, 9, 8, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {4, 10, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 10, 1, 8, 10, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 9, 0, 1, 4, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 10, 1, 5, 9, 10, 9, 8, 10, -1, -1, -1, -1, -1, -1, -1},
-        {5, 1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 8, 4, 5, 1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {9, 1, 11, 0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {1, 8, 4, 1, 11, 8, 11, 9, 8, -1, -1, -1, -1, -1, -1, -1},
-        {4, 11, 5, 10, 11, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 11, 5, 0, 8, 11, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1},
-        {4, 9, 0, 4, 10, 9, 10, 11, 9, -1, -1, -1, -1, -1, -1, -1},
-        {9, 8, 11, 11, 8, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {2, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {2, 4, 0, 6, 4, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 5, 9, 8, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {2, 5, 9, 2, 6, 5, 6, 4, 5, -1, -1, -1, -1, -1, -1, -1},
-        {8, 2, 6, 4, 10, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {10, 2, 6, 10, 1, 2, 1, 0, 2, -1, -1, -1, -1, -1, -1, -1},
-        {9, 0, 5, 8, 2, 6, 1, 4, 10, -1, -1, -1, -1, -1, -1, -1},
-        {2, 6, 10, 9, 2, 10, 9, 10, 1, 9, 1, 5, -1, -1, -1, -1},
-        {5, 1, 11, 8, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {4, 2, 6, 4, 0, 2, 5, 1, 11, -1, -1, -1, -1, -1, -1, -1},
-        {9, 1, 11, 9, 0, 1, 8, 2, 6, -1, -1, -1, -1, -1, -1, -1},
-        {1, 11, 9, 1, 9, 6, 1, 6, 4, 6, 9, 2, -1, -1, -1, -1},
-        {4, 11, 5, 4, 10, 11, 6, 8, 2, -1, -1, -1, -1, -1, -1, -1},
-        {5, 10, 11, 5, 2, 10, 5, 0, 2, 6, 10, 2, -1, -1, -1, -1},
-        {2, 6, 8, 9, 0, 10, 9, 10, 11, 10, 0, 4, -1, -1, -1, -1},
-        {2, 6, 10, 2, 10, 9, 9, 10, 11, -1, -1, -1, -1, -1, -1, -1},
-        {9, 7, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {9, 7, 2, 0, 8, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 7, 2, 5, 7, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {8, 7, 2, 8, 4, 7, 4, 5, 7, -1, -1, -1, -1, -1, -1, -1},
-        {9, 7, 2, 1, 4, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 10, 1, 0, 8, 10, 2, 9, 7, -1, -1, -1, -1, -1, -1, -1},
-        {0, 7, 2, 0, 5, 7, 1, 4, 10, -1, -1, -1, -1, -1, -1, -1},
-        {1, 5, 7, 1, 7, 8, 1, 8, 10, 2, 8, 7, -1, -1, -1, -1},
-        {5, 1, 11, 9, 7, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {4, 0, 8, 5, 1, 11, 2, 9, 7, -1, -1, -1, -1, -1, -1, -1},
-        {7, 1, 11, 7, 2, 1, 2, 0, 1, -1, -1, -1, -1, -1, -1, -1},
-        {1, 11, 7, 4, 1, 7, 4, 7, 2, 4, 2, 8, -1, -1, -1, -1},
-        {11, 4, 10, 11, 5, 4, 9, 7, 2, -1, -1, -1, -1, -1, -1, -1},
-        {2, 9, 7, 0, 8, 5, 8, 11, 5, 8, 10, 11, -1, -1, -1, -1},
-        {7, 2, 0, 7, 0, 10, 7, 10, 11, 10, 0, 4, -1, -1, -1, -1},
-        {7, 2, 8, 7, 8, 11, 11, 8, 10, -1, -1, -1, -1, -1, -1, -1},
-        {9, 6, 8, 7, 6, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {9, 4, 0, 9, 7, 4, 7, 6, 4, -1, -1, -1, -1, -1, -1, -1},
-        {0, 6, 8, 0, 5, 6, 5, 7, 6, -1, -1, -1, -1, -1, -1, -1},
-        {5, 7, 4, 4, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {6, 9, 7, 6, 8, 9, 4, 10, 1, -1, -1, -1, -1, -1, -1, -1},
-        {9, 7, 6, 9, 6, 1, 9, 1, 0, 1, 6, 10, -1, -1, -1, -1},
-        {1, 4, 10, 0, 5, 8, 5, 6, 8, 5, 7, 6, -1, -1, -1, -1},
-        {10, 1, 5, 10, 5, 6, 6, 5, 7, -1, -1, -1, -1, -1, -1, -1},
-        {9, 6, 8, 9, 7, 6, 11, 5, 1, -1, -1, -1, -1, -1, -1, -1},
-        {11, 5, 1, 9, 7, 0, 7, 4, 0, 7, 6, 4, -1, -1, -1, -1},
-        {8, 0, 1, 8, 1, 7, 8, 7, 6, 11, 7, 1, -1, -1, -1, -1},
-        {1, 11, 7, 1, 7, 4, 4, 7, 6, -1, -1, -1, -1, -1, -1, -1},
-        {9, 7, 8, 8, 7, 6, 11, 5, 4, 11, 4, 10, -1, -1, -1, -1},
-        {7, 6, 0, 7, 0, 9, 6, 10, 0, 5, 0, 11, 10, 11, 0, -1},
-        {10, 11, 0, 10, 0, 4, 11, 7, 0, 8, 0, 6, 7, 6, 0, -1},
-        {10, 11, 7, 6, 10, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {6, 3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {4, 0, 8, 10, 6, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 5, 9, 10, 6, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {8, 5, 9, 8, 4, 5, 10, 6, 3, -1, -1, -1, -1, -1, -1, -1},
-        {6, 1, 4, 3, 1, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {6, 0, 8, 6, 3, 0, 3, 1, 0, -1, -1, -1, -1, -1, -1, -1},
-        {1, 6, 3, 1, 4, 6, 0, 5, 9, -1, -1, -1, -1, -1, -1, -1},
-        {5, 3, 1, 5, 8, 3, 5, 9, 8, 8, 6, 3, -1, -1, -1, -1},
-        {11, 5, 1, 3, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 1, 11, 4, 0, 8, 3, 10, 6, -1, -1, -1, -1, -1, -1, -1},
-        {1, 9, 0, 1, 11, 9, 3, 10, 6, -1, -1, -1, -1, -1, -1, -1},
-        {3, 10, 6, 1, 11, 4, 11, 8, 4, 11, 9, 8, -1, -1, -1, -1},
-        {11, 6, 3, 11, 5, 6, 5, 4, 6, -1, -1, -1, -1, -1, -1, -1},
-        {11, 6, 3, 5, 6, 11, 5, 8, 6, 5, 0, 8, -1, -1, -1, -1},
-        {0, 4, 6, 0, 6, 11, 0, 11, 9, 3, 11, 6, -1, -1, -1, -1},
-        {6, 3, 11, 6, 11, 8, 8, 11, 9, -1, -1, -1, -1, -1, -1, -1},
-        {3, 8, 2, 10, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {4, 3, 10, 4, 0, 3, 0, 2, 3, -1, -1, -1, -1, -1, -1, -1},
-        {8, 3, 10, 8, 2, 3, 9, 0, 5, -1, -1, -1, -1, -1, -1, -1},
-        {9, 2, 3, 9, 3, 4, 9, 4, 5, 10, 4, 3, -1, -1, -1, -1},
-        {8, 1, 4, 8, 2, 1, 2, 3, 1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 2, 1, 2, 3, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 9, 0, 1, 4, 2, 1, 2, 3, 2, 4, 8, -1, -1, -1, -1},
-        {5, 9, 2, 5, 2, 1, 1, 2, 3, -1, -1, -1, -1, -1, -1, -1},
-        {3, 8, 2, 3, 10, 8, 1, 11, 5, -1, -1, -1, -1, -1, -1, -1},
-        {5, 1, 11, 4, 0, 10, 0, 3, 10, 0, 2, 3, -1, -1, -1, -1},
-        {2, 10, 8, 2, 3, 10, 0, 1, 9, 1, 11, 9, -1, -1, -1, -1},
-        {11, 9, 4, 11, 4, 1, 9, 2, 4, 10, 4, 3, 2, 3, 4, -1},
-        {8, 5, 4, 8, 3, 5, 8, 2, 3, 3, 11, 5, -1, -1, -1, -1},
-        {11, 5, 0, 11, 0, 3, 3, 0, 2, -1, -1, -1, -1, -1, -1, -1},
-        {2, 3, 4, 2, 4, 8, 3, 11, 4, 0, 4, 9, 11, 9, 4, -1},
-        {11, 9, 2, 3, 11, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {2, 9, 7, 6, 3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 8, 4, 2, 9, 7, 10, 6, 3, -1, -1, -1, -1, -1, -1, -1},
-        {7, 0, 5, 7, 2, 0, 6, 3, 10, -1, -1, -1, -1, -1, -1, -1},
-        {10, 6, 3, 8, 4, 2, 4, 7, 2, 4, 5, 7, -1, -1, -1, -1},
-        {6, 1, 4, 6, 3, 1, 7, 2, 9, -1, -1, -1, -1, -1, -1, -1},
-        {9, 7, 2, 0, 8, 3, 0, 3, 1, 3, 8, 6, -1, -1, -1, -1},
-        {4, 3, 1, 4, 6, 3, 5, 7, 0, 7, 2, 0, -1, -1, -1, -1},
-        {3, 1, 8, 3, 8, 6, 1, 5, 8, 2, 8, 7, 5, 7, 8, -1},
-        {9, 7, 2, 11, 5, 1, 6, 3, 10, -1, -1, -1, -1, -1, -1, -1},
-        {3, 10, 6, 5, 1, 11, 0, 8, 4, 2, 9, 7, -1, -1, -1, -1},
-        {6, 3, 10, 7, 2, 11, 2, 1, 11, 2, 0, 1, -1, -1, -1, -1},
-        {4, 2, 8, 4, 7, 2, 4, 1, 7, 11, 7, 1, 10, 6, 3, -1},
-        {9, 7, 2, 11, 5, 3, 5, 6, 3, 5, 4, 6, -1, -1, -1, -1},
-        {5, 3, 11, 5, 6, 3, 5, 0, 6, 8, 6, 0, 9, 7, 2, -1},
-        {2, 0, 11, 2, 11, 7, 0, 4, 11, 3, 11, 6, 4, 6, 11, -1},
-        {6, 3, 11, 6, 11, 8, 7, 2, 11, 2, 8, 11, -1, -1, -1, -1},
-        {3, 9, 7, 3, 10, 9, 10, 8, 9, -1, -1, -1, -1, -1, -1, -1},
-        {4, 3, 10, 0, 3, 4, 0, 7, 3, 0, 9, 7, -1, -1, -1, -1},
-        {0, 10, 8, 0, 7, 10, 0, 5, 7, 7, 3, 10, -1, -1, -1, -1},
-        {3, 10, 4, 3, 4, 7, 7, 4, 5, -1, -1, -1, -1, -1, -1, -1},
-        {7, 8, 9, 7, 1, 8, 7, 3, 1, 4, 8, 1, -1, -1, -1, -1},
-        {9, 7, 3, 9, 3, 0, 0, 3, 1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 7, 8, 5, 8, 0, 7, 3, 8, 4, 8, 1, 3, 1, 8, -1},
-        {5, 7, 3, 1, 5, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 1, 11, 9, 7, 10, 9, 10, 8, 10, 7, 3, -1, -1, -1, -1},
-        {0, 10, 4, 0, 3, 10, 0, 9, 3, 7, 3, 9, 5, 1, 11, -1},
-        {10, 8, 7, 10, 7, 3, 8, 0, 7, 11, 7, 1, 0, 1, 7, -1},
-        {3, 10, 4, 3, 4, 7, 1, 11, 4, 11, 7, 4, -1, -1, -1, -1},
-        {5, 4, 3, 5, 3, 11, 4, 8, 3, 7, 3, 9, 8, 9, 3, -1},
-        {11, 5, 0, 11, 0, 3, 9, 7, 0, 7, 3, 0, -1, -1, -1, -1},
-        {0, 4, 8, 7, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {11, 7, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {11, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 8, 4, 7, 11, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {9, 0, 5, 7, 11, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 8, 4, 5, 9, 8, 7, 11, 3, -1, -1, -1, -1, -1, -1, -1},
-        {1, 4, 10, 11, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {10, 0, 8, 10, 1, 0, 11, 3, 7, -1, -1, -1, -1, -1, -1, -1},
-        {0, 5, 9, 1, 4, 10, 7, 11, 3, -1, -1, -1, -1, -1, -1, -1},
-        {7, 11, 3, 5, 9, 1, 9, 10, 1, 9, 8, 10, -1, -1, -1, -1},
-        {5, 3, 7, 1, 3, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 3, 7, 5, 1, 3, 4, 0, 8, -1, -1, -1, -1, -1, -1, -1},
-        {9, 3, 7, 9, 0, 3, 0, 1, 3, -1, -1, -1, -1, -1, -1, -1},
-        {7, 9, 8, 7, 8, 1, 7, 1, 3, 4, 1, 8, -1, -1, -1, -1},
-        {3, 4, 10, 3, 7, 4, 7, 5, 4, -1, -1, -1, -1, -1, -1, -1},
-        {0, 8, 10, 0, 10, 7, 0, 7, 5, 7, 10, 3, -1, -1, -1, -1},
-        {4, 10, 3, 0, 4, 3, 0, 3, 7, 0, 7, 9, -1, -1, -1, -1},
-        {3, 7, 9, 3, 9, 10, 10, 9, 8, -1, -1, -1, -1, -1, -1, -1},
-        {7, 11, 3, 2, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {2, 4, 0, 2, 6, 4, 3, 7, 11, -1, -1, -1, -1, -1, -1, -1},
-        {5, 9, 0, 7, 11, 3, 8, 2, 6, -1, -1, -1, -1, -1, -1, -1},
-        {11, 3, 7, 5, 9, 6, 5, 6, 4, 6, 9, 2, -1, -1, -1, -1},
-        {4, 10, 1, 6, 8, 2, 11, 3, 7, -1, -1, -1, -1, -1, -1, -1},
-        {7, 11, 3, 2, 6, 1, 2, 1, 0, 1, 6, 10, -1, -1, -1, -1},
-        {0, 5, 9, 2, 6, 8, 1, 4, 10, 7, 11, 3, -1, -1, -1, -1},
-        {9, 1, 5, 9, 10, 1, 9, 2, 10, 6, 10, 2, 7, 11, 3, -1},
-        {3, 5, 1, 3, 7, 5, 2, 6, 8, -1, -1, -1, -1, -1, -1, -1},
-        {5, 1, 7, 7, 1, 3, 4, 0, 2, 4, 2, 6, -1, -1, -1, -1},
-        {8, 2, 6, 9, 0, 7, 0, 3, 7, 0, 1, 3, -1, -1, -1, -1},
-        {6, 4, 9, 6, 9, 2, 4, 1, 9, 7, 9, 3, 1, 3, 9, -1},
-        {8, 2, 6, 4, 10, 7, 4, 7, 5, 7, 10, 3, -1, -1, -1, -1},
-        {7, 5, 10, 7, 10, 3, 5, 0, 10, 6, 10, 2, 0, 2, 10, -1},
-        {0, 7, 9, 0, 3, 7, 0, 4, 3, 10, 3, 4, 8, 2, 6, -1},
-        {3, 7, 9, 3, 9, 10, 2, 6, 9, 6, 10, 9, -1, -1, -1, -1},
-        {11, 2, 9, 3, 2, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {2, 11, 3, 2, 9, 11, 0, 8, 4, -1, -1, -1, -1, -1, -1, -1},
-        {11, 0, 5, 11, 3, 0, 3, 2, 0, -1, -1, -1, -1, -1, -1, -1},
-        {8, 4, 5, 8, 5, 3, 8, 3, 2, 3, 5, 11, -1, -1, -1, -1},
-        {11, 2, 9, 11, 3, 2, 10, 1, 4, -1, -1, -1, -1, -1, -1, -1},
-        {0, 8, 1, 1, 8, 10, 2, 9, 11, 2, 11, 3, -1, -1, -1, -1},
-        {4, 10, 1, 0, 5, 3, 0, 3, 2, 3, 5, 11, -1, -1, -1, -1},
-        {3, 2, 5, 3, 5, 11, 2, 8, 5, 1, 5, 10, 8, 10, 5, -1},
-        {5, 2, 9, 5, 1, 2, 1, 3, 2, -1, -1, -1, -1, -1, -1, -1},
-        {4, 0, 8, 5, 1, 9, 1, 2, 9, 1, 3, 2, -1, -1, -1, -1},
-        {0, 1, 2, 2, 1, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {8, 4, 1, 8, 1, 2, 2, 1, 3, -1, -1, -1, -1, -1, -1, -1},
-        {9, 3, 2, 9, 4, 3, 9, 5, 4, 10, 3, 4, -1, -1, -1, -1},
-        {8, 10, 5, 8, 5, 0, 10, 3, 5, 9, 5, 2, 3, 2, 5, -1},
-        {4, 10, 3, 4, 3, 0, 0, 3, 2, -1, -1, -1, -1, -1, -1, -1},
-        {3, 2, 8, 10, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {6, 11, 3, 6, 8, 11, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1},
-        {0, 6, 4, 0, 11, 6, 0, 9, 11, 3, 6, 11, -1, -1, -1, -1},
-        {11, 3, 6, 5, 11, 6, 5, 6, 8, 5, 8, 0, -1, -1, -1, -1},
-        {11, 3, 6, 11, 6, 5, 5, 6, 4, -1, -1, -1, -1, -1, -1, -1},
-        {1, 4, 10, 11, 3, 8, 11, 8, 9, 8, 3, 6, -1, -1, -1, -1},
-        {1, 0, 6, 1, 6, 10, 0, 9, 6, 3, 6, 11, 9, 11, 6, -1},
-        {5, 8, 0, 5, 6, 8, 5, 11, 6, 3, 6, 11, 1, 4, 10, -1},
-        {10, 1, 5, 10, 5, 6, 11, 3, 5, 3, 6, 5, -1, -1, -1, -1},
-        {5, 1, 3, 5, 3, 8, 5, 8, 9, 8, 3, 6, -1, -1, -1, -1},
-        {1, 3, 9, 1, 9, 5, 3, 6, 9, 0, 9, 4, 6, 4, 9, -1},
-        {6, 8, 0, 6, 0, 3, 3, 0, 1, -1, -1, -1, -1, -1, -1, -1},
-        {6, 4, 1, 3, 6, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {8, 9, 3, 8, 3, 6, 9, 5, 3, 10, 3, 4, 5, 4, 3, -1},
-        {0, 9, 5, 10, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {6, 8, 0, 6, 0, 3, 4, 10, 0, 10, 3, 0, -1, -1, -1, -1},
-        {6, 10, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {10, 7, 11, 6, 7, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {10, 7, 11, 10, 6, 7, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1},
-        {7, 10, 6, 7, 11, 10, 5, 9, 0, -1, -1, -1, -1, -1, -1, -1},
-        {11, 6, 7, 11, 10, 6, 9, 8, 5, 8, 4, 5, -1, -1, -1, -1},
-        {1, 7, 11, 1, 4, 7, 4, 6, 7, -1, -1, -1, -1, -1, -1, -1},
-        {8, 1, 0, 8, 7, 1, 8, 6, 7, 11, 1, 7, -1, -1, -1, -1},
-        {9, 0, 5, 7, 11, 4, 7, 4, 6, 4, 11, 1, -1, -1, -1, -1},
-        {9, 8, 1, 9, 1, 5, 8, 6, 1, 11, 1, 7, 6, 7, 1, -1},
-        {10, 5, 1, 10, 6, 5, 6, 7, 5, -1, -1, -1, -1, -1, -1, -1},
-        {0, 8, 4, 5, 1, 6, 5, 6, 7, 6, 1, 10, -1, -1, -1, -1},
-        {9, 6, 7, 9, 1, 6, 9, 0, 1, 1, 10, 6, -1, -1, -1, -1},
-        {6, 7, 1, 6, 1, 10, 7, 9, 1, 4, 1, 8, 9, 8, 1, -1},
-        {5, 4, 7, 4, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 8, 6, 0, 6, 5, 5, 6, 7, -1, -1, -1, -1, -1, -1, -1},
-        {9, 0, 4, 9, 4, 7, 7, 4, 6, -1, -1, -1, -1, -1, -1, -1},
-        {9, 8, 6, 7, 9, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {7, 8, 2, 7, 11, 8, 11, 10, 8, -1, -1, -1, -1, -1, -1, -1},
-        {7, 0, 2, 7, 10, 0, 7, 11, 10, 10, 4, 0, -1, -1, -1, -1},
-        {0, 5, 9, 8, 2, 11, 8, 11, 10, 11, 2, 7, -1, -1, -1, -1},
-        {11, 10, 2, 11, 2, 7, 10, 4, 2, 9, 2, 5, 4, 5, 2, -1},
-        {1, 7, 11, 4, 7, 1, 4, 2, 7, 4, 8, 2, -1, -1, -1, -1},
-        {7, 11, 1, 7, 1, 2, 2, 1, 0, -1, -1, -1, -1, -1, -1, -1},
-        {4, 11, 1, 4, 7, 11, 4, 8, 7, 2, 7, 8, 0, 5, 9, -1},
-        {7, 11, 1, 7, 1, 2, 5, 9, 1, 9, 2, 1, -1, -1, -1, -1},
-        {1, 7, 5, 1, 8, 7, 1, 10, 8, 2, 7, 8, -1, -1, -1, -1},
-        {0, 2, 10, 0, 10, 4, 2, 7, 10, 1, 10, 5, 7, 5, 10, -1},
-        {0, 1, 7, 0, 7, 9, 1, 10, 7, 2, 7, 8, 10, 8, 7, -1},
-        {9, 2, 7, 1, 10, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {8, 2, 7, 8, 7, 4, 4, 7, 5, -1, -1, -1, -1, -1, -1, -1},
-        {0, 2, 7, 5, 0, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {8, 2, 7, 8, 7, 4, 9, 0, 7, 0, 4, 7, -1, -1, -1, -1},
-        {9, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {2, 10, 6, 2, 9, 10, 9, 11, 10, -1, -1, -1, -1, -1, -1, -1},
-        {0, 8, 4, 2, 9, 6, 9, 10, 6, 9, 11, 10, -1, -1, -1, -1},
-        {5, 11, 10, 5, 10, 2, 5, 2, 0, 6, 2, 10, -1, -1, -1, -1},
-        {4, 5, 2, 4, 2, 8, 5, 11, 2, 6, 2, 10, 11, 10, 2, -1},
-        {1, 9, 11, 1, 6, 9, 1, 4, 6, 6, 2, 9, -1, -1, -1, -1},
-        {9, 11, 6, 9, 6, 2, 11, 1, 6, 8, 6, 0, 1, 0, 6, -1},
-        {4, 6, 11, 4, 11, 1, 6, 2, 11, 5, 11, 0, 2, 0, 11, -1},
-        {5, 11, 1, 8, 6, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {2, 10, 6, 9, 10, 2, 9, 1, 10, 9, 5, 1, -1, -1, -1, -1},
-        {9, 6, 2, 9, 10, 6, 9, 5, 10, 1, 10, 5, 0, 8, 4, -1},
-        {10, 6, 2, 10, 2, 1, 1, 2, 0, -1, -1, -1, -1, -1, -1, -1},
-        {10, 6, 2, 10, 2, 1, 8, 4, 2, 4, 1, 2, -1, -1, -1, -1},
-        {2, 9, 5, 2, 5, 6, 6, 5, 4, -1, -1, -1, -1, -1, -1, -1},
-        {2, 9, 5, 2, 5, 6, 0, 8, 5, 8, 6, 5, -1, -1, -1, -1},
-        {2, 0, 4, 6, 2, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {2, 8, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {9, 11, 8, 11, 10, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {4, 0, 9, 4, 9, 10, 10, 9, 11, -1, -1, -1, -1, -1, -1, -1},
-        {0, 5, 11, 0, 11, 8, 8, 11, 10, -1, -1, -1, -1, -1, -1, -1},
-        {4, 5, 11, 10, 4, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {1, 4, 8, 1, 8, 11, 11, 8, 9, -1, -1, -1, -1, -1, -1, -1},
-        {9, 11, 1, 0, 9, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {1, 4, 8, 1, 8, 11, 0, 5, 8, 5, 11, 8, -1, -1, -1, -1},
-        {5, 11, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 1, 10, 5, 10, 9, 9, 10, 8, -1, -1, -1, -1, -1, -1, -1},
-        {4, 0, 9, 4, 9, 10, 5, 1, 9, 1, 10, 9, -1, -1, -1, -1},
-        {0, 1, 10, 8, 0, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {4, 1, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {5, 4, 8, 9, 5, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 9, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {0, 4, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}};
+    const uint8_t SDFTree::s_triangle_table[256][15] = {
+        {},
+        {0, 8, 4},
+        {0, 5, 9},
+        {5, 8, 4, 9, 8, 5},
+        {4, 10, 1},
+        {0, 10, 1, 8, 10, 0},
+        {5, 9, 0, 1, 4, 10},
+        {5, 10, 1, 5, 9, 10, 9, 8, 10},
+        {5, 1, 11},
+        {0, 8, 4, 5, 1, 11},
+        {9, 1, 11, 0, 1, 9},
+        {1, 8, 4, 1, 11, 8, 11, 9, 8},
+        {4, 11, 5, 10, 11, 4},
+        {0, 11, 5, 0, 8, 11, 8, 10, 11},
+        {4, 9, 0, 4, 10, 9, 10, 11, 9},
+        {9, 8, 11, 11, 8, 10},
+        {2, 6, 8},
+        {2, 4, 0, 6, 4, 2},
+        {0, 5, 9, 8, 2, 6},
+        {2, 5, 9, 2, 6, 5, 6, 4, 5},
+        {8, 2, 6, 4, 10, 1},
+        {10, 2, 6, 10, 1, 2, 1, 0, 2},
+        {9, 0, 5, 8, 2, 6, 1, 4, 10},
+        {2, 6, 10, 9, 2, 10, 9, 10, 1, 9, 1, 5},
+        {5, 1, 11, 8, 2, 6},
+        {4, 2, 6, 4, 0, 2, 5, 1, 11},
+        {9, 1, 11, 9, 0, 1, 8, 2, 6},
+        {1, 11, 9, 1, 9, 6, 1, 6, 4, 6, 9, 2},
+        {4, 11, 5, 4, 10, 11, 6, 8, 2},
+        {5, 10, 11, 5, 2, 10, 5, 0, 2, 6, 10, 2},
+        {2, 6, 8, 9, 0, 10, 9, 10, 11, 10, 0, 4},
+        {2, 6, 10, 2, 10, 9, 9, 10, 11},
+        {9, 7, 2},
+        {9, 7, 2, 0, 8, 4},
+        {0, 7, 2, 5, 7, 0},
+        {8, 7, 2, 8, 4, 7, 4, 5, 7},
+        {9, 7, 2, 1, 4, 10},
+        {0, 10, 1, 0, 8, 10, 2, 9, 7},
+        {0, 7, 2, 0, 5, 7, 1, 4, 10},
+        {1, 5, 7, 1, 7, 8, 1, 8, 10, 2, 8, 7},
+        {5, 1, 11, 9, 7, 2},
+        {4, 0, 8, 5, 1, 11, 2, 9, 7},
+        {7, 1, 11, 7, 2, 1, 2, 0, 1},
+        {1, 11, 7, 4, 1, 7, 4, 7, 2, 4, 2, 8},
+        {11, 4, 10, 11, 5, 4, 9, 7, 2},
+        {2, 9, 7, 0, 8, 5, 8, 11, 5, 8, 10, 11},
+        {7, 2, 0, 7, 0, 10, 7, 10, 11, 10, 0, 4},
+        {7, 2, 8, 7, 8, 11, 11, 8, 10},
+        {9, 6, 8, 7, 6, 9},
+        {9, 4, 0, 9, 7, 4, 7, 6, 4},
+        {0, 6, 8, 0, 5, 6, 5, 7, 6},
+        {5, 7, 4, 4, 7, 6},
+        {6, 9, 7, 6, 8, 9, 4, 10, 1},
+        {9, 7, 6, 9, 6, 1, 9, 1, 0, 1, 6, 10},
+        {1, 4, 10, 0, 5, 8, 5, 6, 8, 5, 7, 6},
+        {10, 1, 5, 10, 5, 6, 6, 5, 7},
+        {9, 6, 8, 9, 7, 6, 11, 5, 1},
+        {11, 5, 1, 9, 7, 0, 7, 4, 0, 7, 6, 4},
+        {8, 0, 1, 8, 1, 7, 8, 7, 6, 11, 7, 1},
+        {1, 11, 7, 1, 7, 4, 4, 7, 6},
+        {9, 7, 8, 8, 7, 6, 11, 5, 4, 11, 4, 10},
+        {7, 6, 0, 7, 0, 9, 6, 10, 0, 5, 0, 11, 10, 11, 0},
+        {10, 11, 0, 10, 0, 4, 11, 7, 0, 8, 0, 6, 7, 6, 0},
+        {10, 11, 7, 6, 10, 7},
+        {6, 3, 10},
+        {4, 0, 8, 10, 6, 3},
+        {0, 5, 9, 10, 6, 3},
+        {8, 5, 9, 8, 4, 5, 10, 6, 3},
+        {6, 1, 4, 3, 1, 6},
+        {6, 0, 8, 6, 3, 0, 3, 1, 0},
+        {1, 6, 3, 1, 4, 6, 0, 5, 9},
+        {5, 3, 1, 5, 8, 3, 5, 9, 8, 8, 6, 3},
+        {11, 5, 1, 3, 10, 6},
+        {5, 1, 11, 4, 0, 8, 3, 10, 6},
+        {1, 9, 0, 1, 11, 9, 3, 10, 6},
+        {3, 10, 6, 1, 11, 4, 11, 8, 4, 11, 9, 8},
+        {11, 6, 3, 11, 5, 6, 5, 4, 6},
+        {11, 6, 3, 5, 6, 11, 5, 8, 6, 5, 0, 8},
+        {0, 4, 6, 0, 6, 11, 0, 11, 9, 3, 11, 6},
+        {6, 3, 11, 6, 11, 8, 8, 11, 9},
+        {3, 8, 2, 10, 8, 3},
+        {4, 3, 10, 4, 0, 3, 0, 2, 3},
+        {8, 3, 10, 8, 2, 3, 9, 0, 5},
+        {9, 2, 3, 9, 3, 4, 9, 4, 5, 10, 4, 3},
+        {8, 1, 4, 8, 2, 1, 2, 3, 1},
+        {0, 2, 1, 2, 3, 1},
+        {5, 9, 0, 1, 4, 2, 1, 2, 3, 2, 4, 8},
+        {5, 9, 2, 5, 2, 1, 1, 2, 3},
+        {3, 8, 2, 3, 10, 8, 1, 11, 5},
+        {5, 1, 11, 4, 0, 10, 0, 3, 10, 0, 2, 3},
+        {2, 10, 8, 2, 3, 10, 0, 1, 9, 1, 11, 9},
+        {11, 9, 4, 11, 4, 1, 9, 2, 4, 10, 4, 3, 2, 3, 4},
+        {8, 5, 4, 8, 3, 5, 8, 2, 3, 3, 11, 5},
+        {11, 5, 0, 11, 0, 3, 3, 0, 2},
+        {2, 3, 4, 2, 4, 8, 3, 11, 4, 0, 4, 9, 11, 9, 4},
+        {11, 9, 2, 3, 11, 2},
+        {2, 9, 7, 6, 3, 10},
+        {0, 8, 4, 2, 9, 7, 10, 6, 3},
+        {7, 0, 5, 7, 2, 0, 6, 3, 10},
+        {10, 6, 3, 8, 4, 2, 4, 7, 2, 4, 5, 7},
+        {6, 1, 4, 6, 3, 1, 7, 2, 9},
+        {9, 7, 2, 0, 8, 3, 0, 3, 1, 3, 8, 6},
+        {4, 3, 1, 4, 6, 3, 5, 7, 0, 7, 2, 0},
+        {3, 1, 8, 3, 8, 6, 1, 5, 8, 2, 8, 7, 5, 7, 8},
+        {9, 7, 2, 11, 5, 1, 6, 3, 10},
+        {3, 10, 6, 5, 1, 11, 0, 8, 4, 2, 9, 7},
+        {6, 3, 10, 7, 2, 11, 2, 1, 11, 2, 0, 1},
+        {4, 2, 8, 4, 7, 2, 4, 1, 7, 11, 7, 1, 10, 6, 3},
+        {9, 7, 2, 11, 5, 3, 5, 6, 3, 5, 4, 6},
+        {5, 3, 11, 5, 6, 3, 5, 0, 6, 8, 6, 0, 9, 7, 2},
+        {2, 0, 11, 2, 11, 7, 0, 4, 11, 3, 11, 6, 4, 6, 11},
+        {6, 3, 11, 6, 11, 8, 7, 2, 11, 2, 8, 11},
+        {3, 9, 7, 3, 10, 9, 10, 8, 9},
+        {4, 3, 10, 0, 3, 4, 0, 7, 3, 0, 9, 7},
+        {0, 10, 8, 0, 7, 10, 0, 5, 7, 7, 3, 10},
+        {3, 10, 4, 3, 4, 7, 7, 4, 5},
+        {7, 8, 9, 7, 1, 8, 7, 3, 1, 4, 8, 1},
+        {9, 7, 3, 9, 3, 0, 0, 3, 1},
+        {5, 7, 8, 5, 8, 0, 7, 3, 8, 4, 8, 1, 3, 1, 8},
+        {5, 7, 3, 1, 5, 3},
+        {5, 1, 11, 9, 7, 10, 9, 10, 8, 10, 7, 3},
+        {0, 10, 4, 0, 3, 10, 0, 9, 3, 7, 3, 9, 5, 1, 11},
+        {10, 8, 7, 10, 7, 3, 8, 0, 7, 11, 7, 1, 0, 1, 7},
+        {3, 10, 4, 3, 4, 7, 1, 11, 4, 11, 7, 4},
+        {5, 4, 3, 5, 3, 11, 4, 8, 3, 7, 3, 9, 8, 9, 3},
+        {11, 5, 0, 11, 0, 3, 9, 7, 0, 7, 3, 0},
+        {0, 4, 8, 7, 3, 11},
+        {11, 7, 3},
+        {11, 3, 7},
+        {0, 8, 4, 7, 11, 3},
+        {9, 0, 5, 7, 11, 3},
+        {5, 8, 4, 5, 9, 8, 7, 11, 3},
+        {1, 4, 10, 11, 3, 7},
+        {10, 0, 8, 10, 1, 0, 11, 3, 7},
+        {0, 5, 9, 1, 4, 10, 7, 11, 3},
+        {7, 11, 3, 5, 9, 1, 9, 10, 1, 9, 8, 10},
+        {5, 3, 7, 1, 3, 5},
+        {5, 3, 7, 5, 1, 3, 4, 0, 8},
+        {9, 3, 7, 9, 0, 3, 0, 1, 3},
+        {7, 9, 8, 7, 8, 1, 7, 1, 3, 4, 1, 8},
+        {3, 4, 10, 3, 7, 4, 7, 5, 4},
+        {0, 8, 10, 0, 10, 7, 0, 7, 5, 7, 10, 3},
+        {4, 10, 3, 0, 4, 3, 0, 3, 7, 0, 7, 9},
+        {3, 7, 9, 3, 9, 10, 10, 9, 8},
+        {7, 11, 3, 2, 6, 8},
+        {2, 4, 0, 2, 6, 4, 3, 7, 11},
+        {5, 9, 0, 7, 11, 3, 8, 2, 6},
+        {11, 3, 7, 5, 9, 6, 5, 6, 4, 6, 9, 2},
+        {4, 10, 1, 6, 8, 2, 11, 3, 7},
+        {7, 11, 3, 2, 6, 1, 2, 1, 0, 1, 6, 10},
+        {0, 5, 9, 2, 6, 8, 1, 4, 10, 7, 11, 3},
+        {9, 1, 5, 9, 10, 1, 9, 2, 10, 6, 10, 2, 7, 11, 3},
+        {3, 5, 1, 3, 7, 5, 2, 6, 8},
+        {5, 1, 7, 7, 1, 3, 4, 0, 2, 4, 2, 6},
+        {8, 2, 6, 9, 0, 7, 0, 3, 7, 0, 1, 3},
+        {6, 4, 9, 6, 9, 2, 4, 1, 9, 7, 9, 3, 1, 3, 9},
+        {8, 2, 6, 4, 10, 7, 4, 7, 5, 7, 10, 3},
+        {7, 5, 10, 7, 10, 3, 5, 0, 10, 6, 10, 2, 0, 2, 10},
+        {0, 7, 9, 0, 3, 7, 0, 4, 3, 10, 3, 4, 8, 2, 6},
+        {3, 7, 9, 3, 9, 10, 2, 6, 9, 6, 10, 9},
+        {11, 2, 9, 3, 2, 11},
+        {2, 11, 3, 2, 9, 11, 0, 8, 4},
+        {11, 0, 5, 11, 3, 0, 3, 2, 0},
+        {8, 4, 5, 8, 5, 3, 8, 3, 2, 3, 5, 11},
+        {11, 2, 9, 11, 3, 2, 10, 1, 4},
+        {0, 8, 1, 1, 8, 10, 2, 9, 11, 2, 11, 3},
+        {4, 10, 1, 0, 5, 3, 0, 3, 2, 3, 5, 11},
+        {3, 2, 5, 3, 5, 11, 2, 8, 5, 1, 5, 10, 8, 10, 5},
+        {5, 2, 9, 5, 1, 2, 1, 3, 2},
+        {4, 0, 8, 5, 1, 9, 1, 2, 9, 1, 3, 2},
+        {0, 1, 2, 2, 1, 3},
+        {8, 4, 1, 8, 1, 2, 2, 1, 3},
+        {9, 3, 2, 9, 4, 3, 9, 5, 4, 10, 3, 4},
+        {8, 10, 5, 8, 5, 0, 10, 3, 5, 9, 5, 2, 3, 2, 5},
+        {4, 10, 3, 4, 3, 0, 0, 3, 2},
+        {3, 2, 8, 10, 3, 8},
+        {6, 11, 3, 6, 8, 11, 8, 9, 11},
+        {0, 6, 4, 0, 11, 6, 0, 9, 11, 3, 6, 11},
+        {11, 3, 6, 5, 11, 6, 5, 6, 8, 5, 8, 0},
+        {11, 3, 6, 11, 6, 5, 5, 6, 4},
+        {1, 4, 10, 11, 3, 8, 11, 8, 9, 8, 3, 6},
+        {1, 0, 6, 1, 6, 10, 0, 9, 6, 3, 6, 11, 9, 11, 6},
+        {5, 8, 0, 5, 6, 8, 5, 11, 6, 3, 6, 11, 1, 4, 10},
+        {10, 1, 5, 10, 5, 6, 11, 3, 5, 3, 6, 5},
+        {5, 1, 3, 5, 3, 8, 5, 8, 9, 8, 3, 6},
+        {1, 3, 9, 1, 9, 5, 3, 6, 9, 0, 9, 4, 6, 4, 9},
+        {6, 8, 0, 6, 0, 3, 3, 0, 1},
+        {6, 4, 1, 3, 6, 1},
+        {8, 9, 3, 8, 3, 6, 9, 5, 3, 10, 3, 4, 5, 4, 3},
+        {0, 9, 5, 10, 3, 6},
+        {6, 8, 0, 6, 0, 3, 4, 10, 0, 10, 3, 0},
+        {6, 10, 3},
+        {10, 7, 11, 6, 7, 10},
+        {10, 7, 11, 10, 6, 7, 8, 4, 0},
+        {7, 10, 6, 7, 11, 10, 5, 9, 0},
+        {11, 6, 7, 11, 10, 6, 9, 8, 5, 8, 4, 5},
+        {1, 7, 11, 1, 4, 7, 4, 6, 7},
+        {8, 1, 0, 8, 7, 1, 8, 6, 7, 11, 1, 7},
+        {9, 0, 5, 7, 11, 4, 7, 4, 6, 4, 11, 1},
+        {9, 8, 1, 9, 1, 5, 8, 6, 1, 11, 1, 7, 6, 7, 1},
+        {10, 5, 1, 10, 6, 5, 6, 7, 5},
+        {0, 8, 4, 5, 1, 6, 5, 6, 7, 6, 1, 10},
+        {9, 6, 7, 9, 1, 6, 9, 0, 1, 1, 10, 6},
+        {6, 7, 1, 6, 1, 10, 7, 9, 1, 4, 1, 8, 9, 8, 1},
+        {5, 4, 7, 4, 6, 7},
+        {0, 8, 6, 0, 6, 5, 5, 6, 7},
+        {9, 0, 4, 9, 4, 7, 7, 4, 6},
+        {9, 8, 6, 7, 9, 6},
+        {7, 8, 2, 7, 11, 8, 11, 10, 8},
+        {7, 0, 2, 7, 10, 0, 7, 11, 10, 10, 4, 0},
+        {0, 5, 9, 8, 2, 11, 8, 11, 10, 11, 2, 7},
+        {11, 10, 2, 11, 2, 7, 10, 4, 2, 9, 2, 5, 4, 5, 2},
+        {1, 7, 11, 4, 7, 1, 4, 2, 7, 4, 8, 2},
+        {7, 11, 1, 7, 1, 2, 2, 1, 0},
+        {4, 11, 1, 4, 7, 11, 4, 8, 7, 2, 7, 8, 0, 5, 9},
+        {7, 11, 1, 7, 1, 2, 5, 9, 1, 9, 2, 1},
+        {1, 7, 5, 1, 8, 7, 1, 10, 8, 2, 7, 8},
+        {0, 2, 10, 0, 10, 4, 2, 7, 10, 1, 10, 5, 7, 5, 10},
+        {0, 1, 7, 0, 7, 9, 1, 10, 7, 2, 7, 8, 10, 8, 7},
+        {9, 2, 7, 1, 10, 4},
+        {8, 2, 7, 8, 7, 4, 4, 7, 5},
+        {0, 2, 7, 5, 0, 7},
+        {8, 2, 7, 8, 7, 4, 9, 0, 7, 0, 4, 7},
+        {9, 2, 7},
+        {2, 10, 6, 2, 9, 10, 9, 11, 10},
+        {0, 8, 4, 2, 9, 6, 9, 10, 6, 9, 11, 10},
+        {5, 11, 10, 5, 10, 2, 5, 2, 0, 6, 2, 10},
+        {4, 5, 2, 4, 2, 8, 5, 11, 2, 6, 2, 10, 11, 10, 2},
+        {1, 9, 11, 1, 6, 9, 1, 4, 6, 6, 2, 9},
+        {9, 11, 6, 9, 6, 2, 11, 1, 6, 8, 6, 0, 1, 0, 6},
+        {4, 6, 11, 4, 11, 1, 6, 2, 11, 5, 11, 0, 2, 0, 11},
+        {5, 11, 1, 8, 6, 2},
+        {2, 10, 6, 9, 10, 2, 9, 1, 10, 9, 5, 1},
+        {9, 6, 2, 9, 10, 6, 9, 5, 10, 1, 10, 5, 0, 8, 4},
+        {10, 6, 2, 10, 2, 1, 1, 2, 0},
+        {10, 6, 2, 10, 2, 1, 8, 4, 2, 4, 1, 2},
+        {2, 9, 5, 2, 5, 6, 6, 5, 4},
+        {2, 9, 5, 2, 5, 6, 0, 8, 5, 8, 6, 5},
+        {2, 0, 4, 6, 2, 4},
+        {2, 8, 6},
+        {9, 11, 8, 11, 10, 8},
+        {4, 0, 9, 4, 9, 10, 10, 9, 11},
+        {0, 5, 11, 0, 11, 8, 8, 11, 10},
+        {4, 5, 11, 10, 4, 11},
+        {1, 4, 8, 1, 8, 11, 11, 8, 9},
+        {9, 11, 1, 0, 9, 1},
+        {1, 4, 8, 1, 8, 11, 0, 5, 8, 5, 11, 8},
+        {5, 11, 1},
+        {5, 1, 10, 5, 10, 9, 9, 10, 8},
+        {4, 0, 9, 4, 9, 10, 5, 1, 9, 1, 10, 9},
+        {0, 1, 10, 8, 0, 10},
+        {4, 1, 10},
+        {5, 4, 8, 9, 5, 8},
+        {0, 9, 5},
+        {0, 4, 8},
+        {}};
+
+    const uint8_t SDFTree::s_triangle_count[256] = {
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 2,
+        1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 3,
+        1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 3,
+        2, 3, 3, 2, 3, 4, 4, 3, 3, 4, 4, 3, 4, 5, 5, 2,
+        1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 3,
+        2, 3, 3, 4, 3, 2, 4, 3, 3, 4, 4, 5, 4, 3, 5, 2,
+        2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 4,
+        3, 4, 4, 3, 4, 3, 5, 2, 4, 5, 5, 4, 5, 4, 2, 1,
+        1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 3,
+        2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 4,
+        2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 2, 3, 4, 5, 3, 2,
+        3, 4, 4, 3, 4, 5, 5, 4, 4, 5, 3, 2, 5, 2, 4, 1,
+        2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 2, 3, 3, 2,
+        3, 4, 4, 5, 4, 3, 5, 4, 4, 5, 5, 2, 3, 2, 4, 1,
+        3, 4, 4, 5, 4, 5, 5, 2, 4, 5, 3, 4, 3, 4, 2, 1,
+        2, 3, 3, 2, 3, 2, 4, 1, 3, 4, 2, 1, 2, 1, 1, 0};
 
     const char *type_str(SDFType type)
     {
@@ -1354,6 +5570,8 @@ namespace gm
             return "PRIMITIVE_OCTAHEDRON";
         case SDFType::PRIMITIVE_PYRAMID:
             return "PRIMITIVE_PYRAMID";
+        case SDFType::PRIMITIVE_GRID:
+            return "PRIMITIVE_GRID";
         case SDFType::UNARY_OPERATOR_HULL:
             return "UNARY_OPERATOR_HULL";
         case SDFType::UNARY_OPERATOR_ROUNDING:
@@ -1376,6 +5594,10 @@ namespace gm
             return "BINARY_OPERATOR_SUBSTRACTION";
         case SDFType::BINARY_OPERATOR_SMOOTH_SUBSTRACTION:
             return "BINARY_OPERATOR_SMOOTH_SUBSTRACTION";
+        case SDFType::NARY_OPERATOR_UNION:
+            return "NARY_OPERATOR_UNION";
+        case SDFType::NARY_OPERATOR_SMOOTH_UNION:
+            return "NARY_OPERATOR_SMOOTH_UNION";
         case SDFType::TRANSFORM_TRANSLATION:
             return "TRANSFORM_TRANSLATION";
         case SDFType::TRANSFORM_ROTATION:
@@ -1388,6 +5610,10 @@ namespace gm
             return "TRANSFORM_ROTATION_Z";
         case SDFType::TRANSFORM_SCALE:
             return "TRANSFORM_SCALE";
+        case SDFType::TRANSFORM_AFFINE:
+            return "TRANSFORM_AFFINE";
+        case SDFType::TRANSFORM_INSTANCES:
+            return "TRANSFORM_INSTANCES";
         }
 
         return "NULL";
@@ -0,0 +1,618 @@
+#include "SDFProgram.h"
+
+#include "SDF.h"
+#include "SDFKernels.h"
+
+namespace gm
+{
+    const int SDFProgram::s_inline_stack = 32;
+    const int SDFProgram::s_batch_size = 256;
+    const int SDFProgram::s_skip_size = 4;
+    const int SDFProgram::s_share_size = 2;
+
+    void SDFProgram::clear()
+    {
+        m_code.clear();
+        m_params.clear();
+        m_nodes.clear();
+
+        m_depth = m_max_depth = 0;
+        m_frames = m_max_frames = 0;
+        m_weight = 0;
+        m_slots = 0;
+        m_keys.clear();
+        m_shares.clear();
+    }
+
+    bool SDFProgram::empty() const
+    {
+        return m_code.empty();
+    }
+
+    int SDFProgram::size() const
+    {
+        return static_cast<int>(m_code.size());
+    }
+
+    /*!
+    \brief Returns the number of nodes evaluated by one program run, used to keep SDFNode::value_call_count() meaningful.
+    */
+    int SDFProgram::weight() const
+    {
+        return m_weight;
+    }
+
+    /*!
+    \brief Lower a tree, evaluating its identical sub-trees only once per point.
+
+    A first pass counts the occurrences of every sub-tree, identified by its fingerprint and by the point
+    operators of its frame : the same sub-tree under two different transforms is not shared.
+    The second pass wraps every occurrence of a repeated sub-tree between a SDFOpCode::LOAD and a SDFOpCode::STORE
+    on a shared memoization slot : the first occurrence reached fills the slot, the next ones jump over their code.
+    Occurrences skipped by a SDFOpCode::BOUND_SKIP leave the slot empty, so that bounds guards are kept.
+    Slots live for one point in the scalar evaluations and for one chunk in SDFProgram::value_batch.
+    \param root Root node, must outlive the program if it contains nodes without lowering.
+    \sa SDFNode::fingerprint
+    */
+    void SDFProgram::build(const SDFNode &root)
+    {
+        clear();
+        m_counting = true;
+        compile(root);
+        m_counting = false;
+
+        std::unordered_map<uint64_t, Share> shares = std::move(m_shares);
+        clear();
+        for (auto &[key, share] : shares)
+        {
+            if (share.uses > 1 && share.length >= s_share_size)
+                share.slot = m_slots++;
+        }
+
+        m_shares = std::move(shares);
+        compile(root);
+        m_shares.clear();
+    }
+
+    /*!
+    \brief Lower an operand, called by SDFNode::compile implementations instead of lowering their operands directly.
+    Outside of SDFProgram::build, this is the same as node.compile(*this).
+    */
+    void SDFProgram::compile(const SDFNode &node)
+    {
+        if (!m_counting && m_shares.empty())
+        {
+            node.compile(*this);
+            return;
+        }
+
+        const uint64_t k = key(node);
+        if (m_counting)
+        {
+            // Later occurrences are not lowered, so that their own sub-trees are not counted twice
+            if (m_shares[k].uses++ > 0)
+            {
+                m_depth++;
+                return;
+            }
+            const int start = size();
+            node.compile(*this);
+            m_shares[k].length = size() - start;
+            return;
+        }
+
+        auto it = m_shares.find(k);
+        if (it == m_shares.end() || it->second.slot < 0)
+        {
+            node.compile(*this);
+            return;
+        }
+
+        const float slot = static_cast<float>(it->second.slot);
+        const int index = size();
+        emit(SDFOpCode::LOAD, {slot, 0.f});
+
+        // Nodes are evaluated once whatever the number of occurrences
+        const int weight = m_weight;
+        node.compile(*this);
+        Share &share = m_shares[k];
+        if (share.lowered)
+            m_weight = weight;
+        share.lowered = true;
+
+        emit(SDFOpCode::STORE, {slot});
+        m_params[m_code[index].param + 1] = static_cast<float>(size() - index - 1);
+    }
+
+    //! Identifies a sub-tree evaluated in the current frame.
+    uint64_t SDFProgram::key(const SDFNode &node) const
+    {
+        const uint64_t fingerprint = node.fingerprint();
+        return m_keys.empty() ? fingerprint : utils::hash(fingerprint, m_keys.back());
+    }
+
+    /*!
+    \brief Append an instruction and its inline parameters.
+    \param op Operation code.
+    \param params Inline parameters, copied next to the previous instruction ones.
+    */
+    void SDFProgram::emit(SDFOpCode op, std::initializer_list<float> params)
+    {
+        m_code.push_back({op, static_cast<int>(m_params.size())});
+        m_params.insert(m_params.end(), params.begin(), params.end());
+
+        switch (op)
+        {
+        case SDFOpCode::PRIMITIVE_SPHERE:
+        case SDFOpCode::PRIMITIVE_BOX:
+        case SDFOpCode::PRIMITIVE_PLANE:
+        case SDFOpCode::PRIMITIVE_TORUS:
+        case SDFOpCode::PRIMITIVE_CAPSULE:
+        case SDFOpCode::PRIMITIVE_CYLINDER:
+        case SDFOpCode::NODE:
+            m_depth++;
+            m_weight++;
+            break;
+        case SDFOpCode::UNARY_OPERATOR_HULL:
+            m_weight++;
+            break;
+        case SDFOpCode::BINARY_OPERATOR_UNION:
+        case SDFOpCode::BINARY_OPERATOR_INTERSECTION:
+        case SDFOpCode::BINARY_OPERATOR_SUBSTRACTION:
+        case SDFOpCode::BINARY_OPERATOR_XOR:
+        case SDFOpCode::BINARY_OPERATOR_SMOOTH_UNION:
+        case SDFOpCode::BINARY_OPERATOR_SMOOTH_INTERSECTION:
+        case SDFOpCode::BINARY_OPERATOR_SMOOTH_SUBSTRACTION:
+            m_depth--;
+            m_weight++;
+            break;
+        case SDFOpCode::POINT_TRANSLATE:
+        case SDFOpCode::POINT_TRANSFORM:
+        case SDFOpCode::POINT_SCALE:
+        case SDFOpCode::POINT_REPEAT:
+        {
+            uint64_t key = utils::hash(op, m_keys.empty() ? 0xcbf29ce484222325ull : m_keys.back());
+            for (float param : params)
+                key = utils::hash(param, key);
+            m_keys.push_back(key);
+            m_frames++;
+            m_weight++;
+            break;
+        }
+        case SDFOpCode::POINT_POP:
+        case SDFOpCode::POINT_POP_SCALE:
+            m_keys.pop_back();
+            m_frames--;
+            break;
+        default:
+            break;
+        }
+
+        m_max_depth = std::max(m_max_depth, m_depth);
+        m_max_frames = std::max(m_max_frames, m_frames);
+    }
+
+    /*!
+    \brief Append a virtual call to a node that cannot be lowered.
+    The node must outlive the program.
+    */
+    void SDFProgram::emit(const SDFNode *node)
+    {
+        emit(SDFOpCode::NODE);
+        m_code.back().param = static_cast<int>(m_nodes.size());
+        m_nodes.push_back(node);
+    }
+
+    /*!
+    \brief Start a block of instructions, an operand followed by its union, skipped at evaluation when
+    the current point is farther from the operand bounds than the top value plus a blend radius.
+
+    The result is unchanged only if the operand is at least its distance to its bounds : callers guard
+    operands with SDFNode::conservative_bounds only.
+    \param bounds Bounds of the operand, see SDFNode::bounds.
+    \param k Blend radius of a smooth union.
+    \return Index of the instruction to be closed with SDFProgram::end_skip, -1 for unbounded operands.
+    */
+    int SDFProgram::begin_skip(const Box &bounds, float k)
+    {
+        if (!SDFNode::bounded(bounds))
+            return -1;
+
+        emit(SDFOpCode::BOUND_SKIP, {bounds[0](0), bounds[0](1), bounds[0](2), bounds[1](0), bounds[1](1), bounds[1](2), k, 0.f});
+        return size() - 1;
+    }
+
+    /*!
+    \brief Close a block started with SDFProgram::begin_skip.
+    Blocks too short to be worth the bounds test are left unguarded.
+    */
+    void SDFProgram::end_skip(int index)
+    {
+        if (index < 0)
+            return;
+
+        const int length = size() - index - 1;
+        if (length < s_skip_size)
+        {
+            // Jumps are relative, so that removing an instruction keeps nested blocks valid
+            m_code.erase(m_code.begin() + index);
+            return;
+        }
+        m_params[m_code[index].param + 7] = static_cast<float>(length);
+    }
+
+    /*!
+    \brief Evaluate the program at a given point.
+    \param p Point.
+    */
+    float SDFProgram::value(const Point &p) const
+    {
+        return evaluate<float>(p.x, p.y, p.z);
+    }
+
+    /*!
+    \brief Evaluate the program and its gradient at a given point.
+    \param x, y, z Point coordinates, with their gradient with respect to the differentiation variables.
+    */
+    Dual SDFProgram::value_dual(const Dual &x, const Dual &y, const Dual &z) const
+    {
+        return evaluate<Dual>(x, y, z);
+    }
+
+    //! Value of a node that cannot be lowered, on either number type.
+    static float node_value(const SDFNode *node, float x, float y, float z)
+    {
+        return node->value(Point(x, y, z));
+    }
+
+    static Dual node_value(const SDFNode *node, const Dual &x, const Dual &y, const Dual &z)
+    {
+        return node->value_dual(x, y, z);
+    }
+
+    /*!
+    \brief Scalar stack machine, instantiated on float for values and on Dual for gradients.
+    */
+    template <typename T>
+    T SDFProgram::evaluate(T x, T y, T z) const
+    {
+        struct Frame
+        {
+            T x, y, z;
+        };
+
+        T inline_values[s_inline_stack];
+        Frame inline_frames[s_inline_stack];
+        T inline_slots[s_inline_stack];
+        uint8_t inline_filled[s_inline_stack];
+
+        std::vector<T> heap_values;
+        std::vector<Frame> heap_frames;
+        std::vector<T> heap_slots;
+        std::vector<uint8_t> heap_filled;
+
+        T *values = inline_values;
+        Frame *frames = inline_frames;
+        T *slots = inline_slots;
+        uint8_t *filled = inline_filled;
+        if (m_max_depth > s_inline_stack)
+        {
+            heap_values.resize(m_max_depth);
+            values = heap_values.data();
+        }
+        if (m_max_frames > s_inline_stack)
+        {
+            heap_frames.resize(m_max_frames);
+            frames = heap_frames.data();
+        }
+        if (m_slots > s_inline_stack)
+        {
+            heap_slots.resize(m_slots);
+            heap_filled.resize(m_slots);
+            slots = heap_slots.data();
+            filled = heap_filled.data();
+        }
+        std::fill_n(filled, m_slots, 0);
+
+        int sp = 0;
+        int fp = 0;
+
+        const float *params = m_params.data();
+        for (int pc = 0; pc < int(m_code.size()); pc++)
+        {
+            const SDFInstruction &ins = m_code[pc];
+            const float *k = params + ins.param;
+            switch (ins.op)
+            {
+            case SDFOpCode::PRIMITIVE_SPHERE:
+                values[sp++] = kernel::Sphere()(x, y, z, k);
+                break;
+            case SDFOpCode::PRIMITIVE_BOX:
+                values[sp++] = kernel::Box()(x, y, z, k);
+                break;
+            case SDFOpCode::PRIMITIVE_PLANE:
+                values[sp++] = kernel::Plane()(x, y, z, k);
+                break;
+            case SDFOpCode::PRIMITIVE_TORUS:
+                values[sp++] = kernel::Torus()(x, y, z, k);
+                break;
+            case SDFOpCode::PRIMITIVE_CAPSULE:
+                values[sp++] = kernel::Capsule()(x, y, z, k);
+                break;
+            case SDFOpCode::PRIMITIVE_CYLINDER:
+                values[sp++] = kernel::Cylinder()(x, y, z, k);
+                break;
+            case SDFOpCode::NODE:
+                values[sp++] = node_value(m_nodes[ins.param], x, y, z);
+                break;
+            case SDFOpCode::UNARY_OPERATOR_HULL:
+                values[sp - 1] = kernel::Hull()(values[sp - 1], k);
+                break;
+            case SDFOpCode::BINARY_OPERATOR_UNION:
+                sp--;
+                values[sp - 1] = kernel::Union()(values[sp - 1], values[sp], k);
+                break;
+            case SDFOpCode::BINARY_OPERATOR_INTERSECTION:
+                sp--;
+                values[sp - 1] = kernel::Intersection()(values[sp - 1], values[sp], k);
+                break;
+            case SDFOpCode::BINARY_OPERATOR_SUBSTRACTION:
+                sp--;
+                values[sp - 1] = kernel::Substraction()(values[sp - 1], values[sp], k);
+                break;
+            case SDFOpCode::BINARY_OPERATOR_XOR:
+                sp--;
+                values[sp - 1] = kernel::XOR()(values[sp - 1], values[sp], k);
+                break;
+            case SDFOpCode::BINARY_OPERATOR_SMOOTH_UNION:
+                sp--;
+                values[sp - 1] = kernel::SmoothUnion()(values[sp - 1], values[sp], k);
+                break;
+            case SDFOpCode::BINARY_OPERATOR_SMOOTH_INTERSECTION:
+                sp--;
+                values[sp - 1] = kernel::SmoothIntersection()(values[sp - 1], values[sp], k);
+                break;
+            case SDFOpCode::BINARY_OPERATOR_SMOOTH_SUBSTRACTION:
+                sp--;
+                values[sp - 1] = kernel::SmoothSubstraction()(values[sp - 1], values[sp], k);
+                break;
+            case SDFOpCode::POINT_TRANSLATE:
+                frames[fp++] = {x, y, z};
+                kernel::Translate()(x, y, z, k);
+                break;
+            case SDFOpCode::POINT_TRANSFORM:
+                frames[fp++] = {x, y, z};
+                kernel::Transform()(x, y, z, k);
+                break;
+            case SDFOpCode::POINT_SCALE:
+                frames[fp++] = {x, y, z};
+                kernel::InverseScale()(x, y, z, k);
+                break;
+            case SDFOpCode::POINT_REPEAT:
+                frames[fp++] = {x, y, z};
+                kernel::Repeat()(x, y, z, k);
+                break;
+            case SDFOpCode::POINT_POP:
+                fp--;
+                x = frames[fp].x;
+                y = frames[fp].y;
+                z = frames[fp].z;
+                break;
+            case SDFOpCode::POINT_POP_SCALE:
+                fp--;
+                x = frames[fp].x;
+                y = frames[fp].y;
+                z = frames[fp].z;
+                values[sp - 1] = kernel::Scale()(values[sp - 1], k);
+                break;
+            case SDFOpCode::BOUND_SKIP:
+            {
+                // Inside the bounds, the operand may be below a negative top value
+                const float d = kernel::Outside()(primal(x), primal(y), primal(z), k);
+                if (d > 0.f && d >= primal(values[sp - 1]) + k[6])
+                    pc += static_cast<int>(k[7]);
+                break;
+            }
+            case SDFOpCode::LOAD:
+            {
+                const int slot = static_cast<int>(k[0]);
+                if (filled[slot])
+                {
+                    values[sp++] = slots[slot];
+                    pc += static_cast<int>(k[1]);
+                }
+                break;
+            }
+            case SDFOpCode::STORE:
+            {
+                const int slot = static_cast<int>(k[0]);
+                slots[slot] = values[sp - 1];
+                filled[slot] = 1;
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        return values[0];
+    }
+
+    /*!
+    \brief Evaluate the program on a batch of points stored as separate coordinate arrays.
+
+    Points are processed in chunks of s_batch_size lanes : every instruction runs over a whole chunk
+    before the next one is decoded, so the loop cost is shared by all the lanes and the kernels
+    run on SIMD registers.
+    \param xs, ys, zs Point coordinates.
+    \param out Field values, same size as the coordinate arrays.
+    */
+    void SDFProgram::value_batch(std::span<const float> xs, std::span<const float> ys, std::span<const float> zs, std::span<float> out) const
+    {
+        const int n = static_cast<int>(out.size());
+        const int chunk = s_batch_size;
+
+        // Value stack, point stack, memoization slots, current point and bounds distance, chunk lanes each
+        std::vector<float> memory((m_max_depth + 3 * m_max_frames + m_slots + 4) * chunk);
+        float *values = memory.data();
+        float *frames = values + m_max_depth * chunk;
+        float *slots = frames + 3 * m_max_frames * chunk;
+        float *qx = slots + m_slots * chunk;
+        float *qy = qx + chunk;
+        float *qz = qy + chunk;
+        float *outside = qz + chunk;
+        std::vector<uint8_t> filled(m_slots);
+
+        const float *params = m_params.data();
+        for (int first = 0; first < n; first += chunk)
+        {
+            const int count = std::min(chunk, n - first);
+
+            std::copy_n(xs.data() + first, count, qx);
+            std::copy_n(ys.data() + first, count, qy);
+            std::copy_n(zs.data() + first, count, qz);
+
+            std::fill(filled.begin(), filled.end(), 0);
+
+            int sp = 0;
+            int fp = 0;
+            for (int pc = 0; pc < int(m_code.size()); pc++)
+            {
+                const SDFInstruction &ins = m_code[pc];
+                const float *k = params + ins.param;
+                float *top = values + (sp - 1) * chunk;
+                float *push = values + sp * chunk;
+                switch (ins.op)
+                {
+                case SDFOpCode::PRIMITIVE_SPHERE:
+                    kernel::evaluate<kernel::Sphere>(qx, qy, qz, push, count, k);
+                    sp++;
+                    break;
+                case SDFOpCode::PRIMITIVE_BOX:
+                    kernel::evaluate<kernel::Box>(qx, qy, qz, push, count, k);
+                    sp++;
+                    break;
+                case SDFOpCode::PRIMITIVE_PLANE:
+                    kernel::evaluate<kernel::Plane>(qx, qy, qz, push, count, k);
+                    sp++;
+                    break;
+                case SDFOpCode::PRIMITIVE_TORUS:
+                    kernel::evaluate<kernel::Torus>(qx, qy, qz, push, count, k);
+                    sp++;
+                    break;
+                case SDFOpCode::PRIMITIVE_CAPSULE:
+                    kernel::evaluate<kernel::Capsule>(qx, qy, qz, push, count, k);
+                    sp++;
+                    break;
+                case SDFOpCode::PRIMITIVE_CYLINDER:
+                    kernel::evaluate<kernel::Cylinder>(qx, qy, qz, push, count, k);
+                    sp++;
+                    break;
+                case SDFOpCode::NODE:
+                    m_nodes[ins.param]->value_batch({qx, size_t(count)}, {qy, size_t(count)}, {qz, size_t(count)}, {push, size_t(count)});
+                    sp++;
+                    break;
+                case SDFOpCode::UNARY_OPERATOR_HULL:
+                    kernel::apply<kernel::Hull>(top, count, k);
+                    break;
+                case SDFOpCode::BINARY_OPERATOR_UNION:
+                    kernel::combine<kernel::Union>(top - chunk, top, count, k);
+                    sp--;
+                    break;
+                case SDFOpCode::BINARY_OPERATOR_INTERSECTION:
+                    kernel::combine<kernel::Intersection>(top - chunk, top, count, k);
+                    sp--;
+                    break;
+                case SDFOpCode::BINARY_OPERATOR_SUBSTRACTION:
+                    kernel::combine<kernel::Substraction>(top - chunk, top, count, k);
+                    sp--;
+                    break;
+                case SDFOpCode::BINARY_OPERATOR_XOR:
+                    kernel::combine<kernel::XOR>(top - chunk, top, count, k);
+                    sp--;
+                    break;
+                case SDFOpCode::BINARY_OPERATOR_SMOOTH_UNION:
+                    kernel::combine<kernel::SmoothUnion>(top - chunk, top, count, k);
+                    sp--;
+                    break;
+                case SDFOpCode::BINARY_OPERATOR_SMOOTH_INTERSECTION:
+                    kernel::combine<kernel::SmoothIntersection>(top - chunk, top, count, k);
+                    sp--;
+                    break;
+                case SDFOpCode::BINARY_OPERATOR_SMOOTH_SUBSTRACTION:
+                    kernel::combine<kernel::SmoothSubstraction>(top - chunk, top, count, k);
+                    sp--;
+                    break;
+                case SDFOpCode::POINT_TRANSLATE:
+                case SDFOpCode::POINT_TRANSFORM:
+                case SDFOpCode::POINT_SCALE:
+                case SDFOpCode::POINT_REPEAT:
+                {
+                    float *frame = frames + 3 * fp * chunk;
+                    std::copy_n(qx, count, frame);
+                    std::copy_n(qy, count, frame + chunk);
+                    std::copy_n(qz, count, frame + 2 * chunk);
+                    fp++;
+
+                    if (ins.op == SDFOpCode::POINT_TRANSLATE)
+                        kernel::transform<kernel::Translate>(qx, qy, qz, qx, qy, qz, count, k);
+                    else if (ins.op == SDFOpCode::POINT_TRANSFORM)
+                        kernel::transform<kernel::Transform>(qx, qy, qz, qx, qy, qz, count, k);
+                    else if (ins.op == SDFOpCode::POINT_SCALE)
+                        kernel::transform<kernel::InverseScale>(qx, qy, qz, qx, qy, qz, count, k);
+                    else
+                        kernel::transform<kernel::Repeat>(qx, qy, qz, qx, qy, qz, count, k);
+                    break;
+                }
+                case SDFOpCode::POINT_POP:
+                case SDFOpCode::POINT_POP_SCALE:
+                {
+                    fp--;
+                    const float *frame = frames + 3 * fp * chunk;
+                    std::copy_n(frame, count, qx);
+                    std::copy_n(frame + chunk, count, qy);
+                    std::copy_n(frame + 2 * chunk, count, qz);
+
+                    if (ins.op == SDFOpCode::POINT_POP_SCALE)
+                        kernel::apply<kernel::Scale>(top, count, k);
+                    break;
+                }
+                case SDFOpCode::BOUND_SKIP:
+                {
+                    // Skipped only if every lane of the chunk can skip it
+                    kernel::evaluate<kernel::Outside>(qx, qy, qz, outside, count, k);
+                    int i = 0;
+                    while (i < count && outside[i] > 0.f && outside[i] >= top[i] + k[6])
+                        i++;
+                    if (i == count)
+                        pc += static_cast<int>(k[7]);
+                    break;
+                }
+                case SDFOpCode::LOAD:
+                {
+                    // Chunk lanes are skipped together, so a slot is filled for all of them or none
+                    const int slot = static_cast<int>(k[0]);
+                    if (filled[slot])
+                    {
+                        std::copy_n(slots + slot * chunk, count, push);
+                        sp++;
+                        pc += static_cast<int>(k[1]);
+                    }
+                    break;
+                }
+                case SDFOpCode::STORE:
+                {
+                    const int slot = static_cast<int>(k[0]);
+                    std::copy_n(top, count, slots + slot * chunk);
+                    filled[slot] = 1;
+                    break;
+                }
+                default:
+                    break;
+                }
+            }
+
+            std::copy_n(values, count, out.data() + first);
+        }
+    }
+} // namespace gm
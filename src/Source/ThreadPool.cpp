@@ -0,0 +1,108 @@
+#include "ThreadPool.h"
+
+thread_local bool ThreadPool::s_inside_worker = false;
+
+/*!
+\brief Create a pool.
+\param threads Number of threads taking part in a loop, the calling one included. 0 uses the hardware concurrency.
+*/
+ThreadPool::ThreadPool(int threads)
+{
+    if (threads <= 0)
+        threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    m_workers.reserve(threads - 1);
+    for (int i = 0; i < threads - 1; i++)
+        m_workers.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread &thread : m_workers)
+        thread.join();
+}
+
+Ref<ThreadPool> ThreadPool::create(int threads)
+{
+    return create_ref<ThreadPool>(threads);
+}
+
+int ThreadPool::size() const
+{
+    return static_cast<int>(m_workers.size()) + 1;
+}
+
+/*!
+\brief Run task(i) for i in [0, count), returns once every index has been processed.
+Indices are handed out dynamically, one at a time, to balance uneven tasks.
+*/
+void ThreadPool::parallel_for(int count, const std::function<void(int)> &task)
+{
+    if (count <= 0)
+        return;
+
+    if (m_workers.empty() || count == 1 || s_inside_worker)
+    {
+        for (int i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(m_submit);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_running = static_cast<int>(m_workers.size());
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    s_inside_worker = true;
+    run();
+    s_inside_worker = false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]
+                { return m_running == 0; });
+    m_task = nullptr;
+}
+
+void ThreadPool::worker()
+{
+    s_inside_worker = true;
+
+    int generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]
+                        { return m_stop || m_generation != generation; });
+            if (m_stop)
+                return;
+            generation = m_generation;
+        }
+
+        run();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running--;
+        }
+        m_done.notify_one();
+    }
+}
+
+void ThreadPool::run()
+{
+    for (int i = m_next++; i < m_count; i = m_next++)
+        (*m_task)(i);
+}
@@ -847,6 +847,33 @@ int Viewer::render_params_sdf()
         m_slide_z = 0;
     }
 
+    if (ImGui::SliderInt("Threads", &m_sdf_threads, 0, static_cast<int>(std::thread::hardware_concurrency())))
+    {
+        m_sdf_tree->thread_count(m_sdf_threads);
+    }
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+    {
+        ImGui::SetTooltip("Threads used to polygonize the tree, 0 uses every core.");
+    }
+
+    if (ImGui::Checkbox("Octree", &m_sdf_octree))
+    {
+        m_sdf_tree->polygonize_method(m_sdf_octree ? gm::PolygonizeMethod::OCTREE : gm::PolygonizeMethod::UNIFORM);
+    }
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+    {
+        ImGui::SetTooltip("Only polygonize the cells an octree could not prove empty.");
+    }
+
+    if (ImGui::Checkbox("Lattice normals", &m_sdf_lattice_normals))
+    {
+        m_sdf_tree->normal_method(m_sdf_lattice_normals ? gm::NormalMethod::LATTICE : gm::NormalMethod::GRADIENT);
+    }
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+    {
+        ImGui::SetTooltip("Interpolate normals from the grid samples instead of evaluating the gradient at every vertex.");
+    }
+
     render_sdf_buttons();
 
     return 0;
@@ -85,22 +85,22 @@ Point operator%(const Point &p, int t)
 
 Vector abs( const Vector& a )
 {
-    return { abs(a(0)), abs(a(1)), abs(a(2)) };
+    return { std::abs(a(0)), std::abs(a(1)), std::abs(a(2)) };
 }
 
 Point abs( const Point& a )
 {
-    return { abs(a(0)), abs(a(1)), abs(a(2)) };
+    return { std::abs(a(0)), std::abs(a(1)), std::abs(a(2)) };
 }
 
 Point round(const Point &a)
 {
-    return { round(a.x), round(a.y), round(a.z) };
+    return { std::round(a.x), std::round(a.y), std::round(a.z) };
 }
 
 vec2 abs(const vec2 &a)
 {
-    return { abs(a.x), abs(a.y) };
+    return { std::abs(a.x), std::abs(a.y) };
 }
 
 vec2 max(const vec2 &a, float s)